@@ -52,6 +52,14 @@ namespace usami
         return subzero || inf_test || nan_test;
     }
 
+    /**
+     * Perceived brightness of a linear sRGB color, see ITU-R BT.709
+     */
+    inline float Luminance(const SpectrumRGB& s) noexcept
+    {
+        return .2126f * s[0] + .7152f * s[1] + .0722f * s[2];
+    }
+
     inline float GammaCorrect(float u, float gamma) noexcept
     {
         return Pow(u, 1.f / gamma);
@@ -0,0 +1,44 @@
+#pragma once
+#include "usami/common.h"
+#include <cstdint>
+#include <span>
+
+namespace usami
+{
+    /**
+     * 64-bit FNV-1a hash, whose digest is stable across runs and platforms, e.g. to key files
+     * cached on disk
+     */
+    class Fnv1aHash
+    {
+    private:
+        static constexpr uint64_t kOffsetBasis = 0xCBF29CE484222325ull;
+        static constexpr uint64_t kPrime       = 0x00000100000001B3ull;
+
+        uint64_t state_ = kOffsetBasis;
+
+    public:
+        void Update(std::span<const std::byte> data) noexcept
+        {
+            for (std::byte b : data)
+            {
+                state_ = (state_ ^ static_cast<uint64_t>(b)) * kPrime;
+            }
+        }
+
+        /**
+         * Hash object representation of a value, which should have no padding
+         */
+        template <typename T>
+            requires std::is_trivially_copyable_v<T>
+        void Update(const T& value) noexcept
+        {
+            Update(std::as_bytes(std::span{&value, 1}));
+        }
+
+        uint64_t Digest() const noexcept
+        {
+            return state_;
+        }
+    };
+} // namespace usami
@@ -1,70 +1,308 @@
 #pragma once
 #include "usami/math/math.h"
+#include "usami/parallel/parallel_for.h"
+#include <algorithm>
 #include <vector>
 
 namespace usami
 {
+    /**
+     * Discrete distribution over indices in proportion to given weights
+     *
+     * Sampling uses an alias table (Vose's method): each of n bins of equal probability holds an
+     * index and its alias, and a sample picks a bin by the integer part of `u * n` and either
+     * index by the fraction. So both sampling and pmf of an index cost O(1), and the table is built
+     * in O(n).
+     */
     class DiscrateDistribution
     {
+    private:
+        struct Bin
+        {
+            // probability of picking the index of the bin over its alias
+            float threshold;
+
+            // probability of the index of the bin being sampled
+            float pmf;
+
+            int alias;
+        };
+
+        std::vector<Bin> bins_ = {Bin{.threshold = 1.f, .pmf = 1.f, .alias = 0}};
+
     public:
         DiscrateDistribution() = default;
-        DiscrateDistribution(const float* weight_begin, const float* weight_end) : thresholds_{}
+        DiscrateDistribution(const float* weight_begin, const float* weight_end)
         {
             Reset(weight_begin, weight_end);
         }
 
-        int Sample(float u, float& pdf_out) const
+        int Size() const noexcept
         {
-            if (u < thresholds_.front())
+            return static_cast<int>(bins_.size());
+        }
+
+        int Sample(float u, float& pdf_out) const noexcept
+        {
+            int n          = Size();
+            float x        = u * n;
+            int index      = Min(static_cast<int>(x), n - 1);
+            float frac     = Min(x - index, kOneMinusEpsilon);
+            const Bin& bin = bins_[index];
+
+            int result = frac < bin.threshold ? index : bin.alias;
+            pdf_out    = bins_[result].pmf;
+            return result;
+        }
+
+        /**
+         * Probability of `index` being sampled
+         */
+        float Pmf(int index) const noexcept
+        {
+            USAMI_ASSERT(index >= 0 && index < Size());
+            return bins_[index].pmf;
+        }
+
+        /**
+         * Rebuild the table from weights, where indices of zero weights are never sampled
+         *
+         * An empty range or zero total weight gives a uniform distribution instead.
+         */
+        void Reset(const float* weight_begin, const float* weight_end)
+        {
+            int n = static_cast<int>(std::distance(weight_begin, weight_end));
+            if (n <= 0)
             {
-                pdf_out = thresholds_.front();
-                return 0;
+                bins_ = {Bin{.threshold = 1.f, .pmf = 1.f, .alias = 0}};
+                return;
             }
 
-            for (int i = 1; i < thresholds_.size(); ++i)
+            // accumulate in double so that millions of weights don't lose precision
+            double total = 0;
+            for (const float* p = weight_begin; p != weight_end; ++p)
             {
-                if (u < thresholds_[i])
+                USAMI_ASSERT(*p >= 0);
+                total += *p;
+            }
+
+            bins_.resize(n);
+            if (total == 0)
+            {
+                for (int i = 0; i < n; ++i)
                 {
-                    pdf_out = thresholds_[i] - thresholds_[i - 1];
-                    return i;
+                    bins_[i] = Bin{.threshold = 1.f, .pmf = 1.f / n, .alias = i};
                 }
+
+                return;
+            }
+
+            // weights scaled so that each bin holds a total of 1, split into those under and over
+            std::vector<double> scaled(n);
+            std::vector<int> under;
+            std::vector<int> over;
+            for (int i = 0; i < n; ++i)
+            {
+                double pmf = weight_begin[i] / total;
+
+                scaled[i] = pmf * n;
+                bins_[i]  = Bin{.threshold = 1.f, .pmf = static_cast<float>(pmf), .alias = i};
+                (scaled[i] < 1 ? under : over).push_back(i);
             }
 
-            // error
-            pdf_out = 0;
-            return -1;
+            // fill each under-full bin with an over-full index, which remains in either list by
+            // what's left of it
+            while (!under.empty() && !over.empty())
+            {
+                int i = under.back();
+                int j = over.back();
+                under.pop_back();
+                over.pop_back();
+
+                bins_[i].threshold = static_cast<float>(scaled[i]);
+                bins_[i].alias     = j;
+
+                scaled[j] -= 1 - scaled[i];
+                (scaled[j] < 1 ? under : over).push_back(j);
+            }
+
+            // bins left are full up to rounding error
+            for (int i : under)
+            {
+                bins_[i].threshold = 1.f;
+            }
+            for (int i : over)
+            {
+                bins_[i].threshold = 1.f;
+            }
         }
+    };
 
-        void Reset(const float* weight_begin, const float* weight_end)
+    /**
+     * Piecewise-constant distribution over the unit square in proportion to a function given on
+     * a grid of `width * height` cells, see PBRT 3 13.6.7
+     *
+     * A sample picks a row by the marginal distribution of row sums, and then a point in the row
+     * by its conditional distribution, both by binary search over CDFs. So sampling costs
+     * O(log width + log height), while pdf of a point costs O(1).
+     */
+    class Distribution2D
+    {
+    private:
+        int width_  = 0;
+        int height_ = 0;
+
+        // function value of each cell, row by row
+        std::vector<float> func_;
+
+        // CDF of each row, i.e. `width_ + 1` entries per row
+        std::vector<float> conditional_cdf_;
+
+        // integral of each row over [0, 1]
+        std::vector<float> row_integral_;
+
+        // CDF of rows by their integral, `height_ + 1` entries
+        std::vector<float> marginal_cdf_;
+
+        // integral of the function over the unit square
+        float integral_ = 0.f;
+
+    public:
+        Distribution2D() = default;
+        Distribution2D(std::vector<float> func, int width, int height)
+        {
+            Reset(std::move(func), width, height);
+        }
+
+        int Width() const noexcept
         {
-            thresholds_.clear();
+            return width_;
+        }
+        int Height() const noexcept
+        {
+            return height_;
+        }
+
+        /**
+         * Sample a point in the unit square, where `pdf_out` is its density over the square
+         */
+        Point2f Sample(const Point2f& u, float& pdf_out) const noexcept
+        {
+            USAMI_ASSERT(width_ > 0 && height_ > 0);
+
+            int row;
+            float v            = SampleCdf(marginal_cdf_.data(), height_, u[1], row);
+            float row_integral = row_integral_[row];
+            float pdf_row      = integral_ > 0 ? row_integral / integral_ : 1.f;
 
-            int num_output = std::distance(weight_begin, weight_end);
-            if (num_output <= 0)
+            int col;
+            float x = SampleCdf(conditional_cdf_.data() + static_cast<size_t>(row) * (width_ + 1),
+                                width_, u[0], col);
+            float pdf_col = row_integral > 0 ? func_[Index(col, row)] / row_integral : 1.f;
+
+            pdf_out = pdf_row * pdf_col;
+            return Point2f{x, v};
+        }
+
+        /**
+         * Density of sampling point `p` in the unit square
+         */
+        float Pdf(const Point2f& p) const noexcept
+        {
+            USAMI_ASSERT(width_ > 0 && height_ > 0);
+            if (integral_ == 0)
             {
-                thresholds_ = {1.f};
-                return;
+                return 1.f;
             }
 
-            thresholds_.reserve(num_output);
+            int col = Clamp(static_cast<int>(p[0] * width_), 0, width_ - 1);
+            int row = Clamp(static_cast<int>(p[1] * height_), 0, height_ - 1);
+            return func_[Index(col, row)] / integral_;
+        }
 
-            float acc = 0;
-            for (const float* p = weight_begin; p != weight_end; ++p)
-            {
-                USAMI_ASSERT(*p > 0);
+        /**
+         * Rebuild the distribution from non-negative function values of `width * height` cells
+         * stored row by row, where rows are processed in parallel
+         *
+         * Cells of zero value are never sampled, unless the function is zero everywhere, which
+         * gives a uniform distribution instead.
+         */
+        void Reset(std::vector<float> func, int width, int height)
+        {
+            USAMI_REQUIRE(width > 0 && height > 0);
+            USAMI_REQUIRE(func.size() == static_cast<size_t>(width) * height);
+
+            width_  = width;
+            height_ = height;
+            func_   = std::move(func);
+            conditional_cdf_.resize(static_cast<size_t>(height) * (width + 1));
+            row_integral_.resize(height);
+            marginal_cdf_.resize(height + 1);
+
+            ParallelFor(0, height, [&](size_t row) {
+                row_integral_[row] =
+                    BuildCdf(func_.data() + Index(0, static_cast<int>(row)), width,
+                             conditional_cdf_.data() + row * (width + 1));
+            });
 
-                acc += *p;
-                thresholds_.push_back(acc);
+            integral_ = BuildCdf(row_integral_.data(), height, marginal_cdf_.data());
+        }
+
+    private:
+        size_t Index(int col, int row) const noexcept
+        {
+            return static_cast<size_t>(row) * width_ + col;
+        }
+
+        // write normalized CDF of `n` cells into `cdf_out`, and return integral over [0, 1]
+        static float BuildCdf(const float* func, int n, float* cdf_out) noexcept
+        {
+            // accumulate in double so that long rows don't lose precision
+            double sum = 0;
+            cdf_out[0] = 0.f;
+            for (int i = 0; i < n; ++i)
+            {
+                USAMI_ASSERT(func[i] >= 0);
+                sum += func[i];
+                cdf_out[i + 1] = static_cast<float>(sum);
             }
 
-            for (float& x : thresholds_)
+            if (sum == 0)
+            {
+                for (int i = 1; i <= n; ++i)
+                {
+                    cdf_out[i] = static_cast<float>(i) / n;
+                }
+            }
+            else
             {
-                x /= acc;
+                for (int i = 1; i <= n; ++i)
+                {
+                    cdf_out[i] = static_cast<float>(cdf_out[i] / sum);
+                }
             }
+
+            cdf_out[n] = 1.f;
+            return static_cast<float>(sum / n);
         }
 
-    private:
-        std::vector<float> thresholds_{1.f};
+        // invert CDF of `n` cells at `u`, returning the point in [0, 1) and its cell
+        static float SampleCdf(const float* cdf, int n, float u, int& index_out) noexcept
+        {
+            // last entry not greater than u, skipping cells of zero probability
+            int index = static_cast<int>(std::upper_bound(cdf, cdf + n + 1, u) - cdf) - 1;
+            index     = Clamp(index, 0, n - 1);
+
+            float du    = u - cdf[index];
+            float width = cdf[index + 1] - cdf[index];
+            if (width > 0)
+            {
+                du /= width;
+            }
+
+            index_out = index;
+            return Min((index + Clamp(du, 0.f, 1.f)) / n, kOneMinusEpsilon);
+        }
     };
 
-} // namespace usami
\ No newline at end of file
+} // namespace usami
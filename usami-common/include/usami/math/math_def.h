@@ -6,6 +6,9 @@ namespace usami
 {
     constexpr float kFloatEpsilon = 1e-7;
 
+    // largest float below 1, to which a remapped unit sample is clamped
+    constexpr float kOneMinusEpsilon = 0x1.fffffep-1f;
+
     constexpr float kPi     = std::numbers::pi_v<float>;
     constexpr float kHalfPi = .5f * kPi;
     constexpr float kTwoPi  = 2.f * kPi;
@@ -14,6 +17,13 @@ namespace usami
     constexpr float kInvHalfPi = 1.f / kHalfPi;
     constexpr float kInvTwoPi  = 1.f / kTwoPi;
 
+    // number of floats in the widest SIMD register targeted by this build
+#if defined(__AVX__)
+    constexpr int kSimdFloatWidth = 8;
+#else
+    constexpr int kSimdFloatWidth = 4;
+#endif
+
     template <typename T>
     concept ScalarType = std::integral<T> || std::floating_point<T>;
 
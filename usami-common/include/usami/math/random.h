@@ -59,6 +59,20 @@ namespace usami
         uint64_t s[4]; // engine state
     };
 
+    /**
+     * Derives a well-distributed seed from a base seed and a stream index, e.g. a pixel index.
+     * Streams derived from the same base seed are independent of each other.
+     *
+     * Reference: splitmix64 finalizer, http://xoshiro.di.unimi.it/splitmix64.c
+     */
+    inline constexpr uint64_t MixSeed(uint64_t seed, uint64_t stream) noexcept
+    {
+        uint64_t z = seed + (stream + 1) * 0x9e3779b97f4a7c15u;
+        z          = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9u;
+        z          = (z ^ (z >> 27)) * 0x94d049bb133111ebu;
+        return z ^ (z >> 31);
+    }
+
     /**
      * Uniformly samples a float in [0, 1)
      *
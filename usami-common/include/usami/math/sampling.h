@@ -82,4 +82,18 @@ namespace usami
         return z / kPi;
     }
 
+    /**
+     * Weight of a sample drawn by strategy f against another strategy g that may draw the same
+     * sample, by the power heuristic with exponent 2, see PBRT 3 13.10.1
+     *
+     * @param pdf_f density of the sample by f, scaled by the number of samples f takes
+     * @param pdf_g density of the sample by g, scaled by the number of samples g takes
+     */
+    inline float PowerHeuristic(float pdf_f, float pdf_g) noexcept
+    {
+        float f2 = pdf_f * pdf_f;
+        float g2 = pdf_g * pdf_g;
+        return f2 > 0 ? f2 / (f2 + g2) : 0.f;
+    }
+
 } // namespace usami
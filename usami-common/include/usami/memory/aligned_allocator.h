@@ -0,0 +1,48 @@
+#pragma once
+#include <cstddef>
+#include <new>
+
+namespace usami
+{
+    /**
+     * Allocator for standard containers whose storage starts at a multiple of `Alignment` bytes,
+     * e.g. a cache line, regardless of alignment of `T`
+     */
+    template <typename T, size_t Alignment>
+    class AlignedAllocator
+    {
+        static_assert((Alignment & (Alignment - 1)) == 0 && Alignment >= alignof(T));
+
+    public:
+        using value_type = T;
+
+        template <typename U>
+        struct rebind
+        {
+            using other = AlignedAllocator<U, Alignment>;
+        };
+
+        AlignedAllocator() noexcept = default;
+
+        template <typename U>
+        AlignedAllocator(const AlignedAllocator<U, Alignment>&) noexcept
+        {
+        }
+
+        T* allocate(size_t n)
+        {
+            return static_cast<T*>(::operator new(n * sizeof(T), std::align_val_t{Alignment}));
+        }
+
+        void deallocate(T* p, size_t) noexcept
+        {
+            ::operator delete(p, std::align_val_t{Alignment});
+        }
+
+        template <typename U>
+        bool operator==(const AlignedAllocator<U, Alignment>&) const noexcept
+        {
+            return true;
+        }
+    };
+} // namespace usami
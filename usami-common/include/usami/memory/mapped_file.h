@@ -0,0 +1,39 @@
+#pragma once
+#include "usami/common.h"
+#include <filesystem>
+#include <span>
+
+namespace usami
+{
+    /**
+     * Read-only view of a whole file mapped into memory, whose pages are loaded on demand
+     */
+    class MappedFile final : public UsamiObject
+    {
+    private:
+        const std::byte* data_ = nullptr;
+        size_t size_           = 0;
+
+#ifdef _WIN32
+        void* file_handle_    = nullptr;
+        void* mapping_handle_ = nullptr;
+#endif
+
+        MappedFile() = default;
+
+    public:
+        ~MappedFile();
+
+        /**
+         * Map a file, which is required to be not empty
+         *
+         * @return nullptr if the file cannot be opened or mapped
+         */
+        static unique_ptr<MappedFile> Open(const std::filesystem::path& path);
+
+        std::span<const std::byte> Data() const noexcept
+        {
+            return {data_, size_};
+        }
+    };
+} // namespace usami
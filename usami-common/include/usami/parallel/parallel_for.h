@@ -0,0 +1,83 @@
+#pragma once
+#include "usami/parallel/task_group.h"
+#include <algorithm>
+
+namespace usami
+{
+    namespace detail
+    {
+        template <typename F>
+        void ParallelForSplit(TaskGroup& group, size_t begin, size_t end, size_t grain, const F& f)
+        {
+            // fork the upper half and keep the lower one, so that thieves take large chunks first
+            while (end - begin > grain)
+            {
+                size_t mid = begin + (end - begin) / 2;
+                group.Run([&group, mid, end, grain, &f] {
+                    ParallelForSplit(group, mid, end, grain, f);
+                });
+
+                end = mid;
+            }
+
+            f(begin, end);
+        }
+    } // namespace detail
+
+    /**
+     * Default grain that splits a range into a few chunks per worker slot
+     */
+    inline size_t DefaultParallelGrain(size_t count, const ThreadPool& pool = ThreadPool::Global())
+    {
+        return std::max<size_t>(1, count / (8 * pool.NumWorkerSlots()));
+    }
+
+    /**
+     * Invoke `f(chunk_begin, chunk_end)` over disjoint chunks of [begin, end) in parallel, where a
+     * chunk is no longer than `grain`. It returns after all chunks are finished.
+     */
+    template <typename F>
+    void ParallelForRange(size_t begin, size_t end, size_t grain, const F& f,
+                          ThreadPool& pool = ThreadPool::Global())
+    {
+        USAMI_REQUIRE(grain > 0);
+        if (begin >= end)
+        {
+            return;
+        }
+
+        if (end - begin <= grain || pool.NumWorkers() == 0)
+        {
+            f(begin, end);
+            return;
+        }
+
+        TaskGroup group{pool};
+        detail::ParallelForSplit(group, begin, end, grain, f);
+        group.Wait();
+    }
+
+    /**
+     * Invoke `f(i)` for every i in [begin, end) in parallel, see `ParallelForRange`
+     */
+    template <typename F>
+    void ParallelFor(size_t begin, size_t end, size_t grain, const F& f,
+                     ThreadPool& pool = ThreadPool::Global())
+    {
+        ParallelForRange(
+            begin, end, grain,
+            [&f](size_t chunk_begin, size_t chunk_end) {
+                for (size_t i = chunk_begin; i < chunk_end; ++i)
+                {
+                    f(i);
+                }
+            },
+            pool);
+    }
+
+    template <typename F>
+    void ParallelFor(size_t begin, size_t end, const F& f, ThreadPool& pool = ThreadPool::Global())
+    {
+        ParallelFor(begin, end, DefaultParallelGrain(end - begin, pool), f, pool);
+    }
+} // namespace usami
@@ -0,0 +1,96 @@
+#pragma once
+#include "usami/parallel/parallel_for.h"
+#include <algorithm>
+#include <array>
+#include <span>
+#include <vector>
+
+namespace usami
+{
+    /**
+     * Sort `data` by unsigned integer keys of `key_bits` bits in parallel
+     *
+     * It's a stable least significant digit radix sort over 8-bit digits, where each pass counts
+     * digits of chunks in parallel and then scatters the chunks in parallel. `key(x)` is evaluated
+     * twice per element each pass, so it should be cheap.
+     */
+    template <typename T, typename KeyFn>
+    void ParallelRadixSort(std::span<T> data, int key_bits, const KeyFn& key,
+                           ThreadPool& pool = ThreadPool::Global())
+    {
+        constexpr int kDigitBits       = 8;
+        constexpr int kNumBucket       = 1 << kDigitBits;
+        constexpr size_t kMinChunkSize = 1 << 14;
+
+        using Histogram = std::array<size_t, kNumBucket>;
+
+        size_t n = data.size();
+        if (n <= 1)
+        {
+            return;
+        }
+
+        size_t num_chunk  = std::clamp<size_t>(n / kMinChunkSize, 1, 4 * pool.NumWorkerSlots());
+        size_t chunk_size = (n + num_chunk - 1) / num_chunk;
+
+        std::vector<T> buffer(n);
+        std::vector<Histogram> offsets(num_chunk);
+
+        std::span<T> src = data;
+        std::span<T> dst = buffer;
+        for (int shift = 0; shift < key_bits; shift += kDigitBits)
+        {
+            auto digit = [&](const T& x) {
+                return static_cast<size_t>((key(x) >> shift) & (kNumBucket - 1));
+            };
+
+            // count digits of each chunk
+            ParallelFor(
+                0, num_chunk, 1,
+                [&](size_t ichunk) {
+                    Histogram& hist = offsets[ichunk];
+                    hist.fill(0);
+
+                    size_t end = std::min(n, (ichunk + 1) * chunk_size);
+                    for (size_t i = ichunk * chunk_size; i < end; ++i)
+                    {
+                        hist[digit(src[i])] += 1;
+                    }
+                },
+                pool);
+
+            // turn counts into the first output slot of each digit of each chunk, where a digit
+            // of an earlier chunk goes first to keep the sort stable
+            size_t acc = 0;
+            for (int k = 0; k < kNumBucket; ++k)
+            {
+                for (Histogram& hist : offsets)
+                {
+                    size_t count = hist[k];
+                    hist[k]      = acc;
+                    acc += count;
+                }
+            }
+
+            ParallelFor(
+                0, num_chunk, 1,
+                [&](size_t ichunk) {
+                    Histogram& hist = offsets[ichunk];
+
+                    size_t end = std::min(n, (ichunk + 1) * chunk_size);
+                    for (size_t i = ichunk * chunk_size; i < end; ++i)
+                    {
+                        dst[hist[digit(src[i])]++] = src[i];
+                    }
+                },
+                pool);
+
+            std::swap(src, dst);
+        }
+
+        if (src.data() != data.data())
+        {
+            std::copy(src.begin(), src.end(), data.begin());
+        }
+    }
+} // namespace usami
@@ -0,0 +1,92 @@
+#pragma once
+#include "usami/parallel/thread_pool.h"
+#include <exception>
+#include <utility>
+
+namespace usami
+{
+    /**
+     * A set of tasks forked into a thread pool and joined by `Wait`
+     *
+     * Tasks may run other tasks in the same group or create nested groups. The waiting thread
+     * executes pending tasks of the pool until every task of the group is finished, so a worker
+     * blocked on a nested group never idles. Any pending task may be picked up this way unless the
+     * wait is within `ThreadPool::Isolate`.
+     */
+    class TaskGroup final : public UsamiObject
+    {
+    public:
+        TaskGroup(ThreadPool& pool = ThreadPool::Global()) : pool_(pool)
+        {
+        }
+        ~TaskGroup()
+        {
+            // tasks may reference objects on the stack of the creator
+            WaitAux();
+        }
+
+        ThreadPool& Pool() const noexcept
+        {
+            return pool_;
+        }
+
+        /**
+         * Fork a task, which could be called from any thread
+         */
+        template <typename F>
+        void Run(F&& f)
+        {
+            num_unfinished_.fetch_add(1, std::memory_order_relaxed);
+            pool_.Submit([this, f = std::forward<F>(f)]() mutable {
+                try
+                {
+                    f();
+                }
+                catch (...)
+                {
+                    std::lock_guard lock{error_mutex_};
+                    if (error_ == nullptr)
+                    {
+                        error_ = std::current_exception();
+                    }
+                }
+
+                num_unfinished_.fetch_sub(1, std::memory_order_release);
+            });
+        }
+
+        /**
+         * Wait for all forked tasks, rethrowing the first exception thrown by any of them
+         */
+        void Wait()
+        {
+            WaitAux();
+
+            if (error_ != nullptr)
+            {
+                std::rethrow_exception(std::exchange(error_, nullptr));
+            }
+        }
+
+    private:
+        void WaitAux() noexcept
+        {
+            while (num_unfinished_.load(std::memory_order_acquire) > 0)
+            {
+                if (!pool_.RunPendingTask())
+                {
+                    // remaining tasks are being executed by other threads
+                    std::this_thread::yield();
+                }
+            }
+        }
+
+    private:
+        ThreadPool& pool_;
+
+        std::atomic<int64_t> num_unfinished_ = 0;
+
+        std::mutex error_mutex_;
+        std::exception_ptr error_ = nullptr;
+    };
+} // namespace usami
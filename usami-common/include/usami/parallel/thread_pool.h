@@ -0,0 +1,129 @@
+#pragma once
+#include "usami/common.h"
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace usami
+{
+    /**
+     * A work-stealing thread pool
+     *
+     * Every worker owns a task deque where it pushes and pops tasks at the back, and steals from
+     * the front of other deques when it runs out of work. Tasks submitted from threads outside of
+     * the pool go into a shared injection queue. A thread waiting for tasks is expected to help
+     * executing pending tasks (see `TaskGroup::Wait`) so that fork/join parallelism may nest.
+     *
+     * NOTE idle workers sleep instead of spinning, so the pool doesn't compete with other thread
+     * pools (e.g. Embree's TBB workers) while it has nothing to do.
+     */
+    class ThreadPool final : public UsamiObject
+    {
+    public:
+        using Task = std::function<void()>;
+
+        ThreadPool(int num_worker);
+        ~ThreadPool();
+
+        /**
+         * Number of threads owned by the pool
+         */
+        int NumWorkers() const noexcept
+        {
+            return static_cast<int>(workers_.size());
+        }
+
+        /**
+         * Number of distinct values `CurrentWorkerIndex` may return, i.e. size of an array of
+         * per-worker scratch data
+         */
+        int NumWorkerSlots() const noexcept
+        {
+            return NumWorkers() + 1;
+        }
+
+        /**
+         * Index of the calling thread, which is in [0, NumWorkers()) for workers of this pool and
+         * NumWorkers() for any other thread
+         *
+         * NOTE only one thread outside of the pool should drive parallel work at a time if the
+         * index is used to address per-worker scratch data
+         */
+        int CurrentWorkerIndex() const noexcept;
+
+        /**
+         * Schedule a task to be executed by the pool
+         *
+         * NOTE a pool may own no worker, so submitter should help executing tasks while waiting
+         */
+        void Submit(Task task);
+
+        /**
+         * Execute one pending task on the calling thread
+         *
+         * @return false if no task is found
+         */
+        bool RunPendingTask();
+
+        /**
+         * Invoke `f`, during which the calling thread only executes pending tasks forked from
+         * within `f` while it waits for them, e.g. by `TaskGroup::Wait`
+         *
+         * A thread that waits inside a once-only job, e.g. a lazy build, would otherwise pick up
+         * an unrelated task, which may wait for the same job that can never finish below it.
+         */
+        static void Isolate(const std::function<void()>& f);
+
+        /**
+         * Pool shared by all subsystems
+         */
+        static ThreadPool& Global();
+
+        /**
+         * Set total number of threads that runs tasks of the global pool, including the thread
+         * waiting for results. It should be called before the first call to `Global()`.
+         */
+        static void SetGlobalThreadCount(int num_thread);
+
+        static int GlobalThreadCount();
+
+    private:
+        struct PendingTask
+        {
+            Task task;
+
+            // isolation region that the task is forked from, see `Isolate`
+            const void* isolation;
+        };
+
+        struct alignas(64) WorkerQueue
+        {
+            std::mutex mutex;
+            std::deque<PendingTask> tasks;
+        };
+
+        // NOTE tasks of other isolation regions are skipped if `isolation` is not null
+        bool TryPopLocal(int index, const void* isolation, PendingTask& task_out);
+        bool TrySteal(int thief_index, const void* isolation, PendingTask& task_out);
+        bool TryPopInjected(const void* isolation, PendingTask& task_out);
+
+        void WorkerMain(int index);
+
+    private:
+        std::vector<std::thread> workers_;
+        std::vector<unique_ptr<WorkerQueue>> queues_;
+
+        WorkerQueue injection_queue_;
+
+        // number of tasks that are submitted but not yet taken
+        std::atomic<int64_t> num_pending_ = 0;
+
+        std::mutex wake_mutex_;
+        std::condition_variable wake_cv_;
+        bool stopping_ = false;
+    };
+} // namespace usami
@@ -0,0 +1,104 @@
+#include "usami/memory/mapped_file.h"
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace usami
+{
+#ifdef _WIN32
+    MappedFile::~MappedFile()
+    {
+        if (data_ != nullptr)
+        {
+            UnmapViewOfFile(data_);
+        }
+        if (mapping_handle_ != nullptr)
+        {
+            CloseHandle(mapping_handle_);
+        }
+        if (file_handle_ != nullptr)
+        {
+            CloseHandle(file_handle_);
+        }
+    }
+
+    unique_ptr<MappedFile> MappedFile::Open(const std::filesystem::path& path)
+    {
+        HANDLE file = CreateFileW(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr,
+                                  OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+        if (file == INVALID_HANDLE_VALUE)
+        {
+            return nullptr;
+        }
+
+        unique_ptr<MappedFile> result{new MappedFile};
+        result->file_handle_ = file;
+
+        LARGE_INTEGER file_size;
+        if (!GetFileSizeEx(file, &file_size) || file_size.QuadPart == 0)
+        {
+            return nullptr;
+        }
+
+        result->mapping_handle_ = CreateFileMappingW(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+        if (result->mapping_handle_ == nullptr)
+        {
+            return nullptr;
+        }
+
+        void* data = MapViewOfFile(result->mapping_handle_, FILE_MAP_READ, 0, 0, 0);
+        if (data == nullptr)
+        {
+            return nullptr;
+        }
+
+        result->data_ = static_cast<const std::byte*>(data);
+        result->size_ = static_cast<size_t>(file_size.QuadPart);
+        return result;
+    }
+#else
+    MappedFile::~MappedFile()
+    {
+        if (data_ != nullptr)
+        {
+            munmap(const_cast<std::byte*>(data_), size_);
+        }
+    }
+
+    unique_ptr<MappedFile> MappedFile::Open(const std::filesystem::path& path)
+    {
+        int fd = open(path.c_str(), O_RDONLY);
+        if (fd < 0)
+        {
+            return nullptr;
+        }
+
+        // NOTE the mapping stays valid after the descriptor is closed
+        struct stat file_stat;
+        void* data = MAP_FAILED;
+        if (fstat(fd, &file_stat) == 0 && file_stat.st_size > 0)
+        {
+            data = mmap(nullptr, file_stat.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        }
+        close(fd);
+
+        if (data == MAP_FAILED)
+        {
+            return nullptr;
+        }
+
+        unique_ptr<MappedFile> result{new MappedFile};
+        result->data_ = static_cast<const std::byte*>(data);
+        result->size_ = static_cast<size_t>(file_stat.st_size);
+        return result;
+    }
+#endif
+} // namespace usami
@@ -14,10 +14,14 @@
 
 #include "usami/math/vector.h"
 #include "usami/mesh.h"
+#include "usami/parallel/parallel_for.h"
 #include "usami/texture/image.h"
 
 namespace usami
 {
+    // number of cells converted by one task when copying a buffer
+    static constexpr size_t kBufferCopyGrain = 16 * 1024;
+
     template <typename TDst, typename TSrc, size_t N>
     static unique_ptr<SceneDataBuffer>
     AssignConstructBuffer(const tinygltf::Accessor& gltf_accessor,
@@ -43,18 +47,18 @@ namespace usami
         const std::byte* p_src = src_buffer + gltf_bufview.byteOffset;
         std::byte* p_dst       = buffer->data.get();
 
-        for (int i = 0; i < cell_count; ++i)
-        {
-            const TSrc* p_src_typed = reinterpret_cast<const TSrc*>(p_src);
-            TDst* p_dst_typed       = reinterpret_cast<TDst*>(p_dst);
-
-            for (int j = 0; j < N; ++j)
+        ParallelForRange(0, cell_count, kBufferCopyGrain, [&](size_t begin, size_t end) {
+            for (size_t i = begin; i < end; ++i)
             {
-                p_dst_typed[j] = p_src_typed[j];
+                auto p_src_typed = reinterpret_cast<const TSrc*>(p_src + i * src_byte_stride);
+                auto p_dst_typed = reinterpret_cast<TDst*>(p_dst + i * cell_size);
+
+                for (int j = 0; j < N; ++j)
+                {
+                    p_dst_typed[j] = p_src_typed[j];
+                }
             }
-            p_src += src_byte_stride;
-            p_dst += cell_size;
-        }
+        });
 
         return buffer;
     }
@@ -88,12 +92,12 @@ namespace usami
         }
         else
         {
-            for (int i = 0; i < cell_count; ++i)
-            {
-                memcpy(p_dst, p_src, cell_size);
-                p_src += src_byte_stride;
-                p_dst += cell_size;
-            }
+            ParallelForRange(0, cell_count, kBufferCopyGrain, [&](size_t begin, size_t end) {
+                for (size_t i = begin; i < end; ++i)
+                {
+                    memcpy(p_dst + i * cell_size, p_src + i * src_byte_stride, cell_size);
+                }
+            });
         }
 
         return buffer;
@@ -124,17 +128,18 @@ namespace usami
         shared_ptr<SceneModel> result = make_shared<SceneModel>();
 
         // load texture
-        for (const auto& gltf_texture : gltf_model.textures)
-        {
+        // NOTE textures are independent, so their mipmaps are generated concurrently
+        result->textures.resize(gltf_model.textures.size());
+        ParallelFor(0, gltf_model.textures.size(), 1, [&](size_t i) {
             // TODO: support sampler
-            const auto& gltf_img = gltf_model.images.at(gltf_texture.source);
+            const auto& gltf_img = gltf_model.images.at(gltf_model.textures[i].source);
             // USAMI_REQUIRE(!gltf_img.uri.empty());
             USAMI_REQUIRE(gltf_img.bits == 8);
             USAMI_REQUIRE(gltf_img.pixel_type == TINYGLTF_COMPONENT_TYPE_UNSIGNED_BYTE);
 
-            result->textures.push_back(make_unique<ImageTexture>(
-                gltf_img.image.data(), gltf_img.width, gltf_img.height, gltf_img.component));
-        }
+            result->textures[i] = make_unique<ImageTexture>(
+                gltf_img.image.data(), gltf_img.width, gltf_img.height, gltf_img.component);
+        });
 
         // load material
         for (const auto& gltf_material : gltf_model.materials)
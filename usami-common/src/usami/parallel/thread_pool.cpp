@@ -0,0 +1,238 @@
+#include "usami/parallel/thread_pool.h"
+#include "usami/math/math.h"
+#include <algorithm>
+#include <utility>
+
+namespace usami
+{
+    namespace
+    {
+        // pool that the current thread works for, if any
+        thread_local const ThreadPool* tls_pool = nullptr;
+
+        // index of the current thread in `tls_pool`
+        thread_local int tls_worker_index = -1;
+
+        // isolation region of the current thread, or null if it may run any task
+        thread_local const void* tls_isolation = nullptr;
+
+        std::atomic<int> global_thread_count = 0;
+
+        // first task visited in [first, last) that the isolation region may run, or `last`
+        template <typename It>
+        It FindRunnableTask(It first, It last, const void* isolation)
+        {
+            if (isolation == nullptr)
+            {
+                return first;
+            }
+
+            return std::find_if(first, last, [isolation](const auto& task) {
+                return task.isolation == isolation;
+            });
+        }
+    } // namespace
+
+    ThreadPool::ThreadPool(int num_worker)
+    {
+        USAMI_REQUIRE(num_worker >= 0);
+
+        queues_.reserve(num_worker);
+        for (int i = 0; i < num_worker; ++i)
+        {
+            queues_.push_back(make_unique<WorkerQueue>());
+        }
+
+        workers_.reserve(num_worker);
+        for (int i = 0; i < num_worker; ++i)
+        {
+            workers_.emplace_back([this, i] { WorkerMain(i); });
+        }
+    }
+
+    ThreadPool::~ThreadPool()
+    {
+        {
+            std::lock_guard lock{wake_mutex_};
+            stopping_ = true;
+        }
+        wake_cv_.notify_all();
+
+        for (auto& worker : workers_)
+        {
+            worker.join();
+        }
+    }
+
+    int ThreadPool::CurrentWorkerIndex() const noexcept
+    {
+        return tls_pool == this ? tls_worker_index : NumWorkers();
+    }
+
+    void ThreadPool::Submit(Task task)
+    {
+        int index = CurrentWorkerIndex();
+
+        WorkerQueue& queue = index < NumWorkers() ? *queues_[index] : injection_queue_;
+        {
+            std::lock_guard lock{queue.mutex};
+            queue.tasks.push_back(PendingTask{std::move(task), tls_isolation});
+        }
+
+        {
+            // NOTE counter is raised under the lock so that a worker about to sleep won't miss it
+            std::lock_guard lock{wake_mutex_};
+            num_pending_.fetch_add(1, std::memory_order_relaxed);
+        }
+        wake_cv_.notify_one();
+    }
+
+    bool ThreadPool::RunPendingTask()
+    {
+        int index = CurrentWorkerIndex();
+
+        PendingTask task;
+        bool found = (index < NumWorkers() && TryPopLocal(index, tls_isolation, task)) ||
+                     TryPopInjected(tls_isolation, task) || TrySteal(index, tls_isolation, task);
+        if (!found)
+        {
+            return false;
+        }
+
+        // tasks forked by the task belong to the same isolation region
+        const void* isolation = std::exchange(tls_isolation, task.isolation);
+        task.task();
+        tls_isolation = isolation;
+
+        return true;
+    }
+
+    void ThreadPool::Isolate(const std::function<void()>& f)
+    {
+        // NOTE address of the local is unique among regions alive at the same time
+        char region;
+
+        const void* isolation = std::exchange(tls_isolation, &region);
+        try
+        {
+            f();
+        }
+        catch (...)
+        {
+            tls_isolation = isolation;
+            throw;
+        }
+
+        tls_isolation = isolation;
+    }
+
+    ThreadPool& ThreadPool::Global()
+    {
+        // NOTE the calling thread also executes tasks while waiting, so spawn one worker less
+        static ThreadPool pool{Max(0, GlobalThreadCount() - 1)};
+        return pool;
+    }
+
+    void ThreadPool::SetGlobalThreadCount(int num_thread)
+    {
+        USAMI_REQUIRE(num_thread > 0);
+        global_thread_count.store(num_thread);
+    }
+
+    int ThreadPool::GlobalThreadCount()
+    {
+        int num_thread = global_thread_count.load();
+        if (num_thread == 0)
+        {
+            int num_hardware_thread = static_cast<int>(std::thread::hardware_concurrency());
+            global_thread_count.compare_exchange_strong(num_thread, Max(1, num_hardware_thread));
+
+            num_thread = global_thread_count.load();
+        }
+
+        return num_thread;
+    }
+
+    bool ThreadPool::TryPopLocal(int index, const void* isolation, PendingTask& task_out)
+    {
+        WorkerQueue& queue = *queues_[index];
+
+        std::lock_guard lock{queue.mutex};
+
+        // LIFO for the owner for better locality
+        auto it = FindRunnableTask(queue.tasks.rbegin(), queue.tasks.rend(), isolation);
+        if (it == queue.tasks.rend())
+        {
+            return false;
+        }
+
+        task_out = std::move(*it);
+        queue.tasks.erase(std::next(it).base());
+        num_pending_.fetch_sub(1, std::memory_order_relaxed);
+        return true;
+    }
+
+    bool ThreadPool::TrySteal(int thief_index, const void* isolation, PendingTask& task_out)
+    {
+        int num_worker = NumWorkers();
+        for (int i = 1; i <= num_worker; ++i)
+        {
+            WorkerQueue& queue = *queues_[(thief_index + i) % num_worker];
+
+            std::lock_guard lock{queue.mutex};
+
+            // FIFO for thieves as older tasks are usually bigger chunks of work
+            auto it = FindRunnableTask(queue.tasks.begin(), queue.tasks.end(), isolation);
+            if (it != queue.tasks.end())
+            {
+                task_out = std::move(*it);
+                queue.tasks.erase(it);
+                num_pending_.fetch_sub(1, std::memory_order_relaxed);
+                return true;
+            }
+        }
+
+        return false;
+    }
+
+    bool ThreadPool::TryPopInjected(const void* isolation, PendingTask& task_out)
+    {
+        std::lock_guard lock{injection_queue_.mutex};
+
+        auto& tasks = injection_queue_.tasks;
+        auto it     = FindRunnableTask(tasks.begin(), tasks.end(), isolation);
+        if (it == tasks.end())
+        {
+            return false;
+        }
+
+        task_out = std::move(*it);
+        tasks.erase(it);
+        num_pending_.fetch_sub(1, std::memory_order_relaxed);
+        return true;
+    }
+
+    void ThreadPool::WorkerMain(int index)
+    {
+        tls_pool         = this;
+        tls_worker_index = index;
+
+        while (true)
+        {
+            if (RunPendingTask())
+            {
+                continue;
+            }
+
+            std::unique_lock lock{wake_mutex_};
+            wake_cv_.wait(lock, [this] {
+                return stopping_ || num_pending_.load(std::memory_order_relaxed) > 0;
+            });
+
+            if (stopping_)
+            {
+                return;
+            }
+        }
+    }
+} // namespace usami
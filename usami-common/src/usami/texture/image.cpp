@@ -1,4 +1,5 @@
 #include "usami/texture/image.h"
+#include "usami/parallel/parallel_for.h"
 
 namespace usami
 {
@@ -23,18 +24,20 @@ namespace usami
         // generate mipmap
         if (channel == 3)
         {
-            const uint8_t* p_src = data;
-            uint8_t* p_dst       = reinterpret_cast<uint8_t*>(buffer_.Data());
-            for (int i = 0; i < width * height; ++i)
-            {
-                p_dst[0] = p_src[0];
-                p_dst[1] = p_src[1];
-                p_dst[2] = p_src[2];
-                p_dst[3] = 0xff;
+            ParallelFor(0, height, [&](size_t y) {
+                const uint8_t* p_src = data + 3 * width * y;
+                uint8_t* p_dst       = reinterpret_cast<uint8_t*>(buffer_.Data() + width * y);
+                for (size_t x = 0; x < width; ++x)
+                {
+                    p_dst[0] = p_src[0];
+                    p_dst[1] = p_src[1];
+                    p_dst[2] = p_src[2];
+                    p_dst[3] = 0xff;
 
-                p_src += 3;
-                p_dst += 4;
-            }
+                    p_src += 3;
+                    p_dst += 4;
+                }
+            });
         }
         else
         {
@@ -1,6 +1,7 @@
 #pragma once
 #include "usami/math/math.h"
 #include "usami/ray/ray.h"
+#include <limits>
 
 namespace usami::ray
 {
@@ -11,6 +12,10 @@ namespace usami::ray
         Vec3f p_max;
 
     public:
+        // far distances of a slab test are padded slightly so that rounding error doesn't cull a
+        // box that is barely hit, see PBRT 3.9.2
+        static constexpr float kSlabFarScale = 1 + 2 * 3.6e-7f;
+
         BoundingBox(Vec3f p) : p_min(p), p_max(p)
         {
         }
@@ -18,6 +23,20 @@ namespace usami::ray
         {
         }
 
+        /**
+         * Box containing no point, which is the identity of `UnionBBox`
+         */
+        static BoundingBox Empty() noexcept
+        {
+            return BoundingBox{Vec3f{std::numeric_limits<float>::infinity()},
+                               Vec3f{-std::numeric_limits<float>::infinity()}};
+        }
+
+        bool IsEmpty() const noexcept
+        {
+            return p_min[0] > p_max[0] || p_min[1] > p_max[1] || p_min[2] > p_max[2];
+        }
+
         Vec3f Extents() const noexcept
         {
             return p_max - p_min;
@@ -35,96 +54,42 @@ namespace usami::ray
             return (p_min + p_max) * .5f;
         }
 
+        /**
+         * Slab test of a ray, given its origin and reciprocal of its direction
+         *
+         * @param t_enter_out distance where the ray enters the box, clamped to `t_min`
+         * @return true if the ray overlaps the box within [t_min, t_max]
+         */
+        bool IntersectSlab(const Vec3f& o, const Vec3f& inv_d, float t_min, float t_max,
+                           float& t_enter_out) const noexcept
+        {
+            Vec3f t_p_min = (p_min - o) * inv_d;
+            Vec3f t_p_max = (p_max - o) * inv_d;
+            Vec3f t_near  = Min(t_p_min, t_p_max);
+            Vec3f t_far   = Max(t_p_min, t_p_max) * kSlabFarScale;
+
+            float t_enter = Max(Max(t_near[0], t_near[1]), Max(t_near[2], t_min));
+            float t_exit  = Min(Min(t_far[0], t_far[1]), Min(t_far[2], t_max));
+
+            t_enter_out = t_enter;
+            return t_enter <= t_exit;
+        }
+
+        bool IntersectSlab(const Vec3f& o, const Vec3f& inv_d, float t_min,
+                           float t_max) const noexcept
+        {
+            float t_enter;
+            return IntersectSlab(o, inv_d, t_min, t_max, t_enter);
+        }
+
+        /**
+         * Test if the ray overlaps the box within [t_min, t_max]
+         *
+         * @param t_out distance where the ray enters the box, or `t_min` if it starts inside
+         */
         bool Occlude(const Ray& ray, float t_min, float t_max, float& t_out) const noexcept
         {
-            Vec3f dtdd    = 1.f / ray.d;
-            Vec3f t_p_min = (p_min - ray.o) * dtdd;
-            Vec3f t_p_max = (p_max - ray.o) * dtdd;
-
-            float t_hit = t_max;
-
-            if (ray.d.X() != 0)
-            {
-                // hit plane x = p_min.x
-                if (t_p_min.X() > t_min && t_p_min.X() < t_hit)
-                {
-                    Vec3f p = ray.o + t_p_min.X() * ray.d;
-                    if (p.Y() >= p_min.Y() && p.Y() <= p_max.Y() && p.Z() >= p_min.Z() &&
-                        p.Z() <= p_max.Z())
-                    {
-                        t_hit = t_p_min.X();
-                    }
-                }
-
-                // hit plane x = p_max.x
-                if (t_p_max.X() > t_min && t_p_max.X() < t_hit)
-                {
-                    Vec3f p = ray.o + t_p_max.X() * ray.d;
-                    if (p.Y() >= p_min.Y() && p.Y() <= p_max.Y() && p.Z() >= p_min.Z() &&
-                        p.Z() <= p_max.Z())
-                    {
-                        t_hit = t_p_max.X();
-                    }
-                }
-            }
-
-            if (ray.d.Y() != 0)
-            {
-                // hit plane y = p_min.y
-                if (t_p_min.Y() > t_min && t_p_min.Y() < t_hit)
-                {
-                    Vec3f p = ray.o + t_p_min.Y() * ray.d;
-                    if (p.X() >= p_min.X() && p.X() <= p_max.X() && p.Z() >= p_min.Z() &&
-                        p.Z() <= p_max.Z())
-                    {
-                        t_hit = t_p_min.Y();
-                    }
-                }
-
-                // hit plane y = p_max.y
-                if (t_p_max.Y() > t_min && t_p_max.Y() < t_hit)
-                {
-                    Vec3f p = ray.o + t_p_max.Y() * ray.d;
-                    if (p.X() >= p_min.X() && p.X() <= p_max.X() && p.Z() >= p_min.Z() &&
-                        p.Z() <= p_max.Z())
-                    {
-                        t_hit = t_p_max.Y();
-                    }
-                }
-            }
-
-            if (ray.d.Z() != 0)
-            {
-                // hit plane z = p_min.z
-                if (t_p_min.Z() > t_min && t_p_min.Z() < t_hit)
-                {
-                    Vec3f p = ray.o + t_p_min.Z() * ray.d;
-                    if (p.X() >= p_min.X() && p.X() <= p_max.X() && p.Y() >= p_min.Y() &&
-                        p.Y() <= p_max.Y())
-                    {
-                        t_hit = t_p_min.Z();
-                    }
-                }
-
-                // hit plane z = p_max.z
-                if (t_p_max.Z() > t_min && t_p_max.Z() < t_hit)
-                {
-                    Vec3f p = ray.o + t_p_max.Z() * ray.d;
-                    if (p.X() >= p_min.X() && p.X() <= p_max.X() && p.Y() >= p_min.Y() &&
-                        p.Y() <= p_max.Y())
-                    {
-                        t_hit = t_p_max.Z();
-                    }
-                }
-            }
-
-            if (t_hit == t_max)
-            {
-                return false;
-            }
-
-            t_out = t_hit;
-            return true;
+            return IntersectSlab(ray.o, 1.f / ray.d, t_min, t_max, t_out);
         }
     };
 
@@ -132,4 +97,89 @@ namespace usami::ray
     {
         return BoundingBox{Min(a.p_min, b.p_min), Max(a.p_max, b.p_max)};
     }
+
+    // NOTE the result may be empty, see `BoundingBox::IsEmpty`
+    inline BoundingBox IntersectBBox(const BoundingBox& a, const BoundingBox& b)
+    {
+        return BoundingBox{Max(a.p_min, b.p_min), Min(a.p_max, b.p_max)};
+    }
+
+    /**
+     * Bounds of directions, i.e. those within an angle `theta` of the axis `w`, see PBRT 4 3.8.4
+     */
+    struct DirectionCone
+    {
+    public:
+        // normalized axis of the cone
+        Vec3f w;
+
+        // cosine of the spread angle, where -1 covers all directions
+        float cos_theta;
+
+    public:
+        DirectionCone(Vec3f w, float cos_theta) : w(w), cos_theta(cos_theta)
+        {
+        }
+
+        /**
+         * Cone containing no direction, which is the identity of `UnionCone`
+         */
+        static DirectionCone Empty() noexcept
+        {
+            return DirectionCone{Vec3f{0, 0, 1}, std::numeric_limits<float>::infinity()};
+        }
+
+        static DirectionCone EntireSphere() noexcept
+        {
+            return DirectionCone{Vec3f{0, 0, 1}, -1.f};
+        }
+
+        bool IsEmpty() const noexcept
+        {
+            return cos_theta == std::numeric_limits<float>::infinity();
+        }
+    };
+
+    inline DirectionCone UnionCone(const DirectionCone& a, const DirectionCone& b)
+    {
+        if (a.IsEmpty())
+        {
+            return b;
+        }
+        if (b.IsEmpty())
+        {
+            return a;
+        }
+
+        // either cone may contain the other
+        float theta_a = std::acos(Clamp(a.cos_theta, -1.f, 1.f));
+        float theta_b = std::acos(Clamp(b.cos_theta, -1.f, 1.f));
+        float theta_d = std::acos(Clamp(Dot(a.w, b.w), -1.f, 1.f));
+        if (Min(theta_d + theta_b, kPi) <= theta_a)
+        {
+            return a;
+        }
+        if (Min(theta_d + theta_a, kPi) <= theta_b)
+        {
+            return b;
+        }
+
+        // otherwise the spread of the result covers both cones, whose axis is rotated from that
+        // of `a` towards `b`
+        float theta_o = (theta_a + theta_d + theta_b) * .5f;
+        if (theta_o >= kPi)
+        {
+            return DirectionCone::EntireSphere();
+        }
+
+        Vec3f w_perp = b.w - a.w * Dot(a.w, b.w);
+        if (w_perp.LengthSq() == 0)
+        {
+            return DirectionCone::EntireSphere();
+        }
+
+        float theta_r = theta_o - theta_a;
+        Vec3f w       = a.w * Cos(theta_r) + w_perp.Normalize() * Sin(theta_r);
+        return DirectionCone{w.Normalize(), Cos(theta_o)};
+    }
 } // namespace usami::ray
@@ -118,7 +118,7 @@ namespace usami::ray
 
             auto wh = (wo + wi).Normalize();
             auto D  = microfacet_->D(wh);
-            auto F  = fresnel_->Eval(wh.Dot(wi));
+            auto F  = fresnel_->Eval(Dot(wh, wi));
             auto G  = microfacet_->G(wo, wi);
 
             auto f = (D * F * G) / (4 * CosTheta(wo) * CosTheta(wi));
@@ -144,11 +144,11 @@ namespace usami::ray
             }
 
             auto D = microfacet_->D(wh);
-            auto F = fresnel_->Eval(wh.Dot(wi));
+            auto F = fresnel_->Eval(Dot(wh, wi));
             auto G = microfacet_->G(wo, wi);
 
             auto f   = (D * F * G) / (4 * CosTheta(wo) * CosTheta(wi));
-            auto pdf = microfacet_->Pdf(wh) / (4 * wh.Dot(wo));
+            auto pdf = microfacet_->Pdf(wh) / (4 * Dot(wh, wo));
 
             wi_out  = wi;
             pdf_out = pdf;
@@ -163,7 +163,7 @@ namespace usami::ray
             }
 
             auto wh  = (wo + wi).Normalize();
-            auto pdf = microfacet_->Pdf(wh) / (4 * wh.Dot(wo));
+            auto pdf = microfacet_->Pdf(wh) / (4 * Dot(wh, wo));
 
             return pdf;
         }
@@ -1,13 +1,80 @@
 #pragma once
 #include "usami/mesh.h"
+#include "usami/memory/aligned_allocator.h"
+#include "usami/memory/mapped_file.h"
 #include "usami/ray/bbox.h"
 #include "usami/ray/primitive.h"
 #include "usami/ray/shape/triangle.h"
+#include "usami/ray/shape/triangle_soa.h"
+#include "usami/parallel/parallel_for.h"
+#include "usami/parallel/radix_sort.h"
+#include "usami/parallel/task_group.h"
 #include <algorithm>
+#include <array>
+#include <atomic>
+#include <bit>
+#include <filesystem>
+#include <fstream>
+#include <limits>
 #include <vector>
 
 namespace usami::ray
 {
+    enum class BvhBuildAlgorithm
+    {
+        // recursively partition primitives from the root
+        TopDown,
+
+        // linear bvh, which sorts primitives along a Morton curve of their centroids and splits
+        // them by bits of the codes. It builds in a fraction of the time of `TopDown` at the cost
+        // of trace performance, which suits previews and dynamic scenes.
+        Linear,
+    };
+
+    /**
+     * Trade-off between build time and trace performance of a BVH, like `RTC_BUILD_QUALITY_*`
+     *
+     * With `BvhBuildAlgorithm::Linear`, `Low` emits the tree as is, while the others rebuild upper
+     * levels over treelets, i.e. clusters of primitives sharing leading bits of Morton codes, with
+     * the surface area heuristic.
+     */
+    enum class BvhBuildQuality
+    {
+        // split at the median centroid along the widest axis, fastest to build
+        Low,
+
+        // binned surface area heuristic with a few bins
+        Medium,
+
+        // binned surface area heuristic with more bins, slower to build but faster to trace
+        High,
+    };
+
+    struct BvhBuildSetting
+    {
+        BvhBuildAlgorithm algorithm = BvhBuildAlgorithm::TopDown;
+
+        BvhBuildQuality quality = BvhBuildQuality::Medium;
+
+        // maximum number of primitives in a leaf
+        int max_leaf_size = 8;
+
+        // cost of traversing an inner node, relative to intersecting a primitive
+        float traversal_cost = 1.f;
+
+        // a refit rebuilds the tree instead if it raises SAH cost past this ratio of the cost
+        // right after the last build
+        float max_refit_cost_ratio = 1.5f;
+
+        // budget of spatial splits, i.e. extra primitive references relative to the number of
+        // primitives, where 0 disables them. A spatial split clips primitives straddling its plane
+        // into both children, which tightens bounds of long and thin triangles, e.g. those of
+        // architectural meshes, at the cost of memory and build time. It's used by `TopDown`
+        // above `Low` quality over collections that clip primitives, i.e. mesh triangles. A refit
+        // bounds whole primitives again, so it suits static geometry better.
+        float spatial_split_budget = 0.f;
+    };
+
     struct PrimitiveInfo
     {
         BoundingBox bbox;
@@ -46,22 +113,61 @@ namespace usami::ray
             return hit;
         }
 
-        std::vector<PrimitiveInfo> Prepare()
+        bool Intersect(int prim_offset, int num_prim, const Ray& ray, float t_min, float t_max,
+                       Workspace& ws, OcclusionInfo& occ_out) const
         {
-            std::vector<PrimitiveInfo> result;
-            result.reserve(prims_.size());
+            for (int i = 0; i < num_prim; ++i)
+            {
+                if (prims_[prim_offset + i]->Intersect(ray, t_min, t_max, ws, occ_out))
+                {
+                    return true;
+                }
+            }
 
-            for (size_t i = 0; i < prims_.size(); ++i)
+            return false;
+        }
+
+        int IntersectBatchSize() const noexcept
+        {
+            return 1;
+        }
+
+        // bounds of primitives in a leaf after they moved
+        BoundingBox RefitLeaf(int prim_offset, int num_prim) const
+        {
+            BoundingBox result = prims_[prim_offset]->Bounding();
+            for (int i = 1; i < num_prim; ++i)
             {
-                BoundingBox bbox = prims_[i]->Bounding();
-                result.push_back(
-                    PrimitiveInfo{.bbox = bbox, .centroid = bbox.Centroid(), .index = i});
+                result = UnionBBox(result, prims_[prim_offset + i]->Bounding());
             }
 
             return result;
         }
 
-        void Update(const std::vector<PrimitiveInfo>& v)
+        size_t ByteSize() const noexcept
+        {
+            return prims_.capacity() * sizeof(Primitive*);
+        }
+
+        std::vector<PrimitiveInfo> Prepare(ThreadPool& pool)
+        {
+            std::vector<PrimitiveInfo> result;
+            result.resize(prims_.size(),
+                          PrimitiveInfo{.bbox = Vec3f{}, .centroid = {}, .index = 0});
+
+            ParallelFor(
+                0, prims_.size(),
+                [&](size_t i) {
+                    BoundingBox bbox = prims_[i]->Bounding();
+                    result[i] =
+                        PrimitiveInfo{.bbox = bbox, .centroid = bbox.Centroid(), .index = i};
+                },
+                pool);
+
+            return result;
+        }
+
+        void Update(const std::vector<PrimitiveInfo>& v, ThreadPool& pool)
         {
             USAMI_ASSERT(v.size() == prims_.size());
 
@@ -76,26 +182,57 @@ namespace usami::ray
         }
     };
 
+    /**
+     * How triangles of a mesh are stored in bvh leaves
+     */
+    enum class MeshLeafStorage
+    {
+        // refer to triangles by face index, fetching vertices from the mesh on every test
+        Indexed,
+
+        // copy triangles in leaf order into SoA arrays, which are tested in SIMD batches
+        TriangleSoA,
+    };
+
     // collection specialized for mesh triangles
-    // TODO: reorder triangle buffer for cache locality!!!
     class MeshPrimitiveCollection
     {
     private:
-        SceneMesh* mesh_;
-        std::vector<int> faces_;
+        const SceneMesh* mesh_;
+        MeshLeafStorage storage_;
+
+        // face index of triangles in leaf order, which views either `face_storage_` or a cache
+        // file mapped in memory
+        std::span<const int> faces_;
+        std::vector<int> face_storage_;
+
+        // triangles in the same order as `faces_`, only for `MeshLeafStorage::TriangleSoA`
+        shape::TriangleSoA<> triangles_;
 
     public:
         MeshPrimitiveCollection()
         {
         }
-        MeshPrimitiveCollection(SceneMesh* mesh) : mesh_(mesh)
+        MeshPrimitiveCollection(const SceneMesh* mesh,
+                                MeshLeafStorage storage = MeshLeafStorage::TriangleSoA)
+            : mesh_(mesh), storage_(storage)
+        {
+        }
+
+        MeshLeafStorage Storage() const noexcept
         {
-            faces_.reserve(mesh->num_face);
+            return storage_;
         }
 
         bool Intersect(int prim_offset, int num_prim, const Ray& ray, float t_min, float t_max,
                        Workspace& ws, IntersectionInfo& isect_out) const
         {
+            if (storage_ == MeshLeafStorage::TriangleSoA)
+            {
+                return IntersectTriangleSoA(prim_offset, num_prim, ray, t_min, t_max, &isect_out,
+                                            nullptr);
+            }
+
             bool hit    = false;
             float t_hit = t_max;
 
@@ -116,47 +253,310 @@ namespace usami::ray
             return hit;
         }
 
-        std::vector<PrimitiveInfo> Prepare()
+        bool Intersect(int prim_offset, int num_prim, const Ray& ray, float t_min, float t_max,
+                       Workspace& ws, OcclusionInfo& occ_out) const
         {
-            std::vector<PrimitiveInfo> result;
-            result.reserve(mesh_->num_face);
+            if (storage_ == MeshLeafStorage::TriangleSoA)
+            {
+                return IntersectTriangleSoA(prim_offset, num_prim, ray, t_min, t_max, nullptr,
+                                            &occ_out);
+            }
+
+            for (int i = 0; i < num_prim; ++i)
+            {
+                int iface         = faces_[prim_offset + i];
+                auto [v0, v1, v2] = mesh_->GetTriangleVertices(iface).vertices;
+
+                if (TestOcclusion(shape::Triangle{v0, v1, v2}, ray, t_min, t_max, occ_out.t))
+                {
+                    occ_out.primitive = nullptr;
+                    return true;
+                }
+            }
+
+            return false;
+        }
+
+        // number of triangles tested together in a leaf
+        int IntersectBatchSize() const noexcept
+        {
+            return storage_ == MeshLeafStorage::TriangleSoA ? triangles_.kBatchSize : 1;
+        }
+
+        size_t ByteSize() const noexcept
+        {
+            return faces_.size() * sizeof(int) + triangles_.ByteSize();
+        }
+
+        // bounds of triangles in a leaf after vertices of the mesh changed, which also refreshes
+        // copies of the triangles
+        BoundingBox RefitLeaf(int prim_offset, int num_prim)
+        {
+            BoundingBox result = Vec3f{};
+            for (int i = prim_offset; i < prim_offset + num_prim; ++i)
+            {
+                auto [v0, v1, v2] = mesh_->GetTriangleVertices(faces_[i]).vertices;
+                shape::Triangle triangle{v0, v1, v2};
+                if (storage_ == MeshLeafStorage::TriangleSoA)
+                {
+                    triangles_.Set(i, triangle);
+                }
+
+                result = i == prim_offset ? triangle.Bounding()
+                                          : UnionBBox(result, triangle.Bounding());
+            }
 
-            for (size_t i = 0; i < mesh_->num_face; ++i)
+            return result;
+        }
+
+        /**
+         * Clip the part of a triangle within bounds of the reference by plane `position` along
+         * `axis` for spatial splits
+         *
+         * @return bounds of the reference on both sides, which may be empty
+         */
+        std::pair<BoundingBox, BoundingBox> SplitPrimitive(const PrimitiveInfo& ref, int axis,
+                                                           float position) const
+        {
+            constexpr float kInfinity = std::numeric_limits<float>::infinity();
+
+            auto vertices = mesh_->GetTriangleVertices(ref.index).vertices;
+
+            Array3f left_min  = {kInfinity, kInfinity, kInfinity};
+            Array3f left_max  = {-kInfinity, -kInfinity, -kInfinity};
+            Array3f right_min = left_min;
+            Array3f right_max = left_max;
+            auto extend = [](Array3f& p_min, Array3f& p_max, const Array3f& x) {
+                for (int k = 0; k < 3; ++k)
+                {
+                    p_min[k] = std::min(p_min[k], x[k]);
+                    p_max[k] = std::max(p_max[k], x[k]);
+                }
+            };
+
+            for (int i = 0; i < 3; ++i)
             {
-                auto [v0, v1, v2] = mesh_->GetTriangleVertices(i).vertices;
-                BoundingBox bbox  = shape::Triangle{v0, v1, v2}.Bounding();
-                result.push_back(
-                    PrimitiveInfo{.bbox = bbox, .centroid = bbox.Centroid(), .index = i});
+                const Array3f& p = vertices[i];
+                const Array3f& q = vertices[(i + 1) % 3];
+                if (p[axis] <= position)
+                {
+                    extend(left_min, left_max, p);
+                }
+                if (p[axis] >= position)
+                {
+                    extend(right_min, right_max, p);
+                }
+
+                // edge crossing the plane
+                if ((p[axis] < position && q[axis] > position) ||
+                    (p[axis] > position && q[axis] < position))
+                {
+                    float t = (position - p[axis]) / (q[axis] - p[axis]);
+
+                    Array3f x;
+                    for (int k = 0; k < 3; ++k)
+                    {
+                        x[k] = p[k] + t * (q[k] - p[k]);
+                    }
+                    x[axis] = position;
+
+                    extend(left_min, left_max, x);
+                    extend(right_min, right_max, x);
+                }
             }
 
+            BoundingBox left{left_min, left_max};
+            BoundingBox right{right_min, right_max};
+            return {IntersectBBox(left, ref.bbox), IntersectBBox(right, ref.bbox)};
+        }
+
+        std::vector<PrimitiveInfo> Prepare(ThreadPool& pool)
+        {
+            std::vector<PrimitiveInfo> result;
+            result.resize(mesh_->num_face,
+                          PrimitiveInfo{.bbox = Vec3f{}, .centroid = {}, .index = 0});
+
+            ParallelFor(
+                0, mesh_->num_face,
+                [&](size_t i) {
+                    auto [v0, v1, v2] = mesh_->GetTriangleVertices(i).vertices;
+                    BoundingBox bbox  = shape::Triangle{v0, v1, v2}.Bounding();
+                    result[i] =
+                        PrimitiveInfo{.bbox = bbox, .centroid = bbox.Centroid(), .index = i};
+                },
+                pool);
+
             return result;
         }
 
-        void Update(const std::vector<PrimitiveInfo>& v)
+        void Update(const std::vector<PrimitiveInfo>& v, ThreadPool& pool)
         {
-            faces_.reserve(v.size());
+            face_storage_.clear();
+            face_storage_.reserve(v.size());
             for (size_t i = 0; i < v.size(); ++i)
             {
-                faces_.push_back(v[i].index);
+                face_storage_.push_back(v[i].index);
+            }
+
+            faces_ = face_storage_;
+            UpdateTriangles(pool);
+        }
+
+        /**
+         * Primitive order built by `Update`, i.e. the face index of each triangle in leaf order
+         */
+        std::span<const int> PrimitiveOrder() const noexcept
+        {
+            return faces_;
+        }
+
+        /**
+         * Restore primitive order saved from `PrimitiveOrder` instead of building it, where
+         * `order` is used in place and should outlive the collection
+         *
+         * @return false if `order` doesn't fit the mesh
+         */
+        bool RestorePrimitiveOrder(std::span<const int> order, ThreadPool& pool)
+        {
+            // NOTE spatial splits may refer to a triangle multiple times
+            if (order.size() < mesh_->num_face)
+            {
+                return false;
+            }
+
+            for (int iface : order)
+            {
+                if (iface < 0 || static_cast<size_t>(iface) >= mesh_->num_face)
+                {
+                    return false;
+                }
+            }
+
+            face_storage_.clear();
+            faces_ = order;
+            UpdateTriangles(pool);
+            return true;
+        }
+
+    private:
+        void UpdateTriangles(ThreadPool& pool)
+        {
+            if (storage_ == MeshLeafStorage::TriangleSoA)
+            {
+                triangles_.Resize(faces_.size());
+                ParallelFor(
+                    0, faces_.size(),
+                    [&](size_t i) {
+                        auto [v0, v1, v2] = mesh_->GetTriangleVertices(faces_[i]).vertices;
+                        triangles_.Set(i, shape::Triangle{v0, v1, v2});
+                    },
+                    pool);
+            }
+        }
+
+        /**
+         * Test triangles of a leaf in batches, filling either `isect_out` with the closest hit
+         * or `occ_out` with any hit
+         */
+        bool IntersectTriangleSoA(int prim_offset, int num_prim, const Ray& ray, float t_min,
+                                  float t_max, IntersectionInfo* isect_out,
+                                  OcclusionInfo* occ_out) const noexcept
+        {
+            constexpr int kBatchSize = decltype(triangles_)::kBatchSize;
+
+            int ihit    = -1;
+            float t_hit = t_max;
+            float u_hit = 0;
+            float v_hit = 0;
+
+            for (int base = 0; base < num_prim; base += kBatchSize)
+            {
+                float t[kBatchSize];
+                float u[kBatchSize];
+                float v[kBatchSize];
+
+                uint32_t hit_mask =
+                    triangles_.IntersectBatch(prim_offset + base, ray, t_min, t_hit, t, u, v);
+                if (num_prim - base < kBatchSize)
+                {
+                    // discard triangles beyond the leaf
+                    hit_mask &= (1u << (num_prim - base)) - 1;
+                }
+
+                for (int i = 0; i < kBatchSize; ++i)
+                {
+                    // NOTE later triangle wins a tie, like the scalar loop
+                    if ((hit_mask & (1u << i)) != 0 && t[i] <= t_hit)
+                    {
+                        if (occ_out != nullptr)
+                        {
+                            occ_out->t         = t[i];
+                            occ_out->primitive = nullptr;
+                            return true;
+                        }
+
+                        ihit  = prim_offset + base + i;
+                        t_hit = t[i];
+                        u_hit = u[i];
+                        v_hit = v[i];
+                    }
+                }
+            }
+
+            if (ihit < 0)
+            {
+                return false;
             }
+
+            isect_out->t     = t_hit;
+            isect_out->point = ray.o + t_hit * ray.d;
+            isect_out->ng    = triangles_.GeometricNormal(ihit);
+            isect_out->uv    = {u_hit, v_hit};
+            isect_out->iface = faces_[ihit];
+            return true;
         }
     };
 
+    // version of bvh cache files, which should be bumped whenever nodes or builders change
+    constexpr uint32_t kBvhCacheVersion = 2;
+
+    constexpr std::array<char, 8> kBvhCacheMagic = {'U', 'S', 'A', 'M', 'I', 'B', 'V', 'H'};
+
+    /**
+     * Header of a bvh cache file, followed by nodes and primitive order at their offsets
+     *
+     * NOTE data is written in native byte order and layout, which is guarded by `node_size`
+     */
+    struct BvhCacheHeader
+    {
+        std::array<char, 8> magic;
+        uint32_t version;
+        uint32_t node_size;
+
+        // identifies primitives and build setting of the bvh
+        uint64_t key;
+
+        uint64_t num_node;
+        uint64_t node_offset;
+        uint64_t num_prim;
+        uint64_t prim_order_offset;
+
+        float sah_cost;
+        uint32_t reserved;
+    };
+
+    enum class WideBvhNodeFormat;
+
+    template <typename PrimitiveCollection, int Width, WideBvhNodeFormat Format>
+    class BasicWideBvhComposite;
+
     template <typename PrimitiveCollection>
     class BasicBvhComposite : public IntersectableEntity
     {
     private:
-        struct BvhNode
-        {
-            BoundingBox bbox;
-
-            unique_ptr<BvhNode> left;
-            unique_ptr<BvhNode> right;
-
-            int prim_info_begin;
-            int prim_info_end;
-            int partition_axis;
-        };
+        // wide bvh is collapsed from the binary one
+        template <typename, int, WideBvhNodeFormat>
+        friend class BasicWideBvhComposite;
 
         struct LinearBvhNode
         {
@@ -170,31 +570,180 @@ namespace usami::ray
                 // prim_num > 0
                 uint32_t prim_offset;
 
-                // prim_num == 0, NOTE left child is the next node in the array
-                uint32_t right_child_index;
+                // prim_num == 0, NOTE children are stored in a pair, left one comes first
+                uint32_t child_index;
             };
         };
 
         static_assert(sizeof(LinearBvhNode) == 32);
 
+        static constexpr size_t kCacheLineSize = 64;
+        static constexpr size_t kPageSize      = 4096;
+
+        // a tree of more than one node keeps a copy of the root here, see `LayoutNodes`
+        static constexpr uint32_t kRootPaddingIndex = 1;
+
+        using NodeStorage =
+            std::vector<LinearBvhNode, AlignedAllocator<LinearBvhNode, kCacheLineSize>>;
+
+        // number of bins evaluated along each axis by the SAH builder
+        static constexpr int kMaxSahBins = 32;
+
+        // subtrees with at least this number of primitives are built by a separate task
+        static constexpr int kParallelSubtreeThreshold = 4096;
+
+        // bounds and bins of large nodes are computed in parallel over chunks of this size
+        static constexpr int kParallelBinningChunk = 1 << 16;
+
+        // capacity of the traversal stack, which bounds depth of the tree
+        static constexpr int kMaxTraversalDepth = 96;
+
+        // nodes deeper than this are split at the median, which halves primitives each level so
+        // that the tree fits in the traversal stack
+        static constexpr int kMaxSahDepth = kMaxTraversalDepth - 32;
+
+        struct SahBin
+        {
+            BoundingBox bbox = {Vec3f{std::numeric_limits<float>::infinity()},
+                                Vec3f{-std::numeric_limits<float>::infinity()}};
+            int count        = 0;
+        };
+
+        using SahBinSet = std::array<std::array<SahBin, kMaxSahBins>, 3>;
+
+        /**
+         * Best split partitioning primitives by bins of centroids
+         */
+        struct ObjectSplit
+        {
+            float cost = std::numeric_limits<float>::infinity();
+
+            // -1 if no object split is possible
+            int axis = -1;
+
+            // bins [0, bin) go to the left, where bins are placed evenly over bounds of centroids
+            int bin = 0;
+            Vec3f bin_origin;
+            Vec3f bin_scale;
+
+            BoundingBox left_bbox  = BoundingBox::Empty();
+            BoundingBox right_bbox = BoundingBox::Empty();
+        };
+
+        // spatial splits are only tried where children of the best object split overlap by more
+        // than this ratio of area of the root, see Stich et al., Spatial Splits in Bounding Volume
+        // Hierarchies
+        static constexpr float kSpatialSplitMinOverlap = 1e-5f;
+
+        // spatial splits need the collection to clip primitives, as clipping only their bounds
+        // leaves references as large in the other axes and ends up worse than object splits
+        static constexpr bool kSpatialSplitSupported =
+            requires(const PrimitiveCollection& prims, const PrimitiveInfo& ref) {
+                prims.SplitPrimitive(ref, 0, 0.f);
+            };
+
+        struct SpatialBin
+        {
+            BoundingBox bbox = BoundingBox::Empty();
+
+            // number of references starting and ending in the bin
+            int num_enter = 0;
+            int num_exit  = 0;
+        };
+
+        using SpatialBinSet = std::array<std::array<SpatialBin, kMaxSahBins>, 3>;
+
+        /**
+         * Best split clipping references by a plane, where bins are placed evenly over bounds of
+         * the node
+         */
+        struct SpatialSplit
+        {
+            float cost = std::numeric_limits<float>::infinity();
+
+            // -1 if no spatial split is possible
+            int axis       = -1;
+            float position = 0;
+        };
+
+        struct BuildBounds
+        {
+            BoundingBox bbox;
+            BoundingBox bbox_centroid;
+        };
+
+        // linear bvh uses 30-bit Morton codes up to this number of primitives, and 63-bit ones
+        // beyond, so that large scenes are not flattened by ties of codes
+        static constexpr size_t kMaxPrimitiveMorton30 = 1 << 20;
+
+        // treelets of the linear bvh share this number of leading bits of Morton codes
+        static constexpr int kTreeletBits = 12;
+
+        template <typename MortonCode>
+        struct MortonPrimitive
+        {
+            MortonCode code;
+            uint32_t index;
+        };
+
+        /**
+         * State shared by tasks building subtrees of the same bvh
+         */
+        struct BuildContext
+        {
+            std::span<PrimitiveInfo> prims;
+
+            // node pool with room for the largest possible tree, a binary tree of one primitive
+            // per leaf
+            unique_ptr<LinearBvhNode[]> nodes;
+            std::atomic<uint32_t> num_node = 0;
+
+            // spatial splits are tried where children of the best object split overlap by more
+            // than this area
+            float spatial_split_min_overlap = 0;
+
+            // tasks building subtrees. NOTE a thread waiting for them, or for a parallel loop
+            // within them, may run any pending task of the pool, including those unrelated to the
+            // build, unless the build is isolated by the caller, see `ThreadPool::Isolate`.
+            TaskGroup group;
+
+            uint32_t AllocateChildren() noexcept
+            {
+                return num_node.fetch_add(2, std::memory_order_relaxed);
+            }
+        };
+
+        BvhBuildSetting setting_;
+
         PrimitiveCollection prims_;
 
-        // seialized binary tree for bvh
-        std::vector<LinearBvhNode> bvh_nodes_;
+        // seialized binary tree for bvh, root is the first node. It views either `node_storage_`
+        // or a cache file mapped in memory, both aligned to a cache line. See `LayoutNodes` for
+        // order of nodes.
+        std::span<const LinearBvhNode> bvh_nodes_;
+        NodeStorage node_storage_;
+
+        // cache file that the bvh is loaded from, if any
+        shared_ptr<const MappedFile> cache_file_ = nullptr;
+
+        // SAH cost right after the last build
+        float build_sah_cost_ = 0;
 
     public:
         using PrimitiveCollectionType = PrimitiveCollection;
 
-        BasicBvhComposite(PrimitiveCollection prims) : prims_(std::move(prims))
+        /**
+         * Build bvh over the primitive collection. Subtrees are built in parallel on `pool`, so
+         * it's fine to construct multiple composites concurrently.
+         */
+        BasicBvhComposite(PrimitiveCollection prims, BvhBuildSetting setting = {},
+                          ThreadPool& pool = ThreadPool::Global())
+            : setting_(setting), prims_(std::move(prims))
         {
-            std::vector<PrimitiveInfo> prim_info_vec = prims_.Prepare();
-
-            unique_ptr<BvhNode> bvh_root = BuildBvh(prim_info_vec, 0, prim_info_vec.size());
-
-            prims_.Update(prim_info_vec);
+            USAMI_REQUIRE(setting_.max_leaf_size > 0 && setting_.max_leaf_size <= UINT16_MAX);
+            USAMI_REQUIRE(setting_.spatial_split_budget >= 0);
 
-            // TODO: reserve space to cut unnecessary allocation
-            RegisterBvh(bvh_root.get());
+            Build(pool);
         }
 
         BoundingBox Bounding() const
@@ -202,152 +751,1588 @@ namespace usami::ray
             return ComputeBoundingBox(0);
         }
 
-        bool Intersect(const Ray& ray, float t_min, float t_max, Workspace& ws,
-                       IntersectionInfo& isect) const noexcept
+        /**
+         * Memory used by nodes and primitive collection, in bytes
+         */
+        size_t ByteSize() const noexcept
         {
-            return IntersectAux(0, ray, t_min, t_max, ws, isect);
+            return bvh_nodes_.size() * sizeof(LinearBvhNode) + prims_.ByteSize();
         }
 
-    private:
-        unique_ptr<BvhNode> BuildBvh(std::span<PrimitiveInfo> prims, int prim_info_begin,
-                                     int prim_info_end)
+        /**
+         * Expected cost of tracing a ray hitting the root, under the surface area heuristic
+         */
+        float SahCost() const noexcept
         {
-            USAMI_ASSERT(prim_info_end > prim_info_begin);
-
-            BoundingBox bbox_total = prims[prim_info_begin].bbox;
-            for (const PrimitiveInfo& prim_info :
-                 prims.subspan(prim_info_begin + 1, prim_info_end - prim_info_begin - 1))
+            float root_area = Bounding().Area();
+            if (root_area <= 0)
             {
-                bbox_total = UnionBBox(bbox_total, prim_info.bbox);
+                return 0;
             }
 
-            int partition_axis = 0;
+            float cost = 0;
+            for (size_t i = 0; i < bvh_nodes_.size(); ++i)
             {
-                Vec3f extents     = bbox_total.Extents();
-                float axis_extent = extents[0];
-
-                for (int i = 1; i < 3; ++i)
+                // skip the copy of the root padding children to cache lines
+                if (i == kRootPaddingIndex)
                 {
-                    if (extents[i] > axis_extent)
-                    {
-                        partition_axis = i;
-                        axis_extent    = extents[i];
-                    }
+                    continue;
                 }
+
+                const LinearBvhNode& node = bvh_nodes_[i];
+                float area = BoundingBox{node.bbox_p_min, node.bbox_p_max}.Area();
+                cost += area * (node.prim_num == 0 ? setting_.traversal_cost
+                                                   : IntersectionCost(node.prim_num));
             }
 
-            if (prim_info_end - prim_info_begin <= 8)
+            return cost / root_area;
+        }
+
+        /**
+         * Update the bvh after primitives moved or deformed, keeping the topology. Bounds are
+         * recomputed bottom-up in place, while the tree is rebuilt instead if the refit raises its
+         * SAH cost past `BvhBuildSetting::max_refit_cost_ratio`.
+         *
+         * @return if the tree is rebuilt
+         */
+        bool Refit()
+        {
+            // nodes loaded from a cache file are copied before modified
+            if (node_storage_.empty())
             {
-                return make_unique<BvhNode>(BvhNode{.bbox            = bbox_total,
-                                                    .left            = nullptr,
-                                                    .right           = nullptr,
-                                                    .prim_info_begin = prim_info_begin,
-                                                    .prim_info_end   = prim_info_end,
-                                                    .partition_axis  = partition_axis});
+                node_storage_.assign(bvh_nodes_.begin(), bvh_nodes_.end());
+                bvh_nodes_ = node_storage_;
             }
-            else
-            {
-                int prim_info_mid = std::midpoint(prim_info_begin, prim_info_end);
-
-                PrimitiveInfo* ptr_begin = prims.data() + prim_info_begin;
-                PrimitiveInfo* ptr_end   = prims.data() + prim_info_end;
-                PrimitiveInfo* ptr_mid   = prims.data() + prim_info_mid;
 
-                // split with equal count
-                std::nth_element(
-                    ptr_begin, ptr_mid, ptr_end,
-                    [partition_axis](const PrimitiveInfo& lhs, const PrimitiveInfo& rhs) {
-                        return lhs.centroid[partition_axis] < rhs.centroid[partition_axis];
-                    });
+            ParallelFor(0, node_storage_.size(), [&](size_t i) {
+                LinearBvhNode& node = node_storage_[i];
+                if (node.prim_num != 0)
+                {
+                    BoundingBox bbox = prims_.RefitLeaf(node.prim_offset, node.prim_num);
+                    node.bbox_p_min  = bbox.p_min.Array();
+                    node.bbox_p_max  = bbox.p_max.Array();
+                }
+            });
 
-                // split with midpoint
-                // std::partition(ptr_begin, ptr_end,
-                //                [partition_axis, mid = bbox_total.Centroid()[partition_axis]](
-                //                    const PrimitiveInfo& prim_info) {
-                //                    return prim_info.centroid[partition_axis] < mid;
-                //                });
+            ComputeInnerBounds(node_storage_.data(), static_cast<uint32_t>(node_storage_.size()));
 
-                size_t num_prim_left  = std::distance(ptr_begin, ptr_mid);
-                size_t num_prim_right = std::distance(ptr_mid, ptr_end);
-                return make_unique<BvhNode>(
-                    BvhNode{.bbox            = bbox_total,
-                            .left            = BuildBvh(prims, prim_info_begin, prim_info_mid),
-                            .right           = BuildBvh(prims, prim_info_mid, prim_info_end),
-                            .prim_info_begin = -1,
-                            .prim_info_end   = -1,
-                            .partition_axis  = partition_axis});
+            if (SahCost() > build_sah_cost_ * setting_.max_refit_cost_ratio)
+            {
+                Build(ThreadPool::Global());
+                return true;
             }
-        }
 
-        BoundingBox ComputeBoundingBox(uint32_t inode) const
-        {
-            return BoundingBox{bvh_nodes_[inode].bbox_p_min, bvh_nodes_[inode].bbox_p_max};
+            return false;
         }
 
-        uint32_t RegisterBvh(BvhNode* node)
+        /**
+         * Write nodes and primitive order into a cache file tagged with `key`, which identifies
+         * the primitives and build setting, see `MeshBvhCache`
+         *
+         * @return false if the file cannot be written
+         */
+        bool Save(const std::filesystem::path& path, uint64_t key) const
         {
-            USAMI_ASSERT(node != nullptr);
+            std::span<const int> prim_order = prims_.PrimitiveOrder();
 
-            uint32_t index = bvh_nodes_.size();
-            bvh_nodes_.push_back(LinearBvhNode{
-                .bbox_p_min = node->bbox.p_min.Array(),
-                .bbox_p_max = node->bbox.p_max.Array(),
-                .axis       = static_cast<uint16_t>(node->partition_axis),
-                .prim_num   = static_cast<uint16_t>(node->prim_info_end - node->prim_info_begin),
-            });
+            BvhCacheHeader header{.magic     = kBvhCacheMagic,
+                                  .version   = kBvhCacheVersion,
+                                  .node_size = sizeof(LinearBvhNode),
+                                  .key       = key,
+                                  .num_node  = bvh_nodes_.size(),
+                                  .num_prim  = prim_order.size(),
+                                  .sah_cost  = build_sah_cost_,
+                                  .reserved  = 0};
+            header.node_offset = AlignCacheOffset(sizeof(BvhCacheHeader));
+            header.prim_order_offset =
+                AlignCacheOffset(header.node_offset + bvh_nodes_.size_bytes());
 
-            if (node->left != nullptr)
-            {
-                RegisterBvh(node->left.get());
-                bvh_nodes_[index].right_child_index = RegisterBvh(node->right.get());
-            }
-            else
-            {
-                bvh_nodes_[index].prim_offset = node->prim_info_begin;
-            }
+            std::ofstream file{path, std::ios::binary | std::ios::trunc};
+            auto write_at = [&](uint64_t offset, std::span<const std::byte> bytes) {
+                static constexpr char kPadding[64] = {};
+                file.write(kPadding, offset - static_cast<uint64_t>(file.tellp()));
+                file.write(reinterpret_cast<const char*>(bytes.data()), bytes.size());
+            };
+
+            write_at(0, std::as_bytes(std::span{&header, 1}));
+            write_at(header.node_offset, std::as_bytes(bvh_nodes_));
+            write_at(header.prim_order_offset, std::as_bytes(prim_order));
 
-            return index;
+            file.close();
+            return !file.fail();
         }
 
-        bool IntersectAux(uint32_t inode, const Ray& ray, float t_min, float t_max, Workspace& ws,
-                          IntersectionInfo& isect) const noexcept
+        /**
+         * Create a bvh from a cache file written by `Save`, where nodes and primitive order are
+         * used in place instead of building
+         *
+         * @return nullptr if the file isn't a valid cache tagged with `key`
+         */
+        static unique_ptr<BasicBvhComposite> Load(PrimitiveCollection prims,
+                                                  shared_ptr<const MappedFile> file, uint64_t key,
+                                                  BvhBuildSetting setting = {},
+                                                  ThreadPool& pool = ThreadPool::Global())
         {
-            if (float t_hit; !ComputeBoundingBox(inode).Occlude(ray, t_min, t_max, t_hit))
+            std::span<const std::byte> data = file->Data();
+            if (data.size() < sizeof(BvhCacheHeader))
             {
-                return false;
+                return nullptr;
             }
 
-            const LinearBvhNode& node = bvh_nodes_[inode];
-            if (node.prim_num != 0)
+            BvhCacheHeader header;
+            std::memcpy(&header, data.data(), sizeof(BvhCacheHeader));
+            if (header.magic != kBvhCacheMagic || header.version != kBvhCacheVersion ||
+                header.node_size != sizeof(LinearBvhNode) || header.key != key)
             {
-                // leaf
-                return prims_.Intersect(node.prim_offset, node.prim_num, ray, t_min, t_max, ws,
-                                        isect);
+                return nullptr;
             }
-            else
+
+            // NOTE sizes are checked before multiplied, so that nothing overflows
+            auto fits = [&](uint64_t offset, uint64_t count, size_t elem_size, size_t align) {
+                return offset % align == 0 && offset <= data.size() &&
+                       count <= (data.size() - offset) / elem_size;
+            };
+            if (header.num_node == 0 ||
+                !fits(header.node_offset, header.num_node, sizeof(LinearBvhNode),
+                      alignof(LinearBvhNode)) ||
+                !fits(header.prim_order_offset, header.num_prim, sizeof(int), alignof(int)))
+            {
+                return nullptr;
+            }
+
+            std::span<const LinearBvhNode> nodes{
+                reinterpret_cast<const LinearBvhNode*>(data.data() + header.node_offset),
+                header.num_node};
+            std::span<const int> prim_order{
+                reinterpret_cast<const int*>(data.data() + header.prim_order_offset),
+                header.num_prim};
+            if (!ValidateNodes(nodes, prim_order.size()) ||
+                !prims.RestorePrimitiveOrder(prim_order, pool))
+            {
+                return nullptr;
+            }
+
+            return unique_ptr<BasicBvhComposite>{new BasicBvhComposite{
+                std::move(prims), setting, std::move(file), nodes, header.sah_cost}};
+        }
+
+        /**
+         * Find the closest hit, visiting the nearer child first and culling nodes beyond the
+         * closest hit found so far
+         */
+        bool Intersect(const Ray& ray, float t_min, float t_max, Workspace& ws,
+                       IntersectionInfo& isect) const noexcept
+        {
+            Vec3f inv_d     = 1.f / ray.d;
+            bool dir_neg[3] = {inv_d[0] < 0, inv_d[1] < 0, inv_d[2] < 0};
+
+            uint32_t stack[kMaxTraversalDepth];
+            int stack_size = 0;
+
+            bool hit       = false;
+            uint32_t inode = 0;
+            while (true)
             {
-                // non-leaf
-                uint32_t ichild_left  = inode + 1;
-                uint32_t ichild_right = node.right_child_index;
+                const LinearBvhNode& node = bvh_nodes_[inode];
+                if (ComputeBoundingBox(inode).IntersectSlab(ray.o, inv_d, t_min, t_max))
+                {
+                    if (node.prim_num != 0)
+                    {
+                        // leaf
+                        if (prims_.Intersect(node.prim_offset, node.prim_num, ray, t_min, t_max,
+                                             ws, isect))
+                        {
+                            hit   = true;
+                            t_max = isect.t;
+                        }
+                    }
+                    else
+                    {
+                        // non-leaf, the left child holds primitives with smaller centroids
+                        USAMI_ASSERT(stack_size < kMaxTraversalDepth);
+                        if (dir_neg[node.axis])
+                        {
+                            stack[stack_size++] = node.child_index;
+                            inode               = node.child_index + 1;
+                        }
+                        else
+                        {
+                            stack[stack_size++] = node.child_index + 1;
+                            inode               = node.child_index;
+                        }
+
+                        continue;
+                    }
+                }
+
+                if (stack_size == 0)
+                {
+                    break;
+                }
+
+                inode = stack[--stack_size];
+            }
+
+            return hit;
+        }
+
+        bool Intersect(const Ray& ray, float t_min, float t_max, Workspace& ws,
+                       OcclusionInfo& occ_out) const noexcept
+        {
+            Vec3f inv_d = 1.f / ray.d;
 
-                IntersectionInfo isect_tmp;
+            uint32_t stack[kMaxTraversalDepth];
+            int stack_size = 0;
 
-                bool hit_left  = IntersectAux(ichild_left, ray, t_min, t_max, ws, isect);
-                bool hit_right = IntersectAux(ichild_right, ray, t_min, t_max, ws, isect_tmp);
-                if (hit_right)
+            uint32_t inode = 0;
+            while (true)
+            {
+                const LinearBvhNode& node = bvh_nodes_[inode];
+                if (ComputeBoundingBox(inode).IntersectSlab(ray.o, inv_d, t_min, t_max))
                 {
-                    if (!hit_left || isect_tmp.t < isect.t)
+                    if (node.prim_num != 0)
+                    {
+                        // leaf, any hit is enough
+                        if (prims_.Intersect(node.prim_offset, node.prim_num, ray, t_min, t_max,
+                                             ws, occ_out))
+                        {
+                            return true;
+                        }
+                    }
+                    else
                     {
-                        isect = isect_tmp;
+                        USAMI_ASSERT(stack_size < kMaxTraversalDepth);
+                        stack[stack_size++] = node.child_index + 1;
+                        inode               = node.child_index;
+
+                        continue;
                     }
                 }
-                else if (!hit_left)
+
+                if (stack_size == 0)
                 {
                     return false;
                 }
 
-                return true;
+                inode = stack[--stack_size];
+            }
+        }
+
+    private:
+        BasicBvhComposite(PrimitiveCollection prims, BvhBuildSetting setting,
+                          shared_ptr<const MappedFile> cache_file,
+                          std::span<const LinearBvhNode> nodes, float sah_cost)
+            : setting_(setting), prims_(std::move(prims)), bvh_nodes_(nodes),
+              cache_file_(std::move(cache_file)), build_sah_cost_(sah_cost)
+        {
+        }
+
+        static uint64_t AlignCacheOffset(uint64_t offset) noexcept
+        {
+            // cache line aligned
+            return (offset + 63) & ~uint64_t{63};
+        }
+
+        /**
+         * Check that nodes loaded from a file form a tree over `num_prim` primitives no deeper
+         * than `kMaxTraversalDepth`, so that a corrupted file cannot lead traversal out of bounds
+         * of either the nodes or its stack
+         */
+        static bool ValidateNodes(std::span<const LinearBvhNode> nodes, size_t num_prim)
+        {
+            // depth of each node, which is final when the node is visited as children always
+            // come after their parent
+            std::vector<int> depth(nodes.size(), 0);
+
+            for (size_t i = 0; i < nodes.size(); ++i)
+            {
+                const LinearBvhNode& node = nodes[i];
+                if (node.axis > 2)
+                {
+                    return false;
+                }
+
+                if (node.prim_num != 0)
+                {
+                    if (size_t{node.prim_offset} + node.prim_num > num_prim)
+                    {
+                        return false;
+                    }
+                }
+                else if (node.child_index <= i || size_t{node.child_index} + 1 >= nodes.size())
+                {
+                    return false;
+                }
+                else
+                {
+                    // traversal pushes one entry onto the stack for each interior node on the
+                    // path, which must stay below `kMaxTraversalDepth`
+                    if (depth[i] + 1 >= kMaxTraversalDepth)
+                    {
+                        return false;
+                    }
+
+                    for (size_t child : {size_t{node.child_index}, size_t{node.child_index} + 1})
+                    {
+                        depth[child] = std::max(depth[child], depth[i] + 1);
+                    }
+                }
+            }
+
+            return true;
+        }
+
+        /**
+         * (Re)build the tree from current primitives, where every task is run by `pool`
+         */
+        void Build(ThreadPool& pool)
+        {
+            std::vector<PrimitiveInfo> prim_info_vec = prims_.Prepare(pool);
+            USAMI_REQUIRE(!prim_info_vec.empty());
+
+            int num_prim = static_cast<int>(prim_info_vec.size());
+
+            bool use_spatial_split = kSpatialSplitSupported &&
+                                     setting_.algorithm == BvhBuildAlgorithm::TopDown &&
+                                     setting_.quality != BvhBuildQuality::Low &&
+                                     setting_.spatial_split_budget > 0;
+            if (use_spatial_split)
+            {
+                // room for references duplicated by spatial splits
+                double capacity = num_prim * (1. + setting_.spatial_split_budget);
+                prim_info_vec.resize(static_cast<size_t>(std::min<double>(capacity, INT32_MAX)),
+                                     PrimitiveInfo{.bbox = Vec3f{}, .centroid = {}, .index = 0});
+            }
+
+            size_t max_num_node = 2 * prim_info_vec.size() - 1;
+
+            BuildContext ctx{.prims = prim_info_vec,
+                             .nodes = std::make_unique_for_overwrite<LinearBvhNode[]>(max_num_node),
+                             .group = TaskGroup{pool}};
+            ctx.num_node = 1;
+
+            if (setting_.algorithm == BvhBuildAlgorithm::Linear)
+            {
+                if (prim_info_vec.size() <= kMaxPrimitiveMorton30)
+                {
+                    BuildLinearBvh<uint32_t>(ctx);
+                }
+                else
+                {
+                    BuildLinearBvh<uint64_t>(ctx);
+                }
+            }
+            else if (use_spatial_split)
+            {
+                if constexpr (kSpatialSplitSupported)
+                {
+                    BoundingBox bbox = ComputeBounds(prim_info_vec, 0, num_prim, pool).bbox;
+                    ctx.spatial_split_min_overlap = kSpatialSplitMinOverlap * bbox.Area();
+
+                    BuildSbvh(ctx, 0, 0, 0, num_prim, static_cast<int>(prim_info_vec.size()));
+                    ctx.group.Wait();
+
+                    prim_info_vec = CompactReferences(ctx);
+                }
+            }
+            else
+            {
+                BuildBvh(ctx, 0, 0, 0, num_prim);
+                ctx.group.Wait();
+            }
+
+            prims_.Update(prim_info_vec, pool);
+
+            node_storage_   = LayoutNodes(ctx.nodes.get(), ctx.num_node.load());
+            bvh_nodes_      = node_storage_;
+            build_sah_cost_ = SahCost();
+            cache_file_     = nullptr;
+        }
+
+        /**
+         * Reorder nodes of a built tree for locality of traversal, where each pair of children
+         * fills a cache line and each page holds a treelet, i.e. a connected subtree
+         *
+         * A treelet grows from its root by the pair of children with the largest parent, i.e. the
+         * one most likely visited by a ray, until it fills the rest of the page. Pairs left out
+         * start the next treelets, which are placed depth-first so that a subtree spans adjacent
+         * pages. Children are still placed after their parent.
+         */
+        static NodeStorage LayoutNodes(const LinearBvhNode* nodes, uint32_t num_node)
+        {
+            constexpr uint32_t kNodePerPage = kPageSize / sizeof(LinearBvhNode);
+
+            NodeStorage result;
+            if (num_node == 1)
+            {
+                result.assign(nodes, nodes + 1);
+                return result;
+            }
+
+            // the root is followed by a copy of itself, so that pairs of children start at a cache
+            // line
+            result.resize(num_node + 1);
+            result[0] = nodes[0];
+
+            struct PendingPair
+            {
+                float parent_area;
+
+                // index of the parent in `result` and of the first child in `nodes`
+                uint32_t parent;
+                uint32_t first_child;
+            };
+
+            auto make_pending = [&](uint32_t iparent) {
+                const LinearBvhNode& parent = result[iparent];
+                return PendingPair{
+                    .parent_area = BoundingBox{parent.bbox_p_min, parent.bbox_p_max}.Area(),
+                    .parent      = iparent,
+                    .first_child = parent.child_index};
+            };
+            auto area_less = [](const PendingPair& lhs, const PendingPair& rhs) {
+                return lhs.parent_area < rhs.parent_area;
+            };
+
+            std::vector<PendingPair> treelet_roots = {make_pending(0)};
+            std::vector<PendingPair> frontier;
+
+            uint32_t inext = kRootPaddingIndex + 1;
+            while (!treelet_roots.empty())
+            {
+                frontier.assign(1, treelet_roots.back());
+                treelet_roots.pop_back();
+
+                uint32_t page_end = (inext / kNodePerPage + 1) * kNodePerPage;
+                while (inext < page_end && !frontier.empty())
+                {
+                    std::pop_heap(frontier.begin(), frontier.end(), area_less);
+                    PendingPair pair = frontier.back();
+                    frontier.pop_back();
+
+                    result[pair.parent].child_index = inext;
+                    result[inext]                   = nodes[pair.first_child];
+                    result[inext + 1]               = nodes[pair.first_child + 1];
+                    for (uint32_t inode = inext; inode < inext + 2; ++inode)
+                    {
+                        if (result[inode].prim_num == 0)
+                        {
+                            frontier.push_back(make_pending(inode));
+                            std::push_heap(frontier.begin(), frontier.end(), area_less);
+                        }
+                    }
+
+                    inext += 2;
+                }
+
+                // the largest pair left out is placed first
+                std::sort(frontier.begin(), frontier.end(), area_less);
+                treelet_roots.insert(treelet_roots.end(), frontier.begin(), frontier.end());
+            }
+
+            result[kRootPaddingIndex] = result[0];
+            return result;
+        }
+
+        /**
+         * Build subtree of primitives in [prim_info_begin, prim_info_end) into node `inode`,
+         * where the left subtree of a large node is forked into `ctx.group`
+         */
+        void BuildBvh(BuildContext& ctx, uint32_t inode, int depth, int prim_info_begin,
+                      int prim_info_end)
+        {
+            USAMI_ASSERT(prim_info_end > prim_info_begin);
+
+            ThreadPool& pool   = ctx.group.Pool();
+            BuildBounds bounds = ComputeBounds(ctx.prims, prim_info_begin, prim_info_end, pool);
+
+            int partition_axis = MaxExtentAxis(bounds.bbox);
+
+            bool use_sah      = setting_.quality != BvhBuildQuality::Low && depth < kMaxSahDepth;
+            int prim_info_mid = use_sah ? SplitSah(ctx.prims, prim_info_begin, prim_info_end,
+                                                   bounds, setting_.max_leaf_size, partition_axis,
+                                                   pool)
+                                        : SplitMedian(ctx.prims, prim_info_begin, prim_info_end,
+                                                      setting_.max_leaf_size, partition_axis);
+
+            LinearBvhNode& node = ctx.nodes[inode];
+            node.bbox_p_min     = bounds.bbox.p_min.Array();
+            node.bbox_p_max     = bounds.bbox.p_max.Array();
+            node.axis           = static_cast<uint16_t>(partition_axis);
+
+            if (prim_info_mid < 0)
+            {
+                node.prim_num    = static_cast<uint16_t>(prim_info_end - prim_info_begin);
+                node.prim_offset = prim_info_begin;
+                return;
+            }
+
+            uint32_t ichild  = ctx.AllocateChildren();
+            node.prim_num    = 0;
+            node.child_index = ichild;
+
+            if (prim_info_mid - prim_info_begin >= kParallelSubtreeThreshold &&
+                ctx.group.Pool().NumWorkers() > 0)
+            {
+                ctx.group.Run([this, &ctx, ichild, depth, prim_info_begin, prim_info_mid] {
+                    BuildBvh(ctx, ichild, depth + 1, prim_info_begin, prim_info_mid);
+                });
+            }
+            else
+            {
+                BuildBvh(ctx, ichild, depth + 1, prim_info_begin, prim_info_mid);
+            }
+
+            BuildBvh(ctx, ichild + 1, depth + 1, prim_info_mid, prim_info_end);
+        }
+
+        /**
+         * Build subtree of primitive references in [prim_info_begin, prim_info_end) into node
+         * `inode` like `BuildBvh`, trying spatial splits besides object splits. References
+         * duplicated by spatial splits take room in [prim_info_end, prim_info_capacity), which is
+         * shared by children in proportion to their number of references.
+         */
+        void BuildSbvh(BuildContext& ctx, uint32_t inode, int depth, int prim_info_begin,
+                       int prim_info_end, int prim_info_capacity)
+        {
+            USAMI_ASSERT(prim_info_end > prim_info_begin);
+
+            std::span<PrimitiveInfo> prims = ctx.prims;
+            ThreadPool& pool               = ctx.group.Pool();
+            int num_prim                   = prim_info_end - prim_info_begin;
+            BuildBounds bounds = ComputeBounds(prims, prim_info_begin, prim_info_end, pool);
+
+            ObjectSplit object_split;
+            SpatialSplit spatial_split;
+            if (num_prim > 1 && depth < kMaxSahDepth)
+            {
+                object_split =
+                    FindObjectSplit(prims, prim_info_begin, prim_info_end, bounds, pool);
+
+                BoundingBox overlap =
+                    IntersectBBox(object_split.left_bbox, object_split.right_bbox);
+                bool overlapped = object_split.axis < 0 ||
+                                  (!overlap.IsEmpty() &&
+                                   overlap.Area() > ctx.spatial_split_min_overlap);
+                if (overlapped && prim_info_capacity > prim_info_end)
+                {
+                    spatial_split = FindSpatialSplit(prims, prim_info_begin, prim_info_end,
+                                                     bounds.bbox, pool);
+                }
+            }
+
+            LinearBvhNode& node = ctx.nodes[inode];
+            node.bbox_p_min     = bounds.bbox.p_min.Array();
+            node.bbox_p_max     = bounds.bbox.p_max.Array();
+
+            auto make_leaf = [&] {
+                node.axis        = 0;
+                node.prim_num    = static_cast<uint16_t>(num_prim);
+                node.prim_offset = prim_info_begin;
+            };
+
+            // make a leaf if intersecting all references is cheaper than any split
+            float leaf_cost = IntersectionCost(num_prim);
+            if (num_prim <= setting_.max_leaf_size &&
+                leaf_cost <= std::min(object_split.cost, spatial_split.cost))
+            {
+                make_leaf();
+                return;
+            }
+
+            int partition_axis      = 0;
+            int prim_info_mid       = -1;
+            int prim_info_split_end = prim_info_end;
+            if (spatial_split.cost < object_split.cost)
+            {
+                partition_axis = spatial_split.axis;
+                prim_info_mid =
+                    PartitionSpatialSplit(prims, prim_info_begin, prim_info_end,
+                                          prim_info_capacity, spatial_split, prim_info_split_end);
+            }
+
+            if (prim_info_mid < 0)
+            {
+                // no spatial split or it runs out of room
+                prim_info_split_end = prim_info_end;
+                if (object_split.axis >= 0)
+                {
+                    partition_axis = object_split.axis;
+                    prim_info_mid  = PartitionObjectSplit(prims, prim_info_begin, prim_info_end,
+                                                          object_split);
+                }
+                else
+                {
+                    partition_axis = MaxExtentAxis(bounds.bbox);
+                    prim_info_mid  = SplitMedian(prims, prim_info_begin, prim_info_end,
+                                                 setting_.max_leaf_size, partition_axis);
+                    if (prim_info_mid < 0)
+                    {
+                        make_leaf();
+                        return;
+                    }
+                }
+            }
+
+            // share the room left between children, moving references of the right child after
+            // the room of the left one
+            int num_left      = prim_info_mid - prim_info_begin;
+            int num_right     = prim_info_split_end - prim_info_mid;
+            int num_free      = prim_info_capacity - prim_info_split_end;
+            int num_left_free = static_cast<int>(int64_t{num_free} * num_left /
+                                                 (num_left + num_right));
+
+            std::move_backward(prims.begin() + prim_info_mid,
+                               prims.begin() + prim_info_split_end,
+                               prims.begin() + prim_info_split_end + num_left_free);
+
+            int prim_info_left_capacity = prim_info_mid + num_left_free;
+            int prim_info_right_end     = prim_info_split_end + num_left_free;
+
+            uint32_t ichild  = ctx.AllocateChildren();
+            node.axis        = static_cast<uint16_t>(partition_axis);
+            node.prim_num    = 0;
+            node.child_index = ichild;
+
+            if (num_left >= kParallelSubtreeThreshold && ctx.group.Pool().NumWorkers() > 0)
+            {
+                ctx.group.Run([this, &ctx, ichild, depth, prim_info_begin, prim_info_mid,
+                               prim_info_left_capacity] {
+                    BuildSbvh(ctx, ichild, depth + 1, prim_info_begin, prim_info_mid,
+                              prim_info_left_capacity);
+                });
+            }
+            else
+            {
+                BuildSbvh(ctx, ichild, depth + 1, prim_info_begin, prim_info_mid,
+                          prim_info_left_capacity);
+            }
+
+            BuildSbvh(ctx, ichild + 1, depth + 1, prim_info_left_capacity, prim_info_right_end,
+                      prim_info_capacity);
+        }
+
+        /**
+         * Pack references of leaves built by `BuildSbvh` in their order, dropping the room left
+         * unused, and point leaves to their new offsets
+         */
+        static std::vector<PrimitiveInfo> CompactReferences(BuildContext& ctx)
+        {
+            std::vector<uint32_t> leaves;
+            for (uint32_t i = 0; i < ctx.num_node.load(); ++i)
+            {
+                if (ctx.nodes[i].prim_num != 0)
+                {
+                    leaves.push_back(i);
+                }
+            }
+
+            std::sort(leaves.begin(), leaves.end(), [&](uint32_t lhs, uint32_t rhs) {
+                return ctx.nodes[lhs].prim_offset < ctx.nodes[rhs].prim_offset;
+            });
+
+            std::vector<PrimitiveInfo> result;
+            for (uint32_t ileaf : leaves)
+            {
+                LinearBvhNode& node = ctx.nodes[ileaf];
+                auto first          = ctx.prims.begin() + node.prim_offset;
+
+                node.prim_offset = static_cast<uint32_t>(result.size());
+                result.insert(result.end(), first, first + node.prim_num);
+            }
+
+            return result;
+        }
+
+        /**
+         * Build linear bvh of all primitives, which sorts them along the Morton curve and emits
+         * nodes top-down. Bounds of inner nodes are filled by a final bottom-up pass.
+         */
+        template <typename MortonCode>
+        void BuildLinearBvh(BuildContext& ctx)
+        {
+            constexpr int kCodeBits = sizeof(MortonCode) == 4 ? 30 : 63;
+            constexpr int kAxisBits = kCodeBits / 3;
+
+            std::span<PrimitiveInfo> prims = ctx.prims;
+            ThreadPool& pool               = ctx.group.Pool();
+            int num_prim                   = static_cast<int>(prims.size());
+
+            // quantize centroids onto a grid over bounds of centroids
+            BuildBounds bounds = ComputeBounds(prims, 0, num_prim, pool);
+            Vec3f extents      = bounds.bbox_centroid.Extents();
+            Vec3f grid_scale;
+            for (int axis = 0; axis < 3; ++axis)
+            {
+                grid_scale[axis] =
+                    extents[axis] > 0 ? (1 << kAxisBits) * (1 - 1e-4f) / extents[axis] : 0.f;
+            }
+
+            std::vector<MortonPrimitive<MortonCode>> morton_prims;
+            morton_prims.resize(num_prim);
+            ParallelFor(
+                0, num_prim,
+                [&](size_t i) {
+                    Vec3f grid_pos = (prims[i].centroid - bounds.bbox_centroid.p_min) * grid_scale;
+                    morton_prims[i] = {EncodeMorton<MortonCode>(grid_pos),
+                                       static_cast<uint32_t>(i)};
+                },
+                pool);
+
+            ParallelRadixSort(
+                std::span{morton_prims}, kCodeBits,
+                [](const MortonPrimitive<MortonCode>& p) { return p.code; }, pool);
+
+            std::vector<MortonCode> codes;
+            {
+                std::vector<PrimitiveInfo> unsorted_prims{prims.begin(), prims.end()};
+
+                codes.resize(num_prim);
+                ParallelFor(
+                    0, num_prim,
+                    [&](size_t i) {
+                        prims[i] = unsorted_prims[morton_prims[i].index];
+                        codes[i] = morton_prims[i].code;
+                    },
+                    pool);
+            }
+
+            if (setting_.quality == BvhBuildQuality::Low)
+            {
+                BuildLinearSubtree<MortonCode>(ctx, codes, 0, 0, 0, num_prim);
+            }
+            else
+            {
+                // cut primitives into treelets at changes of leading bits
+                std::vector<PrimitiveInfo> treelets;
+                std::vector<int> treelet_begin;
+                for (int i = 0; i < num_prim; ++i)
+                {
+                    constexpr int kShift = kCodeBits - kTreeletBits;
+                    if (i == 0 || (codes[i] >> kShift) != (codes[i - 1] >> kShift))
+                    {
+                        treelet_begin.push_back(i);
+                    }
+                }
+                treelet_begin.push_back(num_prim);
+
+                treelets.resize(treelet_begin.size() - 1,
+                                PrimitiveInfo{.bbox = Vec3f{}, .centroid = {}, .index = 0});
+                ParallelFor(
+                    0, treelets.size(),
+                    [&](size_t i) {
+                        BoundingBox bbox =
+                            ComputeBounds(prims, treelet_begin[i], treelet_begin[i + 1], pool)
+                                .bbox;
+                        treelets[i] =
+                            PrimitiveInfo{.bbox = bbox, .centroid = bbox.Centroid(), .index = i};
+                    },
+                    pool);
+
+                BuildTreeletTree<MortonCode>(ctx, codes, treelets, treelet_begin, 0, 0, 0,
+                                             static_cast<int>(treelets.size()));
+            }
+
+            ctx.group.Wait();
+
+            ComputeInnerBounds(ctx.nodes.get(), ctx.num_node.load());
+        }
+
+        /**
+         * Build upper levels over treelets with the surface area heuristic, where a treelet is
+         * built as a linear bvh subtree into the leaf holding it
+         */
+        template <typename MortonCode>
+        void BuildTreeletTree(BuildContext& ctx, std::span<const MortonCode> codes,
+                              std::span<PrimitiveInfo> treelets,
+                              std::span<const int> treelet_begin, uint32_t inode, int depth,
+                              int treelet_info_begin, int treelet_info_end)
+        {
+            USAMI_ASSERT(treelet_info_end > treelet_info_begin);
+
+            if (treelet_info_end - treelet_info_begin == 1)
+            {
+                size_t itreelet = treelets[treelet_info_begin].index;
+                int begin       = treelet_begin[itreelet];
+                int end         = treelet_begin[itreelet + 1];
+                if (end - begin >= kParallelSubtreeThreshold && ctx.group.Pool().NumWorkers() > 0)
+                {
+                    ctx.group.Run([this, &ctx, codes, inode, depth, begin, end] {
+                        BuildLinearSubtree<MortonCode>(ctx, codes, inode, depth, begin, end);
+                    });
+                }
+                else
+                {
+                    BuildLinearSubtree<MortonCode>(ctx, codes, inode, depth, begin, end);
+                }
+
+                return;
+            }
+
+            BuildBounds bounds =
+                ComputeBounds(treelets, treelet_info_begin, treelet_info_end, ctx.group.Pool());
+
+            int partition_axis = 0;
+            int treelet_info_mid =
+                depth < kMaxSahDepth
+                    ? SplitSah(treelets, treelet_info_begin, treelet_info_end, bounds, 1,
+                               partition_axis, ctx.group.Pool())
+                    : SplitMedian(treelets, treelet_info_begin, treelet_info_end, 1,
+                                  partition_axis);
+
+            uint32_t ichild = ctx.AllocateChildren();
+
+            LinearBvhNode& node = ctx.nodes[inode];
+            node.axis           = static_cast<uint16_t>(partition_axis);
+            node.prim_num       = 0;
+            node.child_index    = ichild;
+
+            BuildTreeletTree<MortonCode>(ctx, codes, treelets, treelet_begin, ichild, depth + 1,
+                                         treelet_info_begin, treelet_info_mid);
+            BuildTreeletTree<MortonCode>(ctx, codes, treelets, treelet_begin, ichild + 1,
+                                         depth + 1, treelet_info_mid, treelet_info_end);
+        }
+
+        /**
+         * Build linear bvh subtree of primitives in [prim_info_begin, prim_info_end) sorted by
+         * Morton codes into node `inode`. Bounds of inner nodes are left to `ComputeInnerBounds`.
+         */
+        template <typename MortonCode>
+        void BuildLinearSubtree(BuildContext& ctx, std::span<const MortonCode> codes,
+                                uint32_t inode, int depth, int prim_info_begin, int prim_info_end)
+        {
+            USAMI_ASSERT(prim_info_end > prim_info_begin);
+
+            LinearBvhNode& node = ctx.nodes[inode];
+
+            // leaves are capped to whole batches if primitives are tested in batches, as a
+            // partial batch costs as much as a full one, see `IntersectionCost`
+            int num_prim      = prim_info_end - prim_info_begin;
+            int max_leaf_size = setting_.max_leaf_size;
+            int batch_size    = prims_.IntersectBatchSize();
+            if (batch_size > 1 && max_leaf_size >= batch_size)
+            {
+                max_leaf_size -= max_leaf_size % batch_size;
             }
+
+            if (num_prim <= max_leaf_size)
+            {
+                BoundingBox bbox =
+                    ComputeBounds(ctx.prims, prim_info_begin, prim_info_end, ctx.group.Pool())
+                        .bbox;
+
+                node.bbox_p_min  = bbox.p_min.Array();
+                node.bbox_p_max  = bbox.p_max.Array();
+                node.axis        = 0;
+                node.prim_num    = static_cast<uint16_t>(num_prim);
+                node.prim_offset = prim_info_begin;
+                return;
+            }
+
+            // split where the highest bit differing in the range flips, which is a plane halving
+            // the grid cell of the range. Primitives sharing a code, or those too deep for the
+            // traversal stack, are split at the median.
+            int partition_axis = 0;
+            int prim_info_mid  = std::midpoint(prim_info_begin, prim_info_end);
+
+            MortonCode diff = codes[prim_info_begin] ^ codes[prim_info_end - 1];
+            if (diff != 0 && depth < kMaxSahDepth)
+            {
+                int bit          = std::bit_width(diff) - 1;
+                MortonCode mask  = MortonCode{1} << bit;
+                auto it_mid      = std::partition_point(
+                    codes.begin() + prim_info_begin, codes.begin() + prim_info_end,
+                    [mask](MortonCode code) { return (code & mask) == 0; });
+
+                partition_axis = 2 - bit % 3;
+                prim_info_mid  = static_cast<int>(std::distance(codes.begin(), it_mid));
+            }
+
+            uint32_t ichild  = ctx.AllocateChildren();
+            node.axis        = static_cast<uint16_t>(partition_axis);
+            node.prim_num    = 0;
+            node.child_index = ichild;
+
+            if (prim_info_mid - prim_info_begin >= kParallelSubtreeThreshold &&
+                ctx.group.Pool().NumWorkers() > 0)
+            {
+                ctx.group.Run([this, &ctx, codes, ichild, depth, prim_info_begin, prim_info_mid] {
+                    BuildLinearSubtree<MortonCode>(ctx, codes, ichild, depth + 1, prim_info_begin,
+                                                   prim_info_mid);
+                });
+            }
+            else
+            {
+                BuildLinearSubtree<MortonCode>(ctx, codes, ichild, depth + 1, prim_info_begin,
+                                               prim_info_mid);
+            }
+
+            BuildLinearSubtree<MortonCode>(ctx, codes, ichild + 1, depth + 1, prim_info_mid,
+                                           prim_info_end);
+        }
+
+        /**
+         * Interleave bits of integer parts of `grid_pos`, where x takes the highest bit
+         */
+        template <typename MortonCode>
+        static MortonCode EncodeMorton(Vec3f grid_pos) noexcept
+        {
+            auto expand_bits = [](MortonCode x) {
+                if constexpr (sizeof(MortonCode) == 4)
+                {
+                    // 10 bits
+                    x = (x * 0x00010001u) & 0xFF0000FFu;
+                    x = (x * 0x00000101u) & 0x0F00F00Fu;
+                    x = (x * 0x00000011u) & 0xC30C30C3u;
+                    x = (x * 0x00000005u) & 0x49249249u;
+                }
+                else
+                {
+                    // 21 bits
+                    x = (x | x << 32) & 0x001F00000000FFFFull;
+                    x = (x | x << 16) & 0x001F0000FF0000FFull;
+                    x = (x | x << 8) & 0x100F00F00F00F00Full;
+                    x = (x | x << 4) & 0x10C30C30C30C30C3ull;
+                    x = (x | x << 2) & 0x1249249249249249ull;
+                }
+
+                return x;
+            };
+
+            return (expand_bits(static_cast<MortonCode>(grid_pos[0])) << 2) |
+                   (expand_bits(static_cast<MortonCode>(grid_pos[1])) << 1) |
+                   expand_bits(static_cast<MortonCode>(grid_pos[2]));
+        }
+
+        /**
+         * Fill bounds of inner nodes from their children, relying on children being allocated
+         * after their parent
+         */
+        static void ComputeInnerBounds(LinearBvhNode* nodes, uint32_t num_node)
+        {
+            for (uint32_t i = num_node; i-- > 0;)
+            {
+                LinearBvhNode& node = nodes[i];
+                if (node.prim_num == 0)
+                {
+                    const LinearBvhNode& left  = nodes[node.child_index];
+                    const LinearBvhNode& right = nodes[node.child_index + 1];
+
+                    BoundingBox bbox = UnionBBox(BoundingBox{left.bbox_p_min, left.bbox_p_max},
+                                                 BoundingBox{right.bbox_p_min, right.bbox_p_max});
+                    node.bbox_p_min  = bbox.p_min.Array();
+                    node.bbox_p_max  = bbox.p_max.Array();
+                }
+            }
+        }
+
+        static bool UseParallelBinning(int num_prim) noexcept
+        {
+            return num_prim >= 2 * kParallelBinningChunk;
+        }
+
+        static size_t NumBinningChunk(int num_prim) noexcept
+        {
+            return (num_prim + kParallelBinningChunk - 1) / kParallelBinningChunk;
+        }
+
+        /**
+         * Invoke `f(chunk_begin, chunk_end, ichunk)` over chunks of [begin, end) in parallel
+         */
+        template <typename F>
+        static void ForEachBinningChunk(int begin, int end, const F& f, ThreadPool& pool)
+        {
+            ParallelFor(
+                0, NumBinningChunk(end - begin), 1,
+                [&](size_t ichunk) {
+                    int chunk_begin = begin + static_cast<int>(ichunk) * kParallelBinningChunk;
+                    int chunk_end   = std::min(end, chunk_begin + kParallelBinningChunk);
+                    f(chunk_begin, chunk_end, ichunk);
+                },
+                pool);
+        }
+
+        static BuildBounds ComputeBounds(std::span<const PrimitiveInfo> prims, int prim_info_begin,
+                                         int prim_info_end, ThreadPool& pool)
+        {
+            auto compute = [&](int begin, int end) {
+                BuildBounds result{prims[begin].bbox, prims[begin].centroid};
+                for (int i = begin + 1; i < end; ++i)
+                {
+                    result.bbox          = UnionBBox(result.bbox, prims[i].bbox);
+                    result.bbox_centroid = UnionBBox(result.bbox_centroid, prims[i].centroid);
+                }
+
+                return result;
+            };
+
+            if (!UseParallelBinning(prim_info_end - prim_info_begin))
+            {
+                return compute(prim_info_begin, prim_info_end);
+            }
+
+            std::vector<BuildBounds> partial;
+            partial.resize(NumBinningChunk(prim_info_end - prim_info_begin),
+                           BuildBounds{Vec3f{}, Vec3f{}});
+            ForEachBinningChunk(
+                prim_info_begin, prim_info_end,
+                [&](int begin, int end, size_t ichunk) { partial[ichunk] = compute(begin, end); },
+                pool);
+
+            BuildBounds result = partial[0];
+            for (size_t i = 1; i < partial.size(); ++i)
+            {
+                result.bbox          = UnionBBox(result.bbox, partial[i].bbox);
+                result.bbox_centroid = UnionBBox(result.bbox_centroid, partial[i].bbox_centroid);
+            }
+
+            return result;
+        }
+
+        /**
+         * Cost of intersecting a ray with `num_prim` primitives in a leaf, relative to a single
+         * primitive. Collections that test primitives in batches are charged per batch.
+         */
+        float IntersectionCost(int num_prim) const noexcept
+        {
+            int batch_size = prims_.IntersectBatchSize();
+            return static_cast<float>((num_prim + batch_size - 1) / batch_size);
+        }
+
+        /**
+         * Split primitives with equal count along `partition_axis`, unless there are no more than
+         * `max_leaf_size` of them
+         *
+         * @return index of the first primitive of the right child, or -1 to make a leaf
+         */
+        static int SplitMedian(std::span<PrimitiveInfo> prims, int prim_info_begin,
+                               int prim_info_end, int max_leaf_size, int partition_axis)
+        {
+            if (prim_info_end - prim_info_begin <= max_leaf_size)
+            {
+                return -1;
+            }
+
+            int prim_info_mid = std::midpoint(prim_info_begin, prim_info_end);
+
+            PrimitiveInfo* ptr_begin = prims.data() + prim_info_begin;
+            PrimitiveInfo* ptr_end   = prims.data() + prim_info_end;
+            PrimitiveInfo* ptr_mid   = prims.data() + prim_info_mid;
+
+            std::nth_element(ptr_begin, ptr_mid, ptr_end,
+                             [partition_axis](const PrimitiveInfo& lhs, const PrimitiveInfo& rhs) {
+                                 return lhs.centroid[partition_axis] <
+                                        rhs.centroid[partition_axis];
+                             });
+
+            return prim_info_mid;
+        }
+
+        /**
+         * Split primitives where the surface area heuristic is minimized, evaluated on bins of
+         * centroids along each axis. `partition_axis` is updated to the axis chosen.
+         *
+         * @return index of the first primitive of the right child, or -1 to make a leaf
+         */
+        int SplitSah(std::span<PrimitiveInfo> prims, int prim_info_begin, int prim_info_end,
+                     const BuildBounds& bounds, int max_leaf_size, int& partition_axis,
+                     ThreadPool& pool) const
+        {
+            int num_prim = prim_info_end - prim_info_begin;
+            if (num_prim <= 1)
+            {
+                return -1;
+            }
+
+            ObjectSplit split =
+                FindObjectSplit(prims, prim_info_begin, prim_info_end, bounds, pool);
+
+            // make a leaf if intersecting all primitives is cheaper than any split, or split at
+            // the median if there's no split, e.g. centroids coincide, but the leaf is too large
+            float leaf_cost = IntersectionCost(num_prim);
+            if (split.axis < 0 || (num_prim <= max_leaf_size && leaf_cost <= split.cost))
+            {
+                return num_prim <= max_leaf_size
+                           ? -1
+                           : SplitMedian(prims, prim_info_begin, prim_info_end, 1, partition_axis);
+            }
+
+            partition_axis = split.axis;
+            return PartitionObjectSplit(prims, prim_info_begin, prim_info_end, split);
+        }
+
+        int NumSahBins() const noexcept
+        {
+            return setting_.quality == BvhBuildQuality::High ? kMaxSahBins : kMaxSahBins / 2;
+        }
+
+        /**
+         * Find the object split with the least SAH cost among bins of centroids along each axis
+         */
+        ObjectSplit FindObjectSplit(std::span<const PrimitiveInfo> prims, int prim_info_begin,
+                                    int prim_info_end, const BuildBounds& bounds,
+                                    ThreadPool& pool) const
+        {
+            int num_prim = prim_info_end - prim_info_begin;
+
+            // bins are placed evenly over bounds of centroids
+            const BoundingBox& bbox_centroid = bounds.bbox_centroid;
+
+            ObjectSplit result;
+
+            Vec3f extents = bbox_centroid.Extents();
+            if (extents[0] <= 0 && extents[1] <= 0 && extents[2] <= 0)
+            {
+                // centroids coincide, no split makes sense
+                return result;
+            }
+
+            int num_bin = NumSahBins();
+
+            // NOTE scale is slightly shrunk so that the max centroid falls into the last bin
+            result.bin_origin = bbox_centroid.p_min;
+            for (int axis = 0; axis < 3; ++axis)
+            {
+                result.bin_scale[axis] =
+                    extents[axis] > 0 ? num_bin * (1 - 1e-4f) / extents[axis] : 0.f;
+            }
+
+            // fill bins of all three axes in one pass
+            auto fill_bins = [&](int begin, int end, SahBinSet& bins) {
+                for (int i = begin; i < end; ++i)
+                {
+                    Vec3f bin_pos = (prims[i].centroid - result.bin_origin) * result.bin_scale;
+                    for (int axis = 0; axis < 3; ++axis)
+                    {
+                        SahBin& bin = bins[axis][static_cast<int>(bin_pos[axis])];
+                        bin.bbox    = UnionBBox(bin.bbox, prims[i].bbox);
+                        bin.count += 1;
+                    }
+                }
+            };
+
+            SahBinSet bins;
+            if (!UseParallelBinning(num_prim))
+            {
+                fill_bins(prim_info_begin, prim_info_end, bins);
+            }
+            else
+            {
+                std::vector<SahBinSet> partial;
+                partial.resize(NumBinningChunk(num_prim));
+                ForEachBinningChunk(
+                    prim_info_begin, prim_info_end,
+                    [&](int begin, int end, size_t ichunk) {
+                        fill_bins(begin, end, partial[ichunk]);
+                    },
+                    pool);
+
+                for (const SahBinSet& chunk_bins : partial)
+                {
+                    for (int axis = 0; axis < 3; ++axis)
+                    {
+                        for (int k = 0; k < num_bin; ++k)
+                        {
+                            bins[axis][k].bbox =
+                                UnionBBox(bins[axis][k].bbox, chunk_bins[axis][k].bbox);
+                            bins[axis][k].count += chunk_bins[axis][k].count;
+                        }
+                    }
+                }
+            }
+
+            // sweep from right to left, collecting area and intersection cost of the right side of
+            // each split plane, where split `k` puts bins [0, k) to the left
+            Vec3f right_area[kMaxSahBins];
+            Vec3f right_cost[kMaxSahBins];
+            {
+                SahBin acc[3];
+                for (int k = num_bin - 1; k > 0; --k)
+                {
+                    for (int axis = 0; axis < 3; ++axis)
+                    {
+                        acc[axis].bbox = UnionBBox(acc[axis].bbox, bins[axis][k].bbox);
+                        acc[axis].count += bins[axis][k].count;
+
+                        right_area[k][axis] = acc[axis].count > 0 ? acc[axis].bbox.Area() : 0.f;
+                        right_cost[k][axis] = IntersectionCost(acc[axis].count);
+                    }
+                }
+            }
+
+            // sweep from left to right evaluating costs of all three axes together
+            float inv_total_area = 1.f / bounds.bbox.Area();
+            {
+                SahBin acc[3];
+                for (int k = 1; k < num_bin; ++k)
+                {
+                    Vec3f left_area;
+                    Vec3f left_cost;
+                    for (int axis = 0; axis < 3; ++axis)
+                    {
+                        acc[axis].bbox = UnionBBox(acc[axis].bbox, bins[axis][k - 1].bbox);
+                        acc[axis].count += bins[axis][k - 1].count;
+
+                        left_area[axis] = acc[axis].count > 0 ? acc[axis].bbox.Area() : 0.f;
+                        left_cost[axis] = IntersectionCost(acc[axis].count);
+                    }
+
+                    Vec3f cost = setting_.traversal_cost +
+                                 (left_area * left_cost + right_area[k] * right_cost[k]) *
+                                     inv_total_area;
+
+                    for (int axis = 0; axis < 3; ++axis)
+                    {
+                        // skip flat axes and splits with an empty side
+                        if (extents[axis] <= 0 || left_cost[axis] == 0 ||
+                            right_cost[k][axis] == 0)
+                        {
+                            continue;
+                        }
+
+                        if (cost[axis] < result.cost)
+                        {
+                            result.cost = cost[axis];
+                            result.axis = axis;
+                            result.bin  = k;
+                        }
+                    }
+                }
+            }
+
+            if (result.axis >= 0)
+            {
+                for (int k = 0; k < num_bin; ++k)
+                {
+                    BoundingBox& bbox = k < result.bin ? result.left_bbox : result.right_bbox;
+                    bbox              = UnionBBox(bbox, bins[result.axis][k].bbox);
+                }
+            }
+
+            return result;
+        }
+
+        /**
+         * Partition primitives by an object split
+         *
+         * @return index of the first primitive of the right child
+         */
+        static int PartitionObjectSplit(std::span<PrimitiveInfo> prims, int prim_info_begin,
+                                        int prim_info_end, const ObjectSplit& split)
+        {
+            int axis                 = split.axis;
+            PrimitiveInfo* ptr_begin = prims.data() + prim_info_begin;
+            PrimitiveInfo* ptr_end   = prims.data() + prim_info_end;
+            PrimitiveInfo* ptr_mid =
+                std::partition(ptr_begin, ptr_end, [&](const PrimitiveInfo& prim_info) {
+                    // NOTE same arithmetic as binning, so that primitives stay in their bins
+                    Vec3f bin_pos = (prim_info.centroid - split.bin_origin) * split.bin_scale;
+                    return static_cast<int>(bin_pos[axis]) < split.bin;
+                });
+
+            return prim_info_begin + static_cast<int>(std::distance(ptr_begin, ptr_mid));
+        }
+
+        /**
+         * Find the spatial split with the least SAH cost among planes between bins along each
+         * axis, where a reference spanning multiple bins is clipped into each of them
+         */
+        SpatialSplit FindSpatialSplit(std::span<const PrimitiveInfo> prims, int prim_info_begin,
+                                      int prim_info_end, const BoundingBox& bbox,
+                                      ThreadPool& pool) const
+        {
+            int num_prim = prim_info_end - prim_info_begin;
+            int num_bin  = NumSahBins();
+
+            // bins are placed evenly over bounds of the node
+            Vec3f extents = bbox.Extents();
+            Vec3f bin_width;
+            Vec3f bin_scale;
+            for (int axis = 0; axis < 3; ++axis)
+            {
+                bin_width[axis] = extents[axis] / num_bin;
+                bin_scale[axis] = extents[axis] > 0 ? num_bin / extents[axis] : 0.f;
+            }
+
+            auto compute_bin = [&](float x, int axis) {
+                int bin = static_cast<int>((x - bbox.p_min[axis]) * bin_scale[axis]);
+                return std::clamp(bin, 0, num_bin - 1);
+            };
+            auto compute_plane = [&](int k, int axis) {
+                return bbox.p_min[axis] + k * bin_width[axis];
+            };
+
+            auto fill_bins = [&](int begin, int end, SpatialBinSet& bins) {
+                for (int i = begin; i < end; ++i)
+                {
+                    for (int axis = 0; axis < 3; ++axis)
+                    {
+                        if (extents[axis] <= 0)
+                        {
+                            continue;
+                        }
+
+                        int first = compute_bin(prims[i].bbox.p_min[axis], axis);
+                        int last  = compute_bin(prims[i].bbox.p_max[axis], axis);
+                        bins[axis][first].num_enter += 1;
+                        bins[axis][last].num_exit += 1;
+
+                        // clip the reference bin by bin
+                        BoundingBox rest = prims[i].bbox;
+                        for (int k = first; k < last && !rest.IsEmpty(); ++k)
+                        {
+                            PrimitiveInfo ref{
+                                .bbox = rest, .centroid = {}, .index = prims[i].index};
+                            auto [left, right] =
+                                prims_.SplitPrimitive(ref, axis, compute_plane(k + 1, axis));
+                            if (!left.IsEmpty())
+                            {
+                                bins[axis][k].bbox = UnionBBox(bins[axis][k].bbox, left);
+                            }
+
+                            rest = right;
+                        }
+
+                        if (!rest.IsEmpty())
+                        {
+                            bins[axis][last].bbox = UnionBBox(bins[axis][last].bbox, rest);
+                        }
+                    }
+                }
+            };
+
+            SpatialBinSet bins;
+            if (!UseParallelBinning(num_prim))
+            {
+                fill_bins(prim_info_begin, prim_info_end, bins);
+            }
+            else
+            {
+                std::vector<SpatialBinSet> partial;
+                partial.resize(NumBinningChunk(num_prim));
+                ForEachBinningChunk(
+                    prim_info_begin, prim_info_end,
+                    [&](int begin, int end, size_t ichunk) {
+                        fill_bins(begin, end, partial[ichunk]);
+                    },
+                    pool);
+
+                for (const SpatialBinSet& chunk_bins : partial)
+                {
+                    for (int axis = 0; axis < 3; ++axis)
+                    {
+                        for (int k = 0; k < num_bin; ++k)
+                        {
+                            bins[axis][k].bbox =
+                                UnionBBox(bins[axis][k].bbox, chunk_bins[axis][k].bbox);
+                            bins[axis][k].num_enter += chunk_bins[axis][k].num_enter;
+                            bins[axis][k].num_exit += chunk_bins[axis][k].num_exit;
+                        }
+                    }
+                }
+            }
+
+            // sweep from right to left like `FindObjectSplit`, where references ending right of
+            // the plane of split `k` go to the right
+            Vec3f right_area[kMaxSahBins];
+            Vec3f right_cost[kMaxSahBins];
+            {
+                SpatialBin acc[3];
+                for (int k = num_bin - 1; k > 0; --k)
+                {
+                    for (int axis = 0; axis < 3; ++axis)
+                    {
+                        acc[axis].bbox = UnionBBox(acc[axis].bbox, bins[axis][k].bbox);
+                        acc[axis].num_exit += bins[axis][k].num_exit;
+
+                        right_area[k][axis] =
+                            acc[axis].num_exit > 0 ? acc[axis].bbox.Area() : 0.f;
+                        right_cost[k][axis] = IntersectionCost(acc[axis].num_exit);
+                    }
+                }
+            }
+
+            // sweep from left to right, where references starting left of the plane go to the
+            // left
+            SpatialSplit result;
+            float inv_total_area = 1.f / bbox.Area();
+            {
+                SpatialBin acc[3];
+                for (int k = 1; k < num_bin; ++k)
+                {
+                    Vec3f left_area;
+                    Vec3f left_cost;
+                    for (int axis = 0; axis < 3; ++axis)
+                    {
+                        acc[axis].bbox = UnionBBox(acc[axis].bbox, bins[axis][k - 1].bbox);
+                        acc[axis].num_enter += bins[axis][k - 1].num_enter;
+
+                        left_area[axis] = acc[axis].num_enter > 0 ? acc[axis].bbox.Area() : 0.f;
+                        left_cost[axis] = IntersectionCost(acc[axis].num_enter);
+                    }
+
+                    Vec3f cost = setting_.traversal_cost +
+                                 (left_area * left_cost + right_area[k] * right_cost[k]) *
+                                     inv_total_area;
+
+                    for (int axis = 0; axis < 3; ++axis)
+                    {
+                        if (extents[axis] <= 0 || left_cost[axis] == 0 ||
+                            right_cost[k][axis] == 0)
+                        {
+                            continue;
+                        }
+
+                        if (cost[axis] < result.cost)
+                        {
+                            result.cost     = cost[axis];
+                            result.axis     = axis;
+                            result.position = compute_plane(k, axis);
+                        }
+                    }
+                }
+            }
+
+            return result;
+        }
+
+        /**
+         * Partition references by a spatial split, where those straddling the plane are clipped
+         * into both children unless it's cheaper to leave them whole in either child, and the
+         * right child ends at `prim_info_end_out`
+         *
+         * @return index of the first reference of the right child, or -1 if the references don't
+         *         fit before `prim_info_capacity` or a child is left empty
+         */
+        int PartitionSpatialSplit(std::span<PrimitiveInfo> prims, int prim_info_begin,
+                                  int prim_info_end, int prim_info_capacity,
+                                  const SpatialSplit& split, int& prim_info_end_out) const
+        {
+            struct StraddlingReference
+            {
+                PrimitiveInfo ref;
+                BoundingBox left;
+                BoundingBox right;
+            };
+
+            int axis       = split.axis;
+            float position = split.position;
+
+            std::vector<PrimitiveInfo> left_refs;
+            std::vector<PrimitiveInfo> right_refs;
+            std::vector<StraddlingReference> straddling_refs;
+
+            BoundingBox left_bbox  = BoundingBox::Empty();
+            BoundingBox right_bbox = BoundingBox::Empty();
+            for (int i = prim_info_begin; i < prim_info_end; ++i)
+            {
+                const PrimitiveInfo& ref = prims[i];
+                if (ref.bbox.p_max[axis] <= position)
+                {
+                    left_refs.push_back(ref);
+                    left_bbox = UnionBBox(left_bbox, ref.bbox);
+                    continue;
+                }
+                if (ref.bbox.p_min[axis] >= position)
+                {
+                    right_refs.push_back(ref);
+                    right_bbox = UnionBBox(right_bbox, ref.bbox);
+                    continue;
+                }
+
+                auto [left, right] = prims_.SplitPrimitive(ref, axis, position);
+                if (left.IsEmpty() || right.IsEmpty())
+                {
+                    // the primitive only touches one side within the reference, or it's lost to
+                    // rounding and kept as is
+                    bool to_left = right.IsEmpty() && !left.IsEmpty();
+                    bool to_both = left.IsEmpty() && right.IsEmpty();
+                    if (to_left || to_both)
+                    {
+                        BoundingBox bbox = to_both ? ref.bbox : left;
+                        left_refs.push_back({bbox, bbox.Centroid(), ref.index});
+                        left_bbox = UnionBBox(left_bbox, bbox);
+                    }
+                    else
+                    {
+                        right_refs.push_back({right, right.Centroid(), ref.index});
+                        right_bbox = UnionBBox(right_bbox, right);
+                    }
+
+                    continue;
+                }
+
+                straddling_refs.push_back({ref, left, right});
+                left_bbox  = UnionBBox(left_bbox, left);
+                right_bbox = UnionBBox(right_bbox, right);
+            }
+
+            // unsplit references whose duplication costs more than enlarging either child, see
+            // Stich et al.
+            float num_left  = static_cast<float>(left_refs.size() + straddling_refs.size());
+            float num_right = static_cast<float>(right_refs.size() + straddling_refs.size());
+            float left_area  = left_bbox.Area();
+            float right_area = right_bbox.Area();
+            float split_cost = left_area * num_left + right_area * num_right;
+            for (const StraddlingReference& straddling : straddling_refs)
+            {
+                const PrimitiveInfo& ref = straddling.ref;
+
+                float to_left_cost = UnionBBox(left_bbox, ref.bbox).Area() * num_left +
+                                     right_area * (num_right - 1);
+                float to_right_cost = left_area * (num_left - 1) +
+                                      UnionBBox(right_bbox, ref.bbox).Area() * num_right;
+                if (to_left_cost < split_cost && to_left_cost <= to_right_cost)
+                {
+                    left_refs.push_back(ref);
+                }
+                else if (to_right_cost < split_cost)
+                {
+                    right_refs.push_back(ref);
+                }
+                else
+                {
+                    const BoundingBox& left  = straddling.left;
+                    const BoundingBox& right = straddling.right;
+                    left_refs.push_back({left, left.Centroid(), ref.index});
+                    right_refs.push_back({right, right.Centroid(), ref.index});
+                }
+            }
+
+            size_t num_ref = left_refs.size() + right_refs.size();
+            if (left_refs.empty() || right_refs.empty() ||
+                num_ref > static_cast<size_t>(prim_info_capacity - prim_info_begin))
+            {
+                return -1;
+            }
+
+            int prim_info_mid = prim_info_begin + static_cast<int>(left_refs.size());
+            std::copy(left_refs.begin(), left_refs.end(), prims.begin() + prim_info_begin);
+            std::copy(right_refs.begin(), right_refs.end(), prims.begin() + prim_info_mid);
+
+            prim_info_end_out = prim_info_begin + static_cast<int>(num_ref);
+            return prim_info_mid;
+        }
+
+        static int MaxExtentAxis(const BoundingBox& bbox) noexcept
+        {
+            Vec3f extents = bbox.Extents();
+
+            int result = 0;
+            for (int axis = 1; axis < 3; ++axis)
+            {
+                if (extents[axis] > extents[result])
+                {
+                    result = axis;
+                }
+            }
+
+            return result;
+        }
+
+        BoundingBox ComputeBoundingBox(uint32_t inode) const
+        {
+            return BoundingBox{bvh_nodes_[inode].bbox_p_min, bvh_nodes_[inode].bbox_p_max};
         }
     };
 
@@ -0,0 +1,116 @@
+#pragma once
+#include "usami/hash.h"
+#include "usami/ray/composite/bvh.h"
+#include <random>
+
+namespace usami::ray
+{
+    /**
+     * Directory of mesh bvhs built by earlier runs, so that a mesh loaded again is ready without
+     * building
+     *
+     * Files are keyed by a hash of triangles of the mesh and the build setting, and mapped into
+     * memory to be used in place. A file that doesn't fit, e.g. written by another version, is
+     * rebuilt and overwritten.
+     */
+    class MeshBvhCache
+    {
+    private:
+        // number of triangles hashed by a task
+        static constexpr size_t kHashChunkSize = 1 << 16;
+
+        std::filesystem::path directory_;
+
+    public:
+        MeshBvhCache(std::filesystem::path directory) : directory_(std::move(directory))
+        {
+            std::filesystem::create_directories(directory_);
+        }
+
+        /**
+         * Load bvh of the mesh from the cache, or build it on `pool` and store it into the cache
+         */
+        unique_ptr<MeshBvhComposite> LoadOrBuild(
+            const SceneMesh* mesh, const BvhBuildSetting& setting = {},
+            MeshLeafStorage storage = MeshLeafStorage::TriangleSoA,
+            ThreadPool& pool = ThreadPool::Global()) const
+        {
+            uint64_t key               = ComputeKey(*mesh, setting, storage, pool);
+            std::filesystem::path path = directory_ / fmt::format("{:016x}.bvh", key);
+
+            if (shared_ptr<const MappedFile> file = MappedFile::Open(path); file != nullptr)
+            {
+                auto bvh = MeshBvhComposite::Load(MeshPrimitiveCollection{mesh, storage},
+                                                  std::move(file), key, setting, pool);
+                if (bvh != nullptr)
+                {
+                    return bvh;
+                }
+            }
+
+            auto bvh = make_unique<MeshBvhComposite>(MeshPrimitiveCollection{mesh, storage},
+                                                     setting, pool);
+
+            // write a temporary file first so that no run maps a partial one. Failing to write
+            // the cache is fine, e.g. when the file is mapped by another run on Windows.
+            std::filesystem::path tmp_path = path;
+            tmp_path += fmt::format(".{:08x}.tmp", std::random_device{}());
+
+            std::error_code ec;
+            if (bvh->Save(tmp_path, key))
+            {
+                std::filesystem::rename(tmp_path, path, ec);
+            }
+            std::filesystem::remove(tmp_path, ec);
+
+            return bvh;
+        }
+
+        /**
+         * Key of a mesh bvh, which changes with any triangle of the mesh or any setting that
+         * affects the tree built
+         */
+        static uint64_t ComputeKey(const SceneMesh& mesh, const BvhBuildSetting& setting,
+                                   MeshLeafStorage storage,
+                                   ThreadPool& pool = ThreadPool::Global())
+        {
+            // hash chunks of triangles in parallel, then digests of chunks in order
+            size_t num_chunk = (mesh.num_face + kHashChunkSize - 1) / kHashChunkSize;
+
+            std::vector<uint64_t> chunk_digests(num_chunk);
+            ParallelFor(
+                0, num_chunk, 1,
+                [&](size_t ichunk) {
+                    size_t end = std::min(mesh.num_face, (ichunk + 1) * kHashChunkSize);
+
+                    Fnv1aHash hash;
+                    for (size_t i = ichunk * kHashChunkSize; i < end; ++i)
+                    {
+                        hash.Update(mesh.GetTriangleVertices(i).vertices);
+                    }
+
+                    chunk_digests[ichunk] = hash.Digest();
+                },
+                pool);
+
+            Fnv1aHash hash;
+            hash.Update(kBvhCacheVersion);
+            hash.Update(uint64_t{mesh.num_face});
+            for (uint64_t digest : chunk_digests)
+            {
+                hash.Update(digest);
+            }
+
+            // leaf storage and batch width affect cost of leaves under the SAH
+            hash.Update(setting.algorithm);
+            hash.Update(setting.quality);
+            hash.Update(setting.max_leaf_size);
+            hash.Update(setting.traversal_cost);
+            hash.Update(setting.spatial_split_budget);
+            hash.Update(storage);
+            hash.Update(kSimdFloatWidth);
+
+            return hash.Digest();
+        }
+    };
+} // namespace usami::ray
@@ -0,0 +1,211 @@
+#pragma once
+#include "usami/ray/composite/bvh.h"
+#include "usami/ray/composite/bvh_cache.h"
+#include "usami/ray/composite/wide_bvh.h"
+#include <atomic>
+#include <mutex>
+
+namespace usami::ray
+{
+    /**
+     * Node layout of mesh bvhs, which trades memory for fewer nodes visited by a ray
+     */
+    enum class MeshBvhLayout
+    {
+        // binary nodes, see `BasicBvhComposite`
+        Binary,
+
+        // binary bvh collapsed into nodes testing `kDefaultWideBvhWidth` children in one SIMD
+        // batch, see `BasicWideBvhComposite`
+        Wide,
+
+        // wide nodes with bounds quantized to 8 bits, see `WideBvhNodeFormat::Quantized`
+        QuantizedWide,
+    };
+
+    /**
+     * Bvh of a mesh that is built, or loaded from a `MeshBvhCache`, the first time it's needed
+     *
+     * Until then, only bounds of the mesh are known, which is enough to place it into a top level
+     * bvh, so a mesh that no ray ever reaches costs no build. `Intersect` is thread-safe and
+     * builds exactly once, while other threads reaching the mesh meanwhile wait for it.
+     *
+     * NOTE the build is isolated by `ThreadPool::Isolate`, as the thread building it would
+     * otherwise pick up pending ray queries while waiting for build tasks, and one of them
+     * reaching the same mesh would wait for the build below it forever.
+     */
+    class LazyMeshBvh
+    {
+    private:
+        // number of triangles bounded by a task
+        static constexpr size_t kBoundsChunkSize = 1 << 16;
+
+        const SceneMesh* mesh_;
+        BvhBuildSetting setting_;
+        MeshBvhLayout layout_;
+
+        // cache that the bvh is loaded from, if not null
+        const MeshBvhCache* file_cache_;
+
+        ThreadPool& pool_;
+
+        // bounds of triangles, until the bvh is built
+        BoundingBox bbox_ = Vec3f{};
+
+        mutable std::once_flag build_flag_;
+        mutable std::atomic<bool> built_ = false;
+
+        // bvh in `layout_`, where only the one of the layout is built
+        mutable unique_ptr<MeshBvhComposite> bvh_                          = nullptr;
+        mutable unique_ptr<MeshWideBvhComposite<>> wide_bvh_               = nullptr;
+        mutable unique_ptr<QuantizedMeshWideBvhComposite<>> quantized_bvh_ = nullptr;
+
+    public:
+        /**
+         * Bvh of the mesh, which is built on `pool`
+         *
+         * @param lazy defer the build to the first query, computing only bounds of the mesh on
+         *             the global pool right away
+         */
+        LazyMeshBvh(const SceneMesh* mesh, BvhBuildSetting setting, MeshBvhLayout layout,
+                    const MeshBvhCache* file_cache, bool lazy = true,
+                    ThreadPool& pool = ThreadPool::Global())
+            : mesh_(mesh), setting_(setting), layout_(layout), file_cache_(file_cache), pool_(pool)
+        {
+            if (lazy)
+            {
+                UpdateBounds();
+            }
+            else
+            {
+                Build();
+            }
+        }
+
+        bool IsBuilt() const noexcept
+        {
+            return built_.load(std::memory_order_acquire);
+        }
+
+        /**
+         * Build the bvh if not yet, which is done by the first query otherwise
+         */
+        void Build() const
+        {
+            std::call_once(build_flag_, [this] {
+                ThreadPool::Isolate([this] { BuildAux(file_cache_); });
+                built_.store(true, std::memory_order_release);
+            });
+        }
+
+        /**
+         * Query the bvh in model space, building it by the first call
+         */
+        template <typename HitInfo>
+        bool Intersect(const Ray& ray, float t_min, float t_max, Workspace& ws,
+                       HitInfo& info_out) const
+        {
+            Build();
+
+            switch (layout_)
+            {
+            case MeshBvhLayout::Wide:
+                return wide_bvh_->Intersect(ray, t_min, t_max, ws, info_out);
+            case MeshBvhLayout::QuantizedWide:
+                return quantized_bvh_->Intersect(ray, t_min, t_max, ws, info_out);
+            default:
+                return bvh_->Intersect(ray, t_min, t_max, ws, info_out);
+            }
+        }
+
+        /**
+         * Bounds of the mesh in model space, whether the bvh is built or not
+         */
+        BoundingBox Bounding() const
+        {
+            if (!IsBuilt())
+            {
+                return bbox_;
+            }
+
+            switch (layout_)
+            {
+            case MeshBvhLayout::Wide:
+                return wide_bvh_->Bounding();
+            case MeshBvhLayout::QuantizedWide:
+                return quantized_bvh_->Bounding();
+            default:
+                return bvh_->Bounding();
+            }
+        }
+
+        /**
+         * Update after vertices of the mesh are changed in place, where a bvh built is refit and
+         * otherwise only bounds are recomputed. It must not run along with `Intersect`.
+         *
+         * NOTE wide bvhs have no refit, so they are rebuilt, bypassing the file cache which only
+         * keeps meshes as they are loaded
+         */
+        void Refit()
+        {
+            if (!IsBuilt())
+            {
+                UpdateBounds();
+            }
+            else if (layout_ == MeshBvhLayout::Binary)
+            {
+                bvh_->Refit();
+            }
+            else
+            {
+                BuildAux(nullptr);
+            }
+        }
+
+    private:
+        void BuildAux(const MeshBvhCache* file_cache) const
+        {
+            // binary bvh, which wide layouts are collapsed from
+            unique_ptr<MeshBvhComposite> bvh =
+                file_cache != nullptr
+                    ? file_cache->LoadOrBuild(mesh_, setting_, MeshLeafStorage::TriangleSoA, pool_)
+                    : make_unique<MeshBvhComposite>(MeshPrimitiveCollection{mesh_}, setting_,
+                                                    pool_);
+
+            switch (layout_)
+            {
+            case MeshBvhLayout::Wide:
+                wide_bvh_ = make_unique<MeshWideBvhComposite<>>(std::move(*bvh));
+                break;
+            case MeshBvhLayout::QuantizedWide:
+                quantized_bvh_ = make_unique<QuantizedMeshWideBvhComposite<>>(std::move(*bvh));
+                break;
+            default:
+                bvh_ = std::move(bvh);
+                break;
+            }
+        }
+
+        void UpdateBounds()
+        {
+            size_t num_chunk = (mesh_->num_face + kBoundsChunkSize - 1) / kBoundsChunkSize;
+
+            std::vector<BoundingBox> partial(num_chunk, BoundingBox::Empty());
+            ParallelFor(0, num_chunk, 1, [&](size_t ichunk) {
+                size_t end = std::min(mesh_->num_face, (ichunk + 1) * kBoundsChunkSize);
+                for (size_t i = ichunk * kBoundsChunkSize; i < end; ++i)
+                {
+                    auto [v0, v1, v2] = mesh_->GetTriangleVertices(i).vertices;
+                    partial[ichunk] =
+                        UnionBBox(partial[ichunk], shape::Triangle{v0, v1, v2}.Bounding());
+                }
+            });
+
+            bbox_ = BoundingBox::Empty();
+            for (const BoundingBox& bbox : partial)
+            {
+                bbox_ = UnionBBox(bbox_, bbox);
+            }
+        }
+    };
+} // namespace usami::ray
@@ -36,5 +36,19 @@ namespace usami::ray
             }
             return any_hit;
         }
+
+        bool Intersect(const Ray& ray, float t_min, float t_max, Workspace& ws,
+                       OcclusionInfo& occ_out) const override
+        {
+            for (auto child : objects_)
+            {
+                if (child->Intersect(ray, t_min, t_max, ws, occ_out))
+                {
+                    return true;
+                }
+            }
+
+            return false;
+        }
     };
 } // namespace usami::ray
@@ -0,0 +1,164 @@
+#pragma once
+#include "usami/ray/composite/bvh.h"
+#include "usami/ray/shape/analytic_soa.h"
+#include <bit>
+
+namespace usami::ray
+{
+    /**
+     * Collection of analytic shapes of the same type, e.g. spheres of particles, which are stored
+     * by value instead of as `Primitive`s and tested in SIMD batches in bvh leaves
+     *
+     * A hit fills `IntersectionInfo::iface` with index of the shape in the input.
+     */
+    template <GeometricShape Shape>
+    class ShapePrimitiveCollection
+    {
+    private:
+        using SoAType = typename shape::ShapeSoATraits<Shape>::Type;
+
+        // shapes and their index in the input, in leaf order after built
+        std::vector<Shape> shapes_;
+        std::vector<int> indices_;
+
+        // copy of `shapes_` tested in batches
+        SoAType shape_soa_;
+
+    public:
+        ShapePrimitiveCollection()
+        {
+        }
+        ShapePrimitiveCollection(std::vector<Shape> shapes) : shapes_(std::move(shapes))
+        {
+            USAMI_REQUIRE(shapes_.size() <= INT32_MAX);
+        }
+
+        bool Intersect(int prim_offset, int num_prim, const Ray& ray, float t_min, float t_max,
+                       Workspace& ws, IntersectionInfo& isect_out) const
+        {
+            int ihit    = -1;
+            float t_hit = t_max;
+            ForEachHit(prim_offset, num_prim, ray, t_min, t_hit, [&](int i, float t) {
+                ihit  = i;
+                t_hit = t;
+                return false;
+            });
+
+            // geometry info is only computed for the closest shape
+            if (ihit < 0 || !TestIntersection(shapes_[ihit], ray, t_min, t_hit, isect_out))
+            {
+                return false;
+            }
+
+            isect_out.iface = indices_[ihit];
+            return true;
+        }
+
+        bool Intersect(int prim_offset, int num_prim, const Ray& ray, float t_min, float t_max,
+                       Workspace& ws, OcclusionInfo& occ_out) const
+        {
+            return ForEachHit(prim_offset, num_prim, ray, t_min, t_max, [&](int i, float t) {
+                occ_out.t         = t;
+                occ_out.primitive = nullptr;
+                return true;
+            });
+        }
+
+        // number of shapes tested together in a leaf
+        int IntersectBatchSize() const noexcept
+        {
+            return SoAType::kBatchSize;
+        }
+
+        size_t ByteSize() const noexcept
+        {
+            return shapes_.capacity() * sizeof(Shape) + indices_.capacity() * sizeof(int) +
+                   shape_soa_.ByteSize();
+        }
+
+        std::vector<PrimitiveInfo> Prepare(ThreadPool& pool)
+        {
+            std::vector<PrimitiveInfo> result;
+            result.resize(shapes_.size(),
+                          PrimitiveInfo{.bbox = Vec3f{}, .centroid = {}, .index = 0});
+
+            ParallelFor(
+                0, shapes_.size(),
+                [&](size_t i) {
+                    BoundingBox bbox = shapes_[i].Bounding();
+                    result[i] =
+                        PrimitiveInfo{.bbox = bbox, .centroid = bbox.Centroid(), .index = i};
+                },
+                pool);
+
+            return result;
+        }
+
+        void Update(const std::vector<PrimitiveInfo>& v, ThreadPool& pool)
+        {
+            USAMI_ASSERT(v.size() == shapes_.size());
+
+            std::vector<Shape> shapes;
+            std::vector<int> indices;
+            shapes.reserve(v.size());
+            indices.reserve(v.size());
+            for (const PrimitiveInfo& info : v)
+            {
+                shapes.push_back(shapes_[info.index]);
+                indices.push_back(indices_.empty() ? static_cast<int>(info.index)
+                                                   : indices_[info.index]);
+            }
+
+            shapes_  = std::move(shapes);
+            indices_ = std::move(indices);
+
+            shape_soa_.Resize(shapes_.size());
+            ParallelFor(
+                0, shapes_.size(), [&](size_t i) { shape_soa_.Set(i, shapes_[i]); }, pool);
+        }
+
+    private:
+        /**
+         * Invoke `f(i, t)` on each shape `i` of a leaf hit at `t` within [t_min, t_max], in order,
+         * until `f` returns true. `t_max` may be shortened by `f` meanwhile.
+         *
+         * Shapes are culled in SIMD batches, and those left are confirmed by the scalar test, so
+         * hits are exactly those of testing each shape alone.
+         *
+         * @return if `f` returns true
+         */
+        template <typename F>
+        bool ForEachHit(int prim_offset, int num_prim, const Ray& ray, float t_min,
+                        const float& t_max, const F& f) const
+        {
+            constexpr int kBatchSize = SoAType::kBatchSize;
+
+            for (int base = 0; base < num_prim; base += kBatchSize)
+            {
+                uint32_t hit_mask =
+                    shape_soa_.IntersectBatch(prim_offset + base, ray, t_min, t_max);
+                if (num_prim - base < kBatchSize)
+                {
+                    // discard shapes beyond the leaf
+                    hit_mask &= (1u << (num_prim - base)) - 1;
+                }
+
+                for (; hit_mask != 0; hit_mask &= hit_mask - 1)
+                {
+                    int i = prim_offset + base + std::countr_zero(hit_mask);
+
+                    float t;
+                    if (TestOcclusion(shapes_[i], ray, t_min, t_max, t) && f(i, t))
+                    {
+                        return true;
+                    }
+                }
+            }
+
+            return false;
+        }
+    };
+
+    template <GeometricShape Shape>
+    using ShapeBvhComposite = BasicBvhComposite<ShapePrimitiveCollection<Shape>>;
+} // namespace usami::ray
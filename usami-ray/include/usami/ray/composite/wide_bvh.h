@@ -0,0 +1,562 @@
+#pragma once
+#include "usami/ray/composite/bvh.h"
+#include "xsimd/xsimd.hpp"
+#include <bit>
+#include <cmath>
+
+namespace usami::ray
+{
+    // widest node that the instruction set of this build handles in one batch
+    constexpr int kDefaultWideBvhWidth = kSimdFloatWidth;
+
+    /**
+     * How bounds of children are stored in wide bvh nodes
+     */
+    enum class WideBvhNodeFormat
+    {
+        // full precision floats
+        Float,
+
+        // 8-bit integers on a grid over bounds of the node, which halves the size of nodes at the
+        // cost of looser bounds and decoding them in traversal. It suits scenes whose bvh doesn't
+        // fit in cache, where traversal is bound by memory bandwidth.
+        Quantized,
+    };
+
+    /**
+     * Bvh of `Width`-ary nodes, each of which stores bounds of its children in SoA layout so that
+     * all of them are tested against a ray in one SIMD batch
+     *
+     * The tree is built as a binary bvh, see `BasicBvhComposite`, and then collapsed by pulling
+     * up grandchildren with the largest surface area until a node is full.
+     */
+    template <typename PrimitiveCollection, int Width = kDefaultWideBvhWidth,
+              WideBvhNodeFormat Format = WideBvhNodeFormat::Float>
+    class BasicWideBvhComposite : public IntersectableEntity
+    {
+    private:
+        static_assert(Width == 4 || Width == 8);
+
+        using BinaryBvh = BasicBvhComposite<PrimitiveCollection>;
+        using BatchType = xsimd::batch<float, Width>;
+
+        struct alignas(sizeof(float) * Width) FloatWideBvhNode
+        {
+            // bounds of children, where unused slots hold an inverted box that no ray overlaps
+            float bbox_p_min[3][Width];
+            float bbox_p_max[3][Width];
+
+            // index of the child node if prim_num == 0, otherwise offset of primitives in the
+            // leaf
+            uint32_t child[Width];
+            uint16_t prim_num[Width];
+        };
+
+        /**
+         * Node with bounds of children quantized to `origin + q * 2^exponent` along each axis,
+         * where `origin` is the min corner of the node. Bounds are rounded outwards, and decoding
+         * is exact as the scale is a power of two, so that decoded boxes contain the children.
+         */
+        struct alignas(64) QuantizedWideBvhNode
+        {
+            float origin[3];
+            int8_t exponent[3];
+
+            // bit `i` is set if the i-th slot holds a child
+            uint8_t child_mask;
+
+            uint8_t q_min[3][Width];
+            uint8_t q_max[3][Width];
+
+            uint32_t child[Width];
+            uint16_t prim_num[Width];
+        };
+
+        static_assert(sizeof(QuantizedWideBvhNode) == (Width == 4 ? 64 : 128));
+
+        using WideBvhNode = std::conditional_t<Format == WideBvhNodeFormat::Quantized,
+                                               QuantizedWideBvhNode, FloatWideBvhNode>;
+
+        /**
+         * Reference of a child pending for traversal
+         */
+        struct TraversalItem
+        {
+            uint32_t child;
+            uint32_t prim_num;
+
+            // distance where the ray enters the child
+            float t;
+        };
+
+        // capacity of the traversal stack, NOTE collapsing doesn't make the tree deeper
+        static constexpr int kMaxTraversalStack = BinaryBvh::kMaxTraversalDepth * (Width - 1) + 1;
+
+        PrimitiveCollection prims_;
+
+        BoundingBox bbox_ = Vec3f{};
+
+        std::vector<WideBvhNode> bvh_nodes_;
+
+        // cache file that primitive order of the binary bvh is mapped from, if any
+        shared_ptr<const MappedFile> cache_file_ = nullptr;
+
+    public:
+        using PrimitiveCollectionType = PrimitiveCollection;
+
+        /**
+         * Build a binary bvh over the primitive collection on `pool`, and collapse it
+         */
+        BasicWideBvhComposite(PrimitiveCollection prims, BvhBuildSetting setting = {},
+                              ThreadPool& pool = ThreadPool::Global())
+            : BasicWideBvhComposite(BinaryBvh{std::move(prims), setting, pool})
+        {
+        }
+
+        /**
+         * Collapse a binary bvh, e.g. one loaded from a `MeshBvhCache`, taking over its
+         * primitives
+         */
+        BasicWideBvhComposite(BinaryBvh&& binary_bvh)
+        {
+            prims_      = std::move(binary_bvh.prims_);
+            bbox_       = binary_bvh.Bounding();
+            cache_file_ = binary_bvh.cache_file_;
+
+            const auto& binary_nodes = binary_bvh.bvh_nodes_;
+            bvh_nodes_.reserve(binary_nodes.size() / (Width - 1) + 1);
+
+            if (binary_nodes[0].prim_num != 0)
+            {
+                // the whole tree is a single leaf, put it into the first slot of the root
+                uint32_t children[Width]      = {0};
+                uint32_t wide_children[Width] = {0};
+                bvh_nodes_.push_back(EncodeNode(binary_nodes, children, wide_children, 1));
+            }
+            else
+            {
+                Collapse(binary_nodes, 0);
+            }
+        }
+
+        BoundingBox Bounding() const
+        {
+            return bbox_;
+        }
+
+        /**
+         * Memory used by nodes and primitive collection, in bytes
+         */
+        size_t ByteSize() const noexcept
+        {
+            return bvh_nodes_.capacity() * sizeof(WideBvhNode) + prims_.ByteSize();
+        }
+
+        /**
+         * Memory used by nodes only, in bytes
+         */
+        size_t NodeByteSize() const noexcept
+        {
+            return bvh_nodes_.size() * sizeof(WideBvhNode);
+        }
+
+        /**
+         * Find the closest hit, visiting children of a node from near to far and culling those
+         * beyond the closest hit found so far
+         */
+        bool Intersect(const Ray& ray, float t_min, float t_max, Workspace& ws,
+                       IntersectionInfo& isect) const noexcept
+        {
+            Vec3f inv_d = 1.f / ray.d;
+
+            TraversalItem stack[kMaxTraversalStack];
+            int stack_size = 0;
+
+            stack[stack_size++] = TraversalItem{.child = 0, .prim_num = 0, .t = t_min};
+
+            bool hit = false;
+            while (stack_size > 0)
+            {
+                TraversalItem item = stack[--stack_size];
+                if (item.t > t_max)
+                {
+                    continue;
+                }
+
+                if (item.prim_num != 0)
+                {
+                    // leaf
+                    if (prims_.Intersect(item.child, item.prim_num, ray, t_min, t_max, ws, isect))
+                    {
+                        hit   = true;
+                        t_max = isect.t;
+                    }
+
+                    continue;
+                }
+
+                const WideBvhNode& node = bvh_nodes_[item.child];
+
+                alignas(sizeof(float) * Width) float t_enter[Width];
+                uint32_t hit_mask = IntersectChildren(node, ray.o, inv_d, t_min, t_max, t_enter);
+
+                // push children that are hit from far to near, so that the nearest is popped
+                // first. Insertion sort is good enough for a handful of children.
+                int stack_base = stack_size;
+                for (int i = 0; i < Width; ++i)
+                {
+                    if ((hit_mask & (1u << i)) == 0)
+                    {
+                        continue;
+                    }
+
+                    TraversalItem child_item{
+                        .child = node.child[i], .prim_num = node.prim_num[i], .t = t_enter[i]};
+
+                    int j = stack_size++;
+                    for (; j > stack_base && stack[j - 1].t < child_item.t; --j)
+                    {
+                        stack[j] = stack[j - 1];
+                    }
+                    stack[j] = child_item;
+                }
+
+                USAMI_ASSERT(stack_size <= kMaxTraversalStack);
+            }
+
+            return hit;
+        }
+
+        bool Intersect(const Ray& ray, float t_min, float t_max, Workspace& ws,
+                       OcclusionInfo& occ_out) const noexcept
+        {
+            Vec3f inv_d = 1.f / ray.d;
+
+            TraversalItem stack[kMaxTraversalStack];
+            int stack_size = 0;
+
+            stack[stack_size++] = TraversalItem{.child = 0, .prim_num = 0, .t = t_min};
+
+            while (stack_size > 0)
+            {
+                TraversalItem item = stack[--stack_size];
+                if (item.prim_num != 0)
+                {
+                    // leaf, any hit is enough
+                    if (prims_.Intersect(item.child, item.prim_num, ray, t_min, t_max, ws,
+                                         occ_out))
+                    {
+                        return true;
+                    }
+
+                    continue;
+                }
+
+                const WideBvhNode& node = bvh_nodes_[item.child];
+
+                alignas(sizeof(float) * Width) float t_enter[Width];
+                uint32_t hit_mask = IntersectChildren(node, ray.o, inv_d, t_min, t_max, t_enter);
+
+                for (int i = 0; i < Width; ++i)
+                {
+                    if ((hit_mask & (1u << i)) != 0)
+                    {
+                        stack[stack_size++] = TraversalItem{
+                            .child = node.child[i], .prim_num = node.prim_num[i], .t = t_enter[i]};
+                    }
+                }
+
+                USAMI_ASSERT(stack_size <= kMaxTraversalStack);
+            }
+
+            return false;
+        }
+
+    private:
+        /**
+         * Slab test of all children of a node in one batch, see `BoundingBox::IntersectSlab`
+         *
+         * @param t_enter_out distance where the ray enters each child
+         * @return mask of children that are hit, bit `i` for the i-th child
+         */
+        static uint32_t IntersectChildren(const WideBvhNode& node, const Vec3f& o,
+                                          const Vec3f& inv_d, float t_min, float t_max,
+                                          float* t_enter_out) noexcept
+        {
+            BatchType t_enter{t_min};
+            BatchType t_exit{t_max};
+
+            for (int axis = 0; axis < 3; ++axis)
+            {
+                // pick planes by sign of the direction instead of min/max of both distances, so
+                // that inverted boxes of unused slots are always missed
+                bool dir_neg = inv_d[axis] < 0;
+
+                BatchType p_near;
+                BatchType p_far;
+                if constexpr (Format == WideBvhNodeFormat::Quantized)
+                {
+                    const uint8_t* q_near = dir_neg ? node.q_max[axis] : node.q_min[axis];
+                    const uint8_t* q_far  = dir_neg ? node.q_min[axis] : node.q_max[axis];
+
+                    alignas(sizeof(float) * Width) float q_near_arr[Width];
+                    alignas(sizeof(float) * Width) float q_far_arr[Width];
+                    for (int i = 0; i < Width; ++i)
+                    {
+                        q_near_arr[i] = q_near[i];
+                        q_far_arr[i]  = q_far[i];
+                    }
+
+                    // NOTE same arithmetic as `DecodeBound`
+                    BatchType origin = BatchType{node.origin[axis]};
+                    BatchType scale  = BatchType{QuantizationScale(node.exponent[axis])};
+                    p_near           = origin + BatchType{}.load_aligned(q_near_arr) * scale;
+                    p_far            = origin + BatchType{}.load_aligned(q_far_arr) * scale;
+                }
+                else
+                {
+                    p_near.load_aligned(dir_neg ? node.bbox_p_max[axis] : node.bbox_p_min[axis]);
+                    p_far.load_aligned(dir_neg ? node.bbox_p_min[axis] : node.bbox_p_max[axis]);
+                }
+
+                BatchType origin  = BatchType{o[axis]};
+                BatchType inv_dir = BatchType{inv_d[axis]};
+
+                BatchType t_near = (p_near - origin) * inv_dir;
+                BatchType t_far  = (p_far - origin) * inv_dir;
+
+                t_enter = xsimd::max(t_enter, t_near);
+                t_exit  = xsimd::min(t_exit, t_far * BatchType{BoundingBox::kSlabFarScale});
+            }
+
+            alignas(sizeof(float) * Width) float t_exit_arr[Width];
+            t_enter.store_aligned(t_enter_out);
+            t_exit.store_aligned(t_exit_arr);
+
+            uint32_t hit_mask = 0;
+            for (int i = 0; i < Width; ++i)
+            {
+                hit_mask |= static_cast<uint32_t>(t_enter_out[i] <= t_exit_arr[i]) << i;
+            }
+
+            if constexpr (Format == WideBvhNodeFormat::Quantized)
+            {
+                // unused slots don't decode to inverted boxes
+                hit_mask &= node.child_mask;
+            }
+
+            return hit_mask;
+        }
+
+        /**
+         * Create a node of children `children` of the binary bvh, where `wide_children` is index
+         * of the wide node collapsed from each inner child
+         */
+        static WideBvhNode EncodeNode(
+            std::span<const typename BinaryBvh::LinearBvhNode> binary_nodes,
+            const uint32_t* children, const uint32_t* wide_children, int num_children)
+        {
+            WideBvhNode node;
+            if constexpr (Format == WideBvhNodeFormat::Quantized)
+            {
+                BoundingBox bbox = BoundingBox::Empty();
+                for (int i = 0; i < num_children; ++i)
+                {
+                    const auto& child = binary_nodes[children[i]];
+                    bbox = UnionBBox(bbox, BoundingBox{child.bbox_p_min, child.bbox_p_max});
+                }
+
+                for (int axis = 0; axis < 3; ++axis)
+                {
+                    float origin = bbox.p_min[axis];
+                    int exponent = ComputeQuantizationExponent(origin, bbox.p_max[axis]);
+
+                    node.origin[axis]   = origin;
+                    node.exponent[axis] = static_cast<int8_t>(exponent);
+
+                    std::fill_n(node.q_min[axis], Width, 0);
+                    std::fill_n(node.q_max[axis], Width, 0);
+                    for (int i = 0; i < num_children; ++i)
+                    {
+                        const auto& child = binary_nodes[children[i]];
+                        node.q_min[axis][i] =
+                            QuantizeBound(child.bbox_p_min[axis], origin, exponent, false);
+                        node.q_max[axis][i] =
+                            QuantizeBound(child.bbox_p_max[axis], origin, exponent, true);
+                    }
+                }
+
+                node.child_mask = static_cast<uint8_t>((1u << num_children) - 1);
+            }
+            else
+            {
+                for (int axis = 0; axis < 3; ++axis)
+                {
+                    std::fill_n(node.bbox_p_min[axis], Width,
+                                std::numeric_limits<float>::infinity());
+                    std::fill_n(node.bbox_p_max[axis], Width,
+                                -std::numeric_limits<float>::infinity());
+
+                    for (int i = 0; i < num_children; ++i)
+                    {
+                        node.bbox_p_min[axis][i] = binary_nodes[children[i]].bbox_p_min[axis];
+                        node.bbox_p_max[axis][i] = binary_nodes[children[i]].bbox_p_max[axis];
+                    }
+                }
+            }
+
+            std::fill_n(node.child, Width, 0);
+            std::fill_n(node.prim_num, Width, 0);
+            for (int i = 0; i < num_children; ++i)
+            {
+                const auto& child = binary_nodes[children[i]];
+                node.child[i]     = child.prim_num != 0 ? child.prim_offset : wide_children[i];
+                node.prim_num[i]  = child.prim_num;
+            }
+
+            return node;
+        }
+
+        static float QuantizationScale(int exponent) noexcept
+        {
+            return std::bit_cast<float>(static_cast<uint32_t>(exponent + 127) << 23);
+        }
+
+        static float DecodeBound(uint8_t q, float origin, int exponent) noexcept
+        {
+            return origin + static_cast<float>(q) * QuantizationScale(exponent);
+        }
+
+        /**
+         * Smallest exponent of the grid whose last cell reaches `p_max` from `origin`
+         */
+        static int ComputeQuantizationExponent(float origin, float p_max) noexcept
+        {
+            constexpr int kMinExponent = -126;
+            constexpr int kMaxExponent = 127;
+
+            float extent = p_max - origin;
+
+            int exponent = kMinExponent;
+            if (extent > 0)
+            {
+                exponent = std::clamp(std::ilogb(extent / 255), kMinExponent, kMaxExponent);
+            }
+
+            while (exponent < kMaxExponent && DecodeBound(255, origin, exponent) < p_max)
+            {
+                ++exponent;
+            }
+
+            return exponent;
+        }
+
+        /**
+         * Quantize a bound rounding down, or up if `round_up`, so that the decoded bound is
+         * conservative
+         */
+        static uint8_t QuantizeBound(float p, float origin, int exponent, bool round_up) noexcept
+        {
+            float x = (p - origin) / QuantizationScale(exponent);
+            int q   = static_cast<int>(std::clamp(round_up ? std::ceil(x) : std::floor(x), 0.f,
+                                                  255.f));
+
+            // fix rounding of the decoding arithmetic
+            if (round_up)
+            {
+                while (q < 255 && DecodeBound(q, origin, exponent) < p)
+                {
+                    ++q;
+                }
+            }
+            else
+            {
+                while (q > 0 && DecodeBound(q, origin, exponent) > p)
+                {
+                    --q;
+                }
+            }
+
+            return static_cast<uint8_t>(q);
+        }
+
+        /**
+         * Collapse the binary subtree rooted at inner node `ibinary` into a wide node
+         *
+         * @return index of the wide node
+         */
+        uint32_t Collapse(std::span<const typename BinaryBvh::LinearBvhNode> binary_nodes,
+                          uint32_t ibinary)
+        {
+            USAMI_ASSERT(binary_nodes[ibinary].prim_num == 0);
+
+            // start with the two children and repeatedly open the inner one with largest area
+            uint32_t children[Width];
+            int num_children = 0;
+
+            children[num_children++] = binary_nodes[ibinary].child_index;
+            children[num_children++] = binary_nodes[ibinary].child_index + 1;
+
+            while (num_children < Width)
+            {
+                int best_slot   = -1;
+                float best_area = -1;
+                for (int i = 0; i < num_children; ++i)
+                {
+                    const auto& child = binary_nodes[children[i]];
+                    if (child.prim_num != 0)
+                    {
+                        continue;
+                    }
+
+                    float area = BoundingBox{child.bbox_p_min, child.bbox_p_max}.Area();
+                    if (area > best_area)
+                    {
+                        best_slot = i;
+                        best_area = area;
+                    }
+                }
+
+                if (best_slot < 0)
+                {
+                    // all children are leaves
+                    break;
+                }
+
+                uint32_t iopened         = children[best_slot];
+                children[best_slot]      = binary_nodes[iopened].child_index;
+                children[num_children++] = binary_nodes[iopened].child_index + 1;
+            }
+
+            // NOTE the node is reserved before its descendants, and filled after them as bounds are
+            // quantized over all children
+            uint32_t index = bvh_nodes_.size();
+            bvh_nodes_.emplace_back();
+
+            uint32_t wide_children[Width];
+            for (int i = 0; i < num_children; ++i)
+            {
+                wide_children[i] = binary_nodes[children[i]].prim_num != 0
+                                       ? 0
+                                       : Collapse(binary_nodes, children[i]);
+            }
+
+            bvh_nodes_[index] = EncodeNode(binary_nodes, children, wide_children, num_children);
+            return index;
+        }
+    };
+
+    template <int Width = kDefaultWideBvhWidth>
+    using WideBvhComposite = BasicWideBvhComposite<BasicPrimitiveCollection, Width>;
+
+    template <int Width = kDefaultWideBvhWidth>
+    using MeshWideBvhComposite = BasicWideBvhComposite<MeshPrimitiveCollection, Width>;
+
+    template <int Width = kDefaultWideBvhWidth>
+    using QuantizedWideBvhComposite =
+        BasicWideBvhComposite<BasicPrimitiveCollection, Width, WideBvhNodeFormat::Quantized>;
+
+    template <int Width = kDefaultWideBvhWidth>
+    using QuantizedMeshWideBvhComposite =
+        BasicWideBvhComposite<MeshPrimitiveCollection, Width, WideBvhNodeFormat::Quantized>;
+} // namespace usami::ray
@@ -0,0 +1,94 @@
+#pragma once
+#include "usami/ray/ray.h"
+#include <vector>
+
+namespace usami::ray
+{
+    /**
+     * Hint of how rays in a batch are distributed, which a scene may use to pick a traversal
+     * strategy
+     */
+    enum class RayCoherence
+    {
+        // rays with nearby origins and similar directions, e.g. camera rays of a tile
+        Coherent,
+
+        // rays in arbitrary directions, e.g. secondary rays of different paths
+        Incoherent,
+    };
+
+    /**
+     * Results of a batch of intersection queries, stored in SoA layout
+     *
+     * NOTE `IntersectionInfo::primitive` is not recorded as it may be allocated from a workspace
+     */
+    struct HitBuffer
+    {
+        std::vector<uint8_t> hit;
+
+        std::vector<float> t;
+        std::vector<Vec3f> point;
+        std::vector<Vec3f> ng;
+        std::vector<Vec3f> ns;
+        std::vector<Vec2f> uv;
+        std::vector<unsigned> iface;
+
+        std::vector<const Material*> material;
+        std::vector<const AreaLight*> area_light;
+
+        size_t Size() const noexcept
+        {
+            return hit.size();
+        }
+
+        void Resize(size_t size)
+        {
+            hit.resize(size);
+            t.resize(size);
+            point.resize(size);
+            ng.resize(size);
+            ns.resize(size);
+            uv.resize(size);
+            iface.resize(size);
+            material.resize(size);
+            area_light.resize(size);
+        }
+
+        void StoreMiss(size_t i) noexcept
+        {
+            hit[i] = false;
+        }
+
+        void Store(size_t i, const IntersectionInfo& isect) noexcept
+        {
+            hit[i]        = true;
+            t[i]          = isect.t;
+            point[i]      = isect.point;
+            ng[i]         = isect.ng;
+            ns[i]         = isect.ns;
+            uv[i]         = isect.uv;
+            iface[i]      = isect.iface;
+            material[i]   = isect.material;
+            area_light[i] = isect.area_light;
+        }
+
+        /**
+         * Assemble intersection info of the i-th ray, which must have hit something
+         */
+        IntersectionInfo Load(size_t i) const noexcept
+        {
+            USAMI_ASSERT(hit[i]);
+
+            IntersectionInfo isect;
+            isect.t          = t[i];
+            isect.point      = point[i];
+            isect.ng         = ng[i];
+            isect.ns         = ns[i];
+            isect.uv         = uv[i];
+            isect.iface      = iface[i];
+            isect.material   = material[i];
+            isect.area_light = area_light[i];
+            return isect;
+        }
+    };
+} // namespace usami::ray
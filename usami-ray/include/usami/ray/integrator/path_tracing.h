@@ -3,17 +3,47 @@
 
 namespace usami::ray
 {
+    /**
+     * How direct lighting is estimated at a shading point
+     */
+    enum class DirectLightSampling
+    {
+        // trace a shadow ray towards every light
+        AllLights,
+
+        // trace shadow rays towards a few lights picked by `Scene::LightBvh`, which scales to
+        // scenes with many lights, e.g. meshes with emissive triangles
+        LightBvh,
+
+        // trace shadow rays towards a few lights picked by their power through
+        // `Scene::LightDistribution`, which costs O(1) per light but ignores where lights are
+        Power,
+    };
+
+    /**
+     * Unidirectional path tracing, where direct lighting at each non-specular bounce combines
+     * sampling lights and sampling BSDF by multiple importance sampling with the power heuristic
+     */
     class PathTracingIntegrator : public Integrator
     {
     private:
         int min_bounce_;
         int max_bounce_;
 
+        DirectLightSampling light_sampling_;
+
+        // number of lights picked at each shading point, unless all of them are sampled
+        int num_light_sample_;
+
     public:
-        PathTracingIntegrator(int min_bounce = 2, int max_bounce = 6)
-            : min_bounce_(min_bounce), max_bounce_(max_bounce)
+        PathTracingIntegrator(int min_bounce = 2, int max_bounce = 6,
+                              DirectLightSampling light_sampling = DirectLightSampling::AllLights,
+                              int num_light_sample = 1)
+            : min_bounce_(min_bounce), max_bounce_(max_bounce), light_sampling_(light_sampling),
+              num_light_sample_(num_light_sample)
         {
             USAMI_REQUIRE(min_bounce > 0 && max_bounce >= min_bounce);
+            USAMI_REQUIRE(num_light_sample > 0);
         }
 
         SpectrumRGB Li(RenderingContext& ctx, Sampler& sampler, const Scene& scene,
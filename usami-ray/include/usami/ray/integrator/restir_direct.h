@@ -0,0 +1,108 @@
+#pragma once
+#include "usami/sampler.h"
+#include "usami/ray/camera.h"
+#include "usami/ray/canvas.h"
+#include "usami/ray/integrator.h"
+#include "usami/ray/reservoir_buffer.h"
+#include "usami/ray/scene.h"
+#include <vector>
+
+namespace usami::ray
+{
+    struct RestirDirectSetting
+    {
+        // number of samples taken for each pixel, one in every frame
+        int num_sample = 16;
+
+        // number of light samples generated at each pixel, from which one is resampled
+        int num_initial_candidate = 32;
+
+        // whether reservoirs only keep visible samples, which costs a shadow ray for each merged
+        // reservoir, but avoids spreading occluded samples, e.g. in soft shadows
+        bool visibility_reuse = true;
+
+        // whether the reservoir of the previous frame at the same pixel is reused
+        bool temporal_reuse = true;
+
+        // history is clamped to this many times of `num_initial_candidate`, so that stale samples
+        // don't dominate new ones and correlation across frames is bounded
+        int max_history = 4;
+
+        // number of neighbouring pixels whose reservoirs are reused
+        int num_spatial_neighbor = 5;
+
+        // radius in pixels within which neighbours are picked
+        float spatial_radius = 30.f;
+
+        // base seed from which samplers of every pixel are derived
+        uint64_t seed = 0xdeadbeef;
+    };
+
+    /**
+     * Direct lighting with reservoir-based spatiotemporal importance resampling, i.e. ReSTIR DI,
+     * see Bitterli et al. 2020
+     *
+     * Each frame renders one sample of every pixel in two passes over the image:
+     *
+     * 1. initial: find the surface seen through the pixel, resample a light sample from many
+     *    candidates picked by `Scene::LightBvh` by their unshadowed contribution, and merge it
+     *    with the history of the pixel
+     * 2. spatial: merge reservoirs of a few neighbouring pixels, and shade the pixel with the
+     *    picked sample
+     *
+     * Candidates cost no ray, so shadow rays are only spent on samples that matter most, and
+     * reusing reservoirs spreads good samples across pixels and frames. Reservoirs are merged with
+     * pairwise MIS weights, so the estimate stays unbiased except for correlation between reused
+     * reservoirs, which is bounded by `max_history`.
+     *
+     * A light sample is reused by evaluating `Light::Sample` with the same unit sample at another
+     * surface. So lights whose samples don't depend on the shading point, i.e. points on area
+     * lights, point and distant lights, are reused exactly.
+     *
+     * NOTE only direct lighting is estimated, i.e. emission seen from the camera and light
+     * reflected once, the same as `PathTracingIntegrator` bounced once.
+     */
+    class RestirDirectIntegrator
+    {
+    private:
+        RestirDirectSetting setting_;
+
+    public:
+        RestirDirectIntegrator(RestirDirectSetting setting = {});
+
+        const RestirDirectSetting& Setting() const noexcept
+        {
+            return setting_;
+        }
+
+        /**
+         * Render the scene, appending the sum of all samples of a pixel into the canvas
+         *
+         * Reservoirs are kept in `reservoirs` of the same size as the canvas, whose history is
+         * reused by the next call, e.g. to render more samples of the same view.
+         *
+         * NOTE scale the canvas by `1 / num_sample` to get the estimated radiance
+         */
+        void Render(Canvas& canvas, ReservoirBuffer& reservoirs, const PerspectiveCamera& camera,
+                    const Scene& scene) const;
+
+        void Render(Canvas& canvas, const PerspectiveCamera& camera, const Scene& scene) const;
+
+    private:
+        struct FrameContext
+        {
+            // sampler of each pixel
+            std::vector<Sampler> samplers;
+
+            // scratch context of each worker
+            std::vector<unique_ptr<RenderingContext>> contexts;
+        };
+
+        void ResampleInitial(FrameContext& frame, Canvas& canvas, ReservoirBuffer& reservoirs,
+                             const PerspectiveCamera& camera, const Scene& scene, int x,
+                             int y) const;
+
+        void ResampleSpatial(FrameContext& frame, Canvas& canvas, ReservoirBuffer& reservoirs,
+                             const Scene& scene, int x, int y) const;
+    };
+} // namespace usami::ray
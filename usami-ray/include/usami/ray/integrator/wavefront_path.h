@@ -0,0 +1,149 @@
+#pragma once
+#include "usami/sampler.h"
+#include "usami/ray/camera.h"
+#include "usami/ray/canvas.h"
+#include "usami/ray/integrator.h"
+#include "usami/ray/scene.h"
+#include <vector>
+
+namespace usami::ray
+{
+    struct WavefrontPathSetting
+    {
+        // number of samples taken for each pixel
+        int num_sample = 16;
+
+        // bounces before russian roulette kicks in
+        int min_bounce = 2;
+
+        // maximum number of bounces of a path
+        int max_bounce = 6;
+
+        // maximum number of paths that are traced together in a wave
+        int max_path_per_wave = 1 << 20;
+
+        // base seed from which samplers of every pixel are derived
+        uint64_t seed = 0xdeadbeef;
+    };
+
+    /**
+     * A path tracer that advances a large number of paths together, one bounce at a time.
+     *
+     * Unlike `PathTracingIntegrator` which follows one path to the end before starting another,
+     * states of all paths in a wave are kept in SoA buffers and each bounce runs as separate
+     * stages over the whole wave:
+     *
+     * 1. extend: find closest hits of all path rays, submitted to the scene in batches
+     * 2. sort: group hit paths by material
+     * 3. shade: compute BSDF, queue shadow rays towards sampled lights and sample next rays
+     * 4. shadow: trace queued shadow rays and accumulate unoccluded direct lighting
+     *
+     * so that every stage runs the same code over many paths, and shading of the same material
+     * is done in a row. It estimates the same quantity as `PathTracingIntegrator`.
+     *
+     * NOTE a wave consists of paths of the same sample index over a range of pixels, so that each
+     * pixel (and its sampler) is used by only one path per wave and the image doesn't depend on
+     * scheduling.
+     */
+    class WavefrontPathIntegrator
+    {
+    private:
+        WavefrontPathSetting setting_;
+
+    public:
+        WavefrontPathIntegrator(WavefrontPathSetting setting = {});
+
+        const WavefrontPathSetting& Setting() const noexcept
+        {
+            return setting_;
+        }
+
+        /**
+         * Render the scene, appending the sum of all samples of a pixel into the canvas
+         *
+         * NOTE scale the canvas by `1 / num_sample` to get the estimated radiance
+         */
+        void Render(Canvas& canvas, const PerspectiveCamera& camera, const Scene& scene) const;
+
+    private:
+        struct ShadowRay
+        {
+            // index of the path in the wave
+            uint32_t path;
+
+            // ray from the shading point towards the sampled light
+            Ray ray;
+
+            // the light is occluded if anything is hit before this distance
+            float t_max;
+
+            // radiance to be added to the path if the light is visible
+            SpectrumRGB contribution;
+        };
+
+        /**
+         * State of paths in a wave, stored in SoA layout
+         */
+        struct PathStates
+        {
+            std::vector<uint32_t> pixel;
+            std::vector<Ray> ray;
+            std::vector<SpectrumRGB> throughput;
+            std::vector<SpectrumRGB> radiance;
+            std::vector<uint8_t> specular_bounce;
+            std::vector<uint8_t> alive;
+
+            // closest hit found in the last extend stage
+            std::vector<IntersectionInfo> hit;
+
+            void Resize(size_t size);
+        };
+
+        /**
+         * Scratch data owned by a worker thread
+         */
+        struct WorkerData
+        {
+            RenderingContext ctx;
+
+            // shadow rays queued by paths shaded on this worker
+            std::vector<ShadowRay> shadow_queue;
+
+            // batch of queries submitted to the scene
+            std::vector<Ray> rays;
+            std::vector<float> t_max;
+            std::vector<uint8_t> occluded;
+            HitBuffer hits;
+        };
+
+        struct WaveContext
+        {
+            PathStates paths;
+
+            // sampler of each pixel, which is consumed by one path in every wave
+            std::vector<Sampler> samplers;
+
+            // indices of paths that are still being traced
+            std::vector<uint32_t> active;
+
+            // indices of paths to be shaded, sorted by material
+            std::vector<uint32_t> shade_queue;
+
+            // scratch data of each worker
+            std::vector<unique_ptr<WorkerData>> workers;
+        };
+
+        void RenderWave(WaveContext& wave, Canvas& canvas, const PerspectiveCamera& camera,
+                        const Scene& scene, size_t pixel_begin, size_t pixel_end) const;
+
+        void Extend(WaveContext& wave, const Scene& scene, int bounce) const;
+
+        void SortByMaterial(WaveContext& wave) const;
+
+        void Shade(WaveContext& wave, const Scene& scene, int bounce) const;
+
+        void TraceShadowRays(WaveContext& wave, const Scene& scene) const;
+
+        void CompactActivePaths(WaveContext& wave) const;
+    };
+} // namespace usami::ray
@@ -2,6 +2,7 @@
 #include "usami/memory/arena.h"
 #include "usami/color.h"
 #include "usami/ray/ray.h"
+#include "usami/ray/bbox.h"
 
 namespace usami::ray
 {
@@ -17,6 +18,42 @@ namespace usami::ray
         Area,
     };
 
+    /**
+     * Spatial and directional bounds of emission of a light, see PBRT 4 12.6.3
+     */
+    struct LightBounds
+    {
+        // bounds of points emitting light
+        BoundingBox bbox = BoundingBox::Empty();
+
+        // bounds of directions the emitters face
+        DirectionCone normal = DirectionCone::Empty();
+
+        // cosine of the angle off a normal that light is still emitted towards, e.g. 0 for a
+        // diffuse surface
+        float cos_theta_e = 1.f;
+
+        // emitted power
+        float phi = 0.f;
+    };
+
+    inline LightBounds UnionLightBounds(const LightBounds& a, const LightBounds& b)
+    {
+        if (a.phi == 0)
+        {
+            return b;
+        }
+        if (b.phi == 0)
+        {
+            return a;
+        }
+
+        return LightBounds{.bbox        = UnionBBox(a.bbox, b.bbox),
+                           .normal      = UnionCone(a.normal, b.normal),
+                           .cos_theta_e = Min(a.cos_theta_e, b.cos_theta_e),
+                           .phi         = a.phi + b.phi};
+    }
+
     class Light : public UsamiObject
     {
     protected:
@@ -32,10 +69,31 @@ namespace usami::ray
 
         virtual LightSample Sample(const IntersectionInfo& isect, const Point2f& u) const = 0;
 
+        /**
+         * Solid angle density of `Sample` at `isect` picking the direction towards `light_isect`,
+         * a point on the light found otherwise, e.g. by a ray sampled from BSDF
+         *
+         * NOTE lights of delta distribution can't be hit by rays, so they always give zero
+         */
+        virtual float Pdf(const IntersectionInfo& isect, const IntersectionInfo& light_isect) const
+        {
+            return 0.f;
+        }
+
         /**
          * Estimate total radiant flux generated by the light source
          */
         virtual SpectrumRGB Power() const = 0;
+
+        /**
+         * Bounds of the light, by which `BvhLightSampler` estimates its contribution to a point
+         *
+         * @return false if the light is unbounded, e.g. a distant light
+         */
+        virtual bool Bounds(LightBounds& bounds_out) const
+        {
+            return false;
+        }
     };
 
     class AreaLight : public Light
@@ -86,6 +144,11 @@ namespace usami::ray
         bool TestVisibility(const Scene& scene, const IntersectionInfo& isect_obj,
                             Workspace& workspace) const;
 
+        /**
+         * Distance a shadow ray from `p` may travel before it reaches the sampled light
+         */
+        float ShadowRayDistance(const Vec3f& p) const;
+
         Ray GenerateTestRay(const Vec3f& p) const noexcept
         {
             return Ray::FromTo(point_, p);
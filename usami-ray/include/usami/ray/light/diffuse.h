@@ -25,18 +25,52 @@ namespace usami::ray
         {
             Vec3f point;
             Vec3f normal;
-            float pdf;
-            GetPrimitive()->SamplePoint(u, point, normal, pdf);
+            float pdf_area;
+            GetPrimitive()->SamplePoint(u, point, normal, pdf_area);
 
-            Vec3f wi       = point - isect.point;
-            Vec3f radiance = Dot(wi, normal) < 0 ? intensity_ : 0.f;
+            Vec3f wi        = point - isect.point;
+            float dist_sq   = wi.LengthSq();
+            float cos_light = -Dot(wi, normal);
+            if (cos_light <= 0 || dist_sq == 0)
+            {
+                // light only emits towards the side its normal faces
+                return LightSample{wi, point, 0.f, 0.f, LightType::Area};
+            }
 
-            return LightSample{wi.Normalize(), point, radiance, pdf, LightType::Area};
+            // convert density over area of the light to solid angle at `isect`
+            float dist = Sqrt(dist_sq);
+            float pdf  = pdf_area * dist_sq * dist / cos_light;
+
+            return LightSample{wi / dist, point, intensity_, pdf, LightType::Area};
+        }
+
+        float Pdf(const IntersectionInfo& isect,
+                  const IntersectionInfo& light_isect) const override
+        {
+            // NOTE points are sampled uniformly by area on every primitive
+            Vec3f wi        = light_isect.point - isect.point;
+            float dist_sq   = wi.LengthSq();
+            float cos_light = -Dot(wi, light_isect.ng.Normalize());
+            if (cos_light <= 0 || dist_sq == 0)
+            {
+                return 0.f;
+            }
+
+            return dist_sq * Sqrt(dist_sq) / (cos_light * GetPrimitive()->Area());
         }
 
         SpectrumRGB Power() const override
         {
             return intensity_ * kPi * GetPrimitive()->Area();
         }
+
+        bool Bounds(LightBounds& bounds_out) const override
+        {
+            bounds_out = LightBounds{.bbox        = GetPrimitive()->Bounding(),
+                                     .normal      = GetPrimitive()->NormalBounds(),
+                                     .cos_theta_e = 0.f,
+                                     .phi         = Power().Length()};
+            return true;
+        }
     };
 } // namespace usami::ray
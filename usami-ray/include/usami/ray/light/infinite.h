@@ -1,10 +1,18 @@
 #pragma once
 #include "usami/ray/light.h"
+#include "usami/math/distribution.h"
 #include "usami/math/sampling.h"
 #include "usami/texture.h"
 
 namespace usami::ray
 {
+    /**
+     * Light from an environment texture surrounding the world, which is mapped to directions by
+     * latitude and longitude
+     *
+     * Directions are sampled in proportion to the luminance of the texture, so that small bright
+     * features like the sun are found by few samples.
+     */
     class InfiniteAreaLight : public Light
     {
     private:
@@ -14,27 +22,19 @@ namespace usami::ray
         Vec3f world_center_;
         float world_radius_;
 
+        // distribution over uv coordinate by luminance of the texture, scaled by sin(theta) of
+        // each texel to account for texels shrinking towards the poles
+        Distribution2D distribution_;
+
     public:
         InfiniteAreaLight(shared_ptr<Texture2D<Vec3f>> tex, float intensity, Vec3f world_center,
-                          float world_radius)
-            : Light(LightType::Infinite), tex_(tex), intensity_(intensity),
-              world_center_(world_center), world_radius_(world_radius)
-        {
-        }
+                          float world_radius);
 
         SpectrumRGB Eval(const Vec3f& wi_world) const
         {
-            // TODO: reuse this with sphere shape
-            // NOTE normal == wi_world
-            float u = 1 - std::atan2(wi_world.y, wi_world.x) * kInvTwoPi;
-            float v = 1 - std::acos(wi_world.z) * kInvPi;
-            if (u < 0)
-            {
-                u += 1;
-            }
-
             // TODO: deal with duvdx and duvdy
-            return intensity_ * tex_->Eval({u, v});
+            Point2f uv = DirectionToUV(wi_world);
+            return intensity_ * tex_->Eval({uv[0], uv[1]});
         }
 
         SpectrumRGB Eval(const Ray& ray) const override
@@ -42,22 +42,45 @@ namespace usami::ray
             return Eval(ray.d);
         }
 
-        // TODO: NOTE we shouldn't only sample lighting from outside the surface here
-        LightSample Sample(const IntersectionInfo& isect, const Point2f& u) const override
+        LightSample Sample(const IntersectionInfo& isect, const Point2f& u) const override;
+
+        /**
+         * Solid angle density of sampling `wi_world` by `Sample`
+         */
+        float Pdf(const Vec3f& wi_world) const;
+
+        SpectrumRGB Power() const override
         {
-            Vec3f wi = SampleUniformSphere(u);
-            if (Dot(wi, isect.ns) < 0)
+            // TODO: give a better estimate
+            return intensity_ * kPi * world_radius_ * world_radius_;
+        }
+
+    private:
+        static Point2f DirectionToUV(const Vec3f& w) noexcept
+        {
+            // TODO: reuse this with sphere shape
+            // NOTE normal == wi_world
+            float u = 1 - std::atan2(w.y, w.x) * kInvTwoPi;
+            float v = 1 - std::acos(Clamp(w.z, -1.f, 1.f)) * kInvPi;
+            if (u < 0)
             {
-                wi = -wi;
+                u += 1;
+            }
+            else if (u >= 1)
+            {
+                u -= 1;
             }
 
-            return LightSample{wi, 0.f, Eval(wi), PdfUniformSphere() * 2, LightType::Infinite};
+            return Point2f{u, v};
         }
 
-        SpectrumRGB Power() const override
+        static Vec3f UVToDirection(const Point2f& uv) noexcept
         {
-            // TODO: give a better estimate
-            return intensity_ * kPi * world_radius_ * world_radius_;
+            float theta = (1 - uv[1]) * kPi;
+            float phi   = (1 - uv[0]) * kTwoPi;
+
+            float sin_theta = Sin(theta);
+            return Vec3f{sin_theta * Cos(phi), sin_theta * Sin(phi), Cos(theta)};
         }
     };
 } // namespace usami::ray
@@ -35,5 +35,14 @@ namespace usami::ray
         {
             return intensity_ * kAreaUnitSphere;
         }
+
+        bool Bounds(LightBounds& bounds_out) const override
+        {
+            bounds_out = LightBounds{.bbox        = point_,
+                                     .normal      = DirectionCone::EntireSphere(),
+                                     .cos_theta_e = 0.f,
+                                     .phi         = Power().Length()};
+            return true;
+        }
     };
 } // namespace usami::ray
\ No newline at end of file
@@ -45,5 +45,14 @@ namespace usami::ray
         {
             return intensity_ * AreaUnitCone(cos_theta_);
         }
+
+        bool Bounds(LightBounds& bounds_out) const override
+        {
+            bounds_out = LightBounds{.bbox        = point_,
+                                     .normal      = DirectionCone{direction_, cos_theta_},
+                                     .cos_theta_e = 1.f,
+                                     .phi         = Power().Length()};
+            return true;
+        }
     };
 } // namespace usami::ray
\ No newline at end of file
@@ -0,0 +1,29 @@
+#pragma once
+#include "usami/common.h"
+#include "usami/ray/light.h"
+
+namespace usami::ray
+{
+    /**
+     * A `LightSampler` picks one of lights of a scene to illuminate a shading point, with
+     * probability that ideally follows contribution of each light to the point
+     */
+    class LightSampler : public UsamiObject
+    {
+    public:
+        /**
+         * Pick a light for a shading point from a unit sample
+         *
+         * @param n normal at the shading point, or zero if the light may come from any side
+         * @param pmf_out probability of the light being picked
+         * @return nullptr if no light could be picked
+         */
+        virtual const Light* Sample(const Vec3f& p, const Vec3f& n, float u,
+                                    float& pmf_out) const = 0;
+
+        /**
+         * Probability of `light` being picked by `Sample` for a shading point
+         */
+        virtual float Pmf(const Vec3f& p, const Vec3f& n, const Light* light) const = 0;
+    };
+} // namespace usami::ray
@@ -0,0 +1,108 @@
+#pragma once
+#include "usami/ray/light_sampler.h"
+#include <span>
+#include <unordered_map>
+#include <vector>
+
+namespace usami::ray
+{
+    /**
+     * Light sampler over a bounding volume hierarchy of lights, see PBRT 4 12.6.3
+     *
+     * Each node keeps bounds, power and normal cone of lights below it, from which importance of
+     * the node to a shading point is estimated. `Sample` descends from the root into either child
+     * with probability proportional to its importance, so a light is picked in time logarithmic
+     * to the number of lights, while lights that can't reach the point, e.g. those facing away,
+     * are never picked. The importance is conservative, so every light that may contribute has a
+     * positive probability and the estimate stays unbiased.
+     *
+     * Unbounded lights, e.g. distant ones, are picked uniformly apart from the hierarchy, which as
+     * a whole is as likely as any of them.
+     */
+    class BvhLightSampler : public LightSampler
+    {
+    private:
+        // number of buckets along an axis over which a split is searched
+        static constexpr int kNumSplitBucket = 12;
+
+        // depth below which lights are split by count instead, so that paths to leaves fit into
+        // 64 bits
+        static constexpr int kMaxCostSplitDepth = 32;
+
+        struct Node
+        {
+            LightBounds bounds;
+
+            // index into `bounded_lights_` of a leaf, or the second child of an interior node
+            // whose first child follows it
+            uint32_t index;
+            bool is_leaf;
+        };
+
+        std::vector<const Light*> bounded_lights_;
+        std::vector<const Light*> infinite_lights_;
+
+        // nodes in depth-first order, where the root is the first
+        std::vector<Node> nodes_;
+
+        // path from the root to the leaf of each bounded light, whose i-th bit is set if the
+        // second child is taken at depth i
+        std::unordered_map<const Light*, uint64_t> light_trails_;
+
+    public:
+        BvhLightSampler()
+        {
+        }
+        BvhLightSampler(std::span<const Light* const> lights)
+        {
+            Reset(lights);
+        }
+
+        /**
+         * Rebuild the hierarchy over `lights`, where those emitting no power are never picked
+         */
+        void Reset(std::span<const Light* const> lights);
+
+        const Light* Sample(const Vec3f& p, const Vec3f& n, float u,
+                            float& pmf_out) const override;
+
+        float Pmf(const Vec3f& p, const Vec3f& n, const Light* light) const override;
+
+        size_t NodeByteSize() const noexcept
+        {
+            return nodes_.capacity() * sizeof(Node);
+        }
+
+    private:
+        // probability of picking an unbounded light
+        float InfiniteProbability() const noexcept
+        {
+            size_t num_infinite = infinite_lights_.size();
+            return num_infinite == 0
+                       ? 0.f
+                       : static_cast<float>(num_infinite) /
+                             static_cast<float>(num_infinite + (nodes_.empty() ? 0 : 1));
+        }
+
+        /**
+         * Conservative estimate of contribution of lights within `bounds` to a shading point
+         */
+        static float Importance(const LightBounds& bounds, const Vec3f& p, const Vec3f& n);
+
+        /**
+         * Cost of a node for splits along `axis`, which grows with its power, surface area and
+         * spread of its normals, see PBRT 4 12.6.3
+         */
+        static float SplitCost(const LightBounds& bounds, const BoundingBox& parent_bbox,
+                               int axis);
+
+        /**
+         * Build a subtree over `items`, which are pairs of an index into `bounded_lights_` and
+         * bounds of the light
+         *
+         * @return index of the root of the subtree
+         */
+        uint32_t BuildNodes(std::span<std::pair<uint32_t, LightBounds>> items, uint64_t trail,
+                            int depth);
+    };
+} // namespace usami::ray
@@ -0,0 +1,70 @@
+#pragma once
+#include "usami/math/distribution.h"
+#include "usami/ray/light_sampler.h"
+#include <span>
+#include <unordered_map>
+#include <vector>
+
+namespace usami::ray
+{
+    /**
+     * Light sampler picking lights in proportion to their power regardless of the shading point,
+     * which costs O(1) per sample
+     */
+    class PowerLightSampler : public LightSampler
+    {
+    private:
+        std::vector<const Light*> lights_;
+        DiscrateDistribution distribution_;
+
+        // index of each light in `lights_`
+        std::unordered_map<const Light*, int> light_indices_;
+
+    public:
+        PowerLightSampler()
+        {
+        }
+        PowerLightSampler(std::span<const Light* const> lights)
+        {
+            Reset(lights);
+        }
+
+        /**
+         * Rebuild the distribution over `lights`, where those emitting no power are never picked
+         */
+        void Reset(std::span<const Light* const> lights)
+        {
+            lights_.assign(lights.begin(), lights.end());
+            light_indices_.clear();
+
+            std::vector<float> weights;
+            weights.reserve(lights_.size());
+            for (const Light* light : lights_)
+            {
+                // TODO: distant/infinite light's power may overwhelm
+                light_indices_.emplace(light, static_cast<int>(weights.size()));
+                weights.push_back(light->Power().Length());
+            }
+
+            distribution_.Reset(weights.data(), weights.data() + weights.size());
+        }
+
+        const Light* Sample(const Vec3f& p, const Vec3f& n, float u,
+                            float& pmf_out) const override
+        {
+            if (lights_.empty())
+            {
+                pmf_out = 0;
+                return nullptr;
+            }
+
+            return lights_[distribution_.Sample(u, pmf_out)];
+        }
+
+        float Pmf(const Vec3f& p, const Vec3f& n, const Light* light) const override
+        {
+            auto it = light_indices_.find(light);
+            return it != light_indices_.end() ? distribution_.Pmf(it->second) : 0.f;
+        }
+    };
+} // namespace usami::ray
@@ -13,6 +13,7 @@ namespace usami::ray
     {
         static_cast<float (T::*)() const>(&T::Area);
         static_cast<BoundingBox (T::*)() const>(&T::Bounding);
+        static_cast<DirectionCone (T::*)() const>(&T::NormalBounds);
         // static_cast<bool (T::*)(const Ray&, float, float, float*, Vec3f*, Vec3f*, Vec2f*) const>(
         //     &T::IntersectTest<true>);
         // static_cast<bool (T::*)(const Ray&, float, float, float*, Vec3f*, Vec3f*, Vec2f*) const>(
@@ -53,6 +54,9 @@ namespace usami::ray
         /**
          * Test intersection from a given ray without need for intersection info
          *
+         * NOTE it may stop at any hit in (t_min, t_max) instead of the closest one, which is all
+         * an occlusion test needs
+         *
          * @return true if an intersection is detected, false otherwise
          */
         virtual bool Intersect(const Ray& ray, float t_min, float t_max, Workspace& ws,
@@ -106,6 +110,15 @@ namespace usami::ray
          */
         virtual BoundingBox Bounding() const = 0;
 
+        /**
+         * Bounds of normals of the primitive's surface, towards which an area light on it emits.
+         * All directions are bounded by default.
+         */
+        virtual DirectionCone NormalBounds() const
+        {
+            return DirectionCone::EntireSphere();
+        }
+
         /**
          * Sample a point on the primitive's surface from a unit sample
          */
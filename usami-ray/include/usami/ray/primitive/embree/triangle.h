@@ -35,6 +35,11 @@ namespace usami::ray
             return BoundingBox{Min(v0_, Min(v1, v2)), Max(v0_, Max(v1, v2))};
         }
 
+        DirectionCone NormalBounds() const override
+        {
+            return DirectionCone{Cross(e1_, e2_).Normalize(), 1.f};
+        }
+
         bool Intersect(const Ray& ray, float t_min, float t_max, Workspace& ws,
                        IntersectionInfo& info) const override
         {
@@ -39,6 +39,17 @@ namespace usami::ray
             return geometry_.Bounding();
         }
 
+        DirectionCone NormalBounds() const override
+        {
+            DirectionCone cone = geometry_.NormalBounds();
+            if (reverse_orientation_)
+            {
+                cone.w = -cone.w;
+            }
+
+            return cone;
+        }
+
         bool Intersect(const Ray& ray, float t_min, float t_max, Workspace& ws,
                        IntersectionInfo& isect) const override
         {
@@ -3,7 +3,7 @@
 #include "usami/math/math.h"
 #include "usami/ray/ray.h"
 #include "usami/ray/primitive.h"
-#include "usami/ray/composite/bvh.h"
+#include "usami/ray/composite/lazy_bvh.h"
 #include "usami/ray/material/diffuse.h"
 
 namespace usami::ray
@@ -20,21 +20,86 @@ namespace usami::ray
     public:
     };
 
+    /**
+     * An instance of a mesh placed in the world
+     *
+     * The bvh of the mesh is built in model space and shared by all instances of the same mesh,
+     * see `IntegratedScene`, so an instance only costs its transform. It may be built lazily by
+     * the first ray reaching any of the instances.
+     */
     class MeshPrimitive : public Primitive
     {
     private:
-        SceneMesh* mesh_;
+        const SceneMesh* mesh_;
 
-        MeshBvhComposite bvh_;
+        const LazyMeshBvh* bvh_ = nullptr;
 
         Matrix4 model_to_world_;
         Matrix4 world_to_model_;
 
+        // transforms normal vectors from model space to world space
+        Matrix4 normal_to_world_;
+
+        // bounds of the transformed mesh, available after the bvh is bound. They don't need the
+        // bvh to be built.
+        BoundingBox world_bbox_ = Vec3f{};
+
     public:
-        MeshPrimitive(SceneMesh* mesh, Matrix4 model_to_world)
-            : mesh_(mesh), bvh_(MeshBvhComposite::PrimitiveCollectionType{mesh}),
-              model_to_world_(model_to_world), world_to_model_(model_to_world.Inverse())
+        MeshPrimitive(const SceneMesh* mesh, Matrix4 model_to_world)
+            : mesh_(mesh), model_to_world_(model_to_world),
+              world_to_model_(model_to_world.Inverse()),
+              normal_to_world_(world_to_model_.Transpose())
+        {
+        }
+
+        const SceneMesh* Mesh() const noexcept
         {
+            return mesh_;
+        }
+
+        /**
+         * Bind the bvh of the mesh, which must be done before any query
+         */
+        void BindBvh(const LazyMeshBvh* bvh)
+        {
+            USAMI_REQUIRE(bvh != nullptr);
+            bvh_ = bvh;
+
+            UpdateWorldBounds();
+        }
+
+        /**
+         * Move the instance, where the scene should be refit before any query
+         */
+        void SetTransform(const Matrix4& model_to_world)
+        {
+            model_to_world_  = model_to_world;
+            world_to_model_  = model_to_world.Inverse();
+            normal_to_world_ = world_to_model_.Transpose();
+
+            if (bvh_ != nullptr)
+            {
+                UpdateWorldBounds();
+            }
+        }
+
+        /**
+         * Recompute bounds of the transformed mesh after the bvh is changed
+         */
+        void UpdateWorldBounds()
+        {
+            // bound all corners of the box in model space
+            BoundingBox bbox_model = bvh_->Bounding();
+            for (int i = 0; i < 8; ++i)
+            {
+                Vec3f corner{(i & 1) ? bbox_model.p_max[0] : bbox_model.p_min[0],
+                             (i & 2) ? bbox_model.p_max[1] : bbox_model.p_min[1],
+                             (i & 4) ? bbox_model.p_max[2] : bbox_model.p_min[2]};
+
+                Vec3f corner_world = model_to_world_.ApplyPoint(corner);
+                world_bbox_        = i == 0 ? BoundingBox{corner_world}
+                                            : UnionBBox(world_bbox_, BoundingBox{corner_world});
+            }
         }
 
         float Area() const override
@@ -42,22 +107,29 @@ namespace usami::ray
             USAMI_NO_IMPL();
         }
 
-        BoundingBox Bounding() const
+        /**
+         * Bounds in world space
+         */
+        BoundingBox Bounding() const override
         {
-            return bvh_.Bounding();
+            USAMI_ASSERT(bvh_ != nullptr);
+            return world_bbox_;
         }
 
         bool Intersect(const Ray& ray, float t_min, float t_max, Workspace& ws,
                        IntersectionInfo& isect_out) const override
         {
-            Ray ray_model{world_to_model_.ApplyPoint(ray.o),
-                          world_to_model_.ApplyVector(ray.d).Normalize()};
+            // transform the ray only if it reaches the mesh
+            if (!world_bbox_.IntersectSlab(ray.o, 1.f / ray.d, t_min, t_max))
+            {
+                return false;
+            }
 
-            bool success = bvh_.Intersect(ray_model, t_min, t_max, ws, isect_out);
+            bool success = bvh_->Intersect(ToModelSpace(ray), t_min, t_max, ws, isect_out);
             if (success)
             {
                 isect_out.point = ray.o + isect_out.t * ray.d;
-                isect_out.ng    = model_to_world_.ApplyVector(isect_out.ng).Normalize();
+                isect_out.ng    = normal_to_world_.ApplyVector(isect_out.ng).Normalize();
                 isect_out.ns    = isect_out.ng;
 
                 static shared_ptr<Material> mat_sphere =
@@ -69,10 +141,34 @@ namespace usami::ray
             return success;
         }
 
+        bool Intersect(const Ray& ray, float t_min, float t_max, Workspace& ws,
+                       OcclusionInfo& occ_out) const override
+        {
+            if (!world_bbox_.IntersectSlab(ray.o, 1.f / ray.d, t_min, t_max))
+            {
+                return false;
+            }
+
+            if (bvh_->Intersect(ToModelSpace(ray), t_min, t_max, ws, occ_out))
+            {
+                occ_out.primitive = this;
+                return true;
+            }
+
+            return false;
+        }
+
         void SamplePoint(const Point2f& u, Vec3f& p_out, Vec3f& n_out,
                          float& pdf_out) const override
         {
             USAMI_NO_IMPL();
         }
+
+    private:
+        // NOTE direction is not normalized, so that a hit has the same distance in both spaces
+        Ray ToModelSpace(const Ray& ray) const noexcept
+        {
+            return Ray{world_to_model_.ApplyPoint(ray.o), world_to_model_.ApplyVector(ray.d)};
+        }
     };
 } // namespace usami::ray
@@ -0,0 +1,116 @@
+#pragma once
+#include "usami/ray/ray.h"
+#include "usami/ray/primitive.h"
+#include "usami/ray/composite/shape_collection.h"
+
+namespace usami::ray
+{
+    /**
+     * A large group of analytic shapes of the same type sharing a material, e.g. particles
+     * rendered as spheres
+     *
+     * Shapes are kept by value in its own bvh, whose leaves test them in SIMD batches, instead of
+     * as a `GeometricPrimitive` each. So a shape costs neither a virtual call nor an allocation,
+     * and the top level bvh sees the whole group as a single primitive.
+     */
+    template <GeometricShape Shape>
+    class ShapeGroupPrimitive : public Primitive
+    {
+    private:
+        // total area of shapes
+        float area_;
+
+        ShapeBvhComposite<Shape> bvh_;
+        bool reverse_orientation_;
+
+        shared_ptr<Material> material_ = nullptr;
+
+    public:
+        ShapeGroupPrimitive(std::vector<Shape> shapes, bool reverse_orientation = false,
+                            BvhBuildSetting setting = {})
+            : area_(TotalArea(shapes)),
+              bvh_(ShapePrimitiveCollection<Shape>{std::move(shapes)}, setting),
+              reverse_orientation_(reverse_orientation)
+        {
+        }
+
+        Material* GetMaterial() const noexcept
+        {
+            return material_.get();
+        }
+
+        /**
+         * Memory used by shapes and their bvh, in bytes
+         */
+        size_t ByteSize() const noexcept
+        {
+            return bvh_.ByteSize();
+        }
+
+        float Area() const override
+        {
+            return area_;
+        }
+
+        BoundingBox Bounding() const override
+        {
+            return bvh_.Bounding();
+        }
+
+        bool Intersect(const Ray& ray, float t_min, float t_max, Workspace& ws,
+                       IntersectionInfo& isect) const override
+        {
+            bool hit = bvh_.Intersect(ray, t_min, t_max, ws, isect);
+            if (hit)
+            {
+                if (reverse_orientation_)
+                {
+                    isect.ng = -isect.ng;
+                    isect.uv = 1.f - isect.uv;
+                }
+
+                isect.ns         = isect.ng;
+                isect.primitive  = this;
+                isect.area_light = nullptr;
+                isect.material   = GetMaterial();
+            }
+
+            return hit;
+        }
+
+        bool Intersect(const Ray& ray, float t_min, float t_max, Workspace& ws,
+                       OcclusionInfo& occ_out) const override
+        {
+            if (bvh_.Intersect(ray, t_min, t_max, ws, occ_out))
+            {
+                occ_out.primitive = this;
+                return true;
+            }
+
+            return false;
+        }
+
+        void SamplePoint(const Point2f& u, Vec3f& p_out, Vec3f& n_out,
+                         float& pdf_out) const override
+        {
+            USAMI_NO_IMPL();
+        }
+
+        void BindMaterial(shared_ptr<Material> mat)
+        {
+            material_ = std::move(mat);
+        }
+
+    private:
+        static float TotalArea(const std::vector<Shape>& shapes)
+        {
+            float result = 0.f;
+            for (const Shape& shape : shapes)
+            {
+                result += shape.Area();
+            }
+
+            return result;
+        }
+    };
+} // namespace usami::ray
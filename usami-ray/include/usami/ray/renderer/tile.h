@@ -0,0 +1,65 @@
+#pragma once
+#include "usami/sampler.h"
+#include "usami/ray/camera.h"
+#include "usami/ray/canvas.h"
+#include "usami/ray/integrator.h"
+#include "usami/ray/scene.h"
+
+namespace usami::ray
+{
+    struct TileRenderSetting
+    {
+        // width and height of a square tile, in pixels
+        int tile_size = 16;
+
+        // number of samples taken for each pixel
+        int num_sample = 16;
+
+        // base seed from which samplers of every pixel are derived
+        uint64_t seed = 0xdeadbeef;
+    };
+
+    /**
+     * A render driver that splits the canvas into tiles and renders them on the global thread pool.
+     *
+     * Each worker owns its `RenderingContext`, and each pixel owns a `Sampler` seeded from its
+     * coordinate. As every tile is written by exactly one worker, radiance is accumulated into
+     * the canvas without locks and the image is identical regardless of the thread count.
+     */
+    class TileRenderer
+    {
+    private:
+        TileRenderSetting setting_;
+
+    public:
+        TileRenderer(TileRenderSetting setting = {});
+
+        const TileRenderSetting& Setting() const noexcept
+        {
+            return setting_;
+        }
+
+        /**
+         * Render the scene, appending the sum of all samples of a pixel into the canvas
+         *
+         * NOTE scale the canvas by `1 / num_sample` to get the estimated radiance
+         */
+        void Render(Canvas& canvas, const PerspectiveCamera& camera, const Scene& scene,
+                    const Integrator& integrator) const;
+
+    private:
+        struct Tile
+        {
+            int x_begin;
+            int y_begin;
+            int x_end;
+            int y_end;
+        };
+
+        Tile GetTile(const Canvas& canvas, int index) const noexcept;
+
+        void RenderTile(RenderingContext& ctx, Canvas& canvas, const Tile& tile,
+                        const PerspectiveCamera& camera, const Scene& scene,
+                        const Integrator& integrator) const;
+    };
+} // namespace usami::ray
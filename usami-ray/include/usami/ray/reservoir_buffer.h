@@ -0,0 +1,142 @@
+#pragma once
+#include "usami/common.h"
+#include "usami/ray/ray.h"
+#include "usami/ray/light.h"
+#include <vector>
+
+namespace usami::ray
+{
+    /**
+     * Reservoir of weighted reservoir sampling over light samples, see ReSTIR (Bitterli et al.
+     * 2020)
+     *
+     * A light sample is identified by the light and the unit sample passed to `Light::Sample`, so
+     * that it may be evaluated again at another shading point when the reservoir is reused.
+     */
+    struct LightReservoir
+    {
+        // picked light, or nullptr if no candidate is picked
+        const Light* light = nullptr;
+
+        // unit sample from which `light` generates the picked sample
+        Point2f u = {0.f, 0.f};
+
+        // target function of the picked sample at the shading point of the reservoir
+        float target = 0.f;
+
+        // sum of resampling weights of all candidates
+        float weight_sum = 0.f;
+
+        // number of candidates the reservoir has seen, which may be fractional after clamped
+        float num_candidate = 0.f;
+
+        // unbiased contribution weight of the picked sample, i.e. estimate of its inverse pdf
+        float contrib_weight = 0.f;
+
+        /**
+         * Stream in a candidate standing for `num_candidate` candidates, which replaces the picked
+         * one with probability of `weight / weight_sum` decided by a unit random number `r`
+         *
+         * @return if the candidate is picked
+         */
+        bool Update(const Light* candidate_light, const Point2f& candidate_u,
+                    float candidate_target, float weight, float r, float num_candidate = 1.f)
+        {
+            this->weight_sum += weight;
+            this->num_candidate += num_candidate;
+
+            if (weight > 0 && r * this->weight_sum < weight)
+            {
+                light  = candidate_light;
+                u      = candidate_u;
+                target = candidate_target;
+                return true;
+            }
+
+            return false;
+        }
+    };
+
+    /**
+     * Per-pixel light reservoirs kept beside a `Canvas`, so that light samples are reused across
+     * neighbouring pixels and across frames
+     *
+     * A pixel keeps the reservoir of the current frame, and the history left by the previous one,
+     * each with the surface seen through the pixel for which it was resampled.
+     */
+    class ReservoirBuffer
+    {
+    public:
+        struct Entry
+        {
+            // first surface hit through the pixel, whose material is nullptr if the pixel doesn't
+            // sample direct lighting, e.g. it sees the background or a specular surface
+            IntersectionInfo isect;
+
+            // direction towards the camera
+            Vec3f wo;
+
+            LightReservoir reservoir;
+
+            bool Valid() const noexcept
+            {
+                return isect.material != nullptr;
+            }
+        };
+
+    private:
+        int width_;
+        int height_;
+
+        std::vector<Entry> current_;
+        std::vector<Entry> history_;
+
+    public:
+        ReservoirBuffer(int width, int height)
+            : width_(width), height_(height), current_(static_cast<size_t>(width) * height),
+              history_(static_cast<size_t>(width) * height)
+        {
+            USAMI_ASSERT(width > 0 && height > 0);
+        }
+
+        int Width() const noexcept
+        {
+            return width_;
+        }
+        int Height() const noexcept
+        {
+            return height_;
+        }
+
+        /**
+         * Forget the history, e.g. when the scene changes
+         */
+        void Clear()
+        {
+            std::fill(history_.begin(), history_.end(), Entry{});
+        }
+
+        Entry& Current(int x, int y)
+        {
+            return current_[static_cast<size_t>(y) * width_ + x];
+        }
+        const Entry& Current(int x, int y) const
+        {
+            return current_[static_cast<size_t>(y) * width_ + x];
+        }
+
+        Entry& History(int x, int y)
+        {
+            return history_[static_cast<size_t>(y) * width_ + x];
+        }
+        const Entry& History(int x, int y) const
+        {
+            return history_[static_cast<size_t>(y) * width_ + x];
+        }
+
+        size_t ByteSize() const noexcept
+        {
+            return (current_.capacity() + history_.capacity()) * sizeof(Entry);
+        }
+    };
+} // namespace usami::ray
@@ -1,9 +1,12 @@
 #pragma once
 #include "usami/common.h"
 #include "usami/memory/arena.h"
-#include "usami/math/distribution.h"
+#include "usami/ray/hit_buffer.h"
 #include "usami/ray/light.h"
 #include "usami/ray/light/infinite.h"
+#include "usami/ray/light_sampler/bvh.h"
+#include "usami/ray/light_sampler/power.h"
+#include <span>
 
 namespace usami::ray
 {
@@ -16,7 +19,12 @@ namespace usami::ray
         const InfiniteAreaLight* global_light_ = nullptr;
 
         std::vector<const Light*> lights_;
-        DiscrateDistribution light_distribution_;
+
+        // distribution over `lights_` by their power
+        PowerLightSampler light_distribution_;
+
+        // hierarchy over `lights_` picking lights by their importance to a shading point
+        BvhLightSampler light_bvh_;
 
     public:
         const auto& GlobalLight() const noexcept
@@ -29,6 +37,22 @@ namespace usami::ray
             return lights_;
         }
 
+        /**
+         * Light sampler over `Lights()` picking lights by their power, which is built on commit
+         */
+        const LightSampler& LightDistribution() const noexcept
+        {
+            return light_distribution_;
+        }
+
+        /**
+         * Light sampler over `Lights()`, which is built on commit
+         */
+        const LightSampler& LightBvh() const noexcept
+        {
+            return light_bvh_;
+        }
+
         virtual void Commit()
         {
             UpdateLightDistribution();
@@ -43,19 +67,39 @@ namespace usami::ray
             return Intersect(ray, workspace, isect);
         }
 
+        /**
+         * Test if the ray hits anything before travelling `t_max`, which stops at the first hit
+         * found instead of searching for the closest one
+         */
+        virtual bool Occluded(const Ray& ray, float t_max, Workspace& workspace) const
+        {
+            IntersectionInfo isect;
+            return IntersectQuick(ray, workspace, isect) && isect.t < t_max;
+        }
+
+        /**
+         * Find closest hits of a batch of rays, writing the i-th result into `hits` at index i
+         *
+         * NOTE `workspace` is used as scratch memory and may be cleared during the call
+         */
+        virtual void IntersectBatch(std::span<const Ray> rays, RayCoherence coherence,
+                                    Workspace& workspace, HitBuffer& hits) const;
+
+        /**
+         * Test if a batch of rays hit anything before travelling `t_max[i]`, writing the i-th
+         * result into `occluded_out[i]`
+         *
+         * NOTE `workspace` is used as scratch memory and may be cleared during the call
+         */
+        virtual void OccludedBatch(std::span<const Ray> rays, std::span<const float> t_max,
+                                   RayCoherence coherence, Workspace& workspace,
+                                   std::span<uint8_t> occluded_out) const;
+
     protected:
         void UpdateLightDistribution()
         {
-            float total_power = 0.f;
-            std::vector<float> power_weights;
-            for (const Light* light : lights_)
-            {
-                // TODO: distant/infinite light's power may overwhelm
-                power_weights.push_back(light->Power().Length());
-            }
-
-            light_distribution_.Reset(power_weights.data(),
-                                      power_weights.data() + power_weights.size());
+            light_distribution_.Reset(lights_);
+            light_bvh_.Reset(lights_);
         }
 
         void SetGlobalLightSource(const InfiniteAreaLight* light)
@@ -4,6 +4,7 @@
 #include "usami/ray/scene.h"
 #include "usami/ray/primitive/embree/triangle.h"
 #include <embree3/rtcore.h>
+#include <span>
 
 namespace usami::ray
 {
@@ -14,11 +15,18 @@ namespace usami::ray
 
         const SceneMesh* mesh_;
 
+        // embree scene of the mesh, which is instanced by this geometry
+        RTCScene instanced_scene_;
+
         Matrix4 model_to_world_;
+        Matrix4 normal_to_world_;
 
         const Material* material                  = nullptr;
         std::vector<const AreaLight*> area_lights = {};
 
+        // world space triangles behind `area_lights`, which are rebuilt when the geometry moves
+        std::vector<EmbreeTriangle*> light_primitives = {};
+
         friend class EmbreeScene;
 
     public:
@@ -38,6 +46,12 @@ namespace usami::ray
             return model_to_world_;
         }
 
+        // model to world transformation of normal vectors
+        const Matrix4& NormalTransform() const noexcept
+        {
+            return normal_to_world_;
+        }
+
         bool ContainAreaLight() const noexcept
         {
             return !area_lights.empty();
@@ -67,6 +81,12 @@ namespace usami::ray
 
         std::unordered_map<const SceneMesh*, RTCScene> mesh_instance_cache;
 
+        // cost estimation of each mesh when its bvh is last built, see `EmbreeScene::Refit`
+        std::unordered_map<const SceneMesh*, float> mesh_build_cost;
+
+        // number of times each mesh is refit since its bvh is last built
+        std::unordered_map<const SceneMesh*, int> mesh_refit_count;
+
         std::unordered_map<const SceneMaterial*, Material*> material_cache;
     };
 
@@ -79,15 +99,82 @@ namespace usami::ray
         std::vector<EmbreeRegisteredModel> models_;
         std::vector<EmbreeMeshGeometry*> geom_lookup_;
 
+        // if the scene could be updated by `Refit` after commit
+        bool dynamic_;
+
+        // number of rays in a packet of coherent batch queries, i.e. 4, 8 or 16
+        size_t packet_size_ = 8;
+
+        // `Refit` rebuilds bvhs whose cost estimation grows past this ratio
+        static constexpr float kMaxRefitCostRatio = 1.5f;
+
+        // `Refit` rebuilds mesh bvhs after being refit this many times in a row
+        static constexpr int kMaxRefitCount = 32;
+
+        // cost estimation of instances when the scene is last built, see `Refit`
+        float build_cost_ = 0;
+
+        // if any emissive geometry moved since light distribution is last built
+        bool lights_moved_ = false;
+
     public:
-        EmbreeScene();
+        /**
+         * A dynamic scene builds bvhs with `RTC_SCENE_FLAG_DYNAMIC`, so that meshes could be
+         * refit in place by `Refit` at the cost of slightly slower traversal
+         */
+        EmbreeScene(bool dynamic = false);
         ~EmbreeScene();
 
         void Commit() override;
 
+        /**
+         * Instances added to the scene, indexed by their geometry id
+         */
+        const auto& Geometries() const noexcept
+        {
+            return geom_lookup_;
+        }
+
+        /**
+         * Update a committed dynamic scene after instances are moved by `SetTransform`, or
+         * vertices of `deformed_meshes` are changed in place
+         *
+         * Meshes are refit with `RTC_BUILD_QUALITY_REFIT`, and instances are rebuilt with low
+         * quality. Either is rebuilt with high quality instead when its cost estimation has grown
+         * past `kMaxRefitCostRatio` times the cost when it's last built. Light distribution is
+         * rebuilt as well if any emissive mesh has moved or deformed.
+         *
+         * NOTE the cost of a mesh is only a proxy of vertex deformation, i.e. the sum of surface
+         * area of triangle bounds over that of the mesh, which grows as triangles stretch but
+         * tells nothing about how much embree's refit hierarchy has degraded. So a mesh is also
+         * rebuilt after `kMaxRefitCount` refits in a row. The cost of instances is measured in
+         * world space and so follows rigid transforms.
+         */
+        void Refit(std::span<const SceneMesh* const> deformed_meshes = {});
+
+        /**
+         * Move an instance, including area lights on it, which takes effect on the next `Refit`
+         */
+        void SetTransform(int geom_id, const Matrix4& model_to_world);
+
         bool Intersect(const Ray& ray, Workspace& workspace,
                        IntersectionInfo& isect) const override;
 
+        bool Occluded(const Ray& ray, float t_max, Workspace& workspace) const override;
+
+        /**
+         * Coherent rays are traced as packets as wide as the isa of embree supports natively, and
+         * incoherent ones as streams of single rays
+         *
+         * NOTE no primitive is instantiated for hits of a batch
+         */
+        void IntersectBatch(std::span<const Ray> rays, RayCoherence coherence,
+                            Workspace& workspace, HitBuffer& hits) const override;
+
+        void OccludedBatch(std::span<const Ray> rays, std::span<const float> t_max,
+                           RayCoherence coherence, Workspace& workspace,
+                           std::span<uint8_t> occluded_out) const override;
+
         void AddModel(shared_ptr<SceneModel> model,
                       const Matrix4& model_to_world = Matrix4::Identity());
 
@@ -99,16 +186,26 @@ namespace usami::ray
         }
 
     private:
+        // sum of surface area of instance bounds over that of the scene
+        float ComputeInstanceCost() const;
+
         void AddSceneNode(const SceneNode* node, const Matrix4& parent_transform,
                           const EmbreeRegisteredModel& registry);
         void AddMeshGeometry(const SceneMesh* mesh, const Matrix4& model_to_world,
                              const EmbreeRegisteredModel& registry);
 
+        // rebuild world space triangles of area lights of the geometry after it moves
+        void UpdateLightPrimitives(EmbreeMeshGeometry& geometry);
+
         void RegisterMeshGeometry(const EmbreeMeshGeometry& geometry,
                                   const Matrix4& model_to_world);
 
-        Primitive* InstantiatePrimitive(unsigned geom_id, unsigned prim_id,
-                                        const TriangleDesc& tri_desc);
+        // fill intersection info of a hit reported by embree, except the primitive
+        void ResolveHit(const Ray& ray, float t, Vec3f ng, float u, float v, unsigned geom_id,
+                        unsigned prim_id, IntersectionInfo& isect) const;
+
+        EmbreeTriangle* InstantiatePrimitive(unsigned geom_id, unsigned prim_id,
+                                             const TriangleDesc& tri_desc);
         Primitive* InstantiateTemporaryPrimitive(Workspace& workspace, unsigned geom_id,
                                                  unsigned prim_id,
                                                  const TriangleDesc& tri_desc) const;
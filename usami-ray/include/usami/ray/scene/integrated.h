@@ -1,11 +1,15 @@
 #pragma once
 #include "usami/ray/scene.h"
+#include "usami/parallel/parallel_for.h"
 
 #include "usami/ray/primitive.h"
 #include "usami/ray/primitive/geometric.h"
 #include "usami/ray/primitive/mesh.h"
+#include "usami/ray/primitive/shape_group.h"
 #include "usami/ray/composite/naive.h"
 #include "usami/ray/composite/bvh.h"
+#include "usami/ray/composite/bvh_cache.h"
+#include "usami/ray/composite/lazy_bvh.h"
 
 #include "usami/ray/light.h"
 #include "usami/ray/light/point.h"
@@ -22,21 +26,145 @@ namespace usami::ray
         Arena arena_;
 
         std::vector<Primitive*> prims_;
+        std::vector<MeshPrimitive*> mesh_prims_;
 
-        IntersectableEntity* world_;
+        // setting of both bvhs of meshes and the top level one
+        BvhBuildSetting bvh_setting_ = {};
+
+        // if bvhs of meshes are built by the first ray reaching them instead of by commit
+        bool lazy_mesh_bvh_ = false;
+
+        // node layout of bvhs of meshes
+        MeshBvhLayout mesh_bvh_layout_ = MeshBvhLayout::Binary;
+
+        // on-disk cache of mesh bvhs across runs, if enabled
+        unique_ptr<MeshBvhCache> mesh_bvh_file_cache_ = nullptr;
+
+        // bvh of each mesh in model space, shared by all of its instances
+        std::unordered_map<const SceneMesh*, unique_ptr<LazyMeshBvh>> mesh_bvh_cache_;
+
+        // if `mesh_bvh_cache_` is built by an outdated setting, which is only dropped by the next
+        // commit as committed instances still refer to it
+        bool mesh_bvh_stale_ = false;
+
+        IntersectableEntity* world_ = nullptr;
+
+        // top level bvh in `world_`, if there is any primitive
+        BvhComposite* world_bvh_ = nullptr;
 
     public:
+        /**
+         * Choose how bvhs are built, e.g. `BvhBuildAlgorithm::Linear` for previews that should
+         * start as soon as possible. It takes effect on the next commit.
+         */
+        void SetBvhBuildSetting(const BvhBuildSetting& setting)
+        {
+            bvh_setting_    = setting;
+            mesh_bvh_stale_ = true;
+        }
+
+        /**
+         * Build the top level bvh from bounds of meshes only, and the bvh of each mesh the first
+         * time a ray reaches it, so that rendering a small part of a huge scene starts quickly
+         * and geometry never reached costs no build. It takes effect on the next commit.
+         */
+        void SetLazyMeshBvh(bool lazy)
+        {
+            lazy_mesh_bvh_  = lazy;
+            mesh_bvh_stale_ = true;
+        }
+
+        /**
+         * Choose node layout of bvhs of meshes, e.g. `MeshBvhLayout::Wide` to test children of
+         * nodes in SIMD batches. It takes effect on the next commit.
+         */
+        void SetMeshBvhLayout(MeshBvhLayout layout)
+        {
+            mesh_bvh_layout_ = layout;
+            mesh_bvh_stale_  = true;
+        }
+
+        /**
+         * Load bvhs of meshes from files in `directory` if they are built by an earlier run, and
+         * store those built into the directory
+         */
+        void SetBvhCacheDirectory(std::filesystem::path directory)
+        {
+            mesh_bvh_file_cache_ = make_unique<MeshBvhCache>(std::move(directory));
+        }
+
         void Commit() override
         {
-            // auto world =
-            //     arena_.Construct<BvhComposite>(BvhComposite::PrimitiveCollectionType{prims_});
-            auto world = arena_.Construct<NaiveComposite>();
-            for (auto prim : prims_)
+            // NOTE every instance is rebound below, so none refers to the dropped bvhs
+            if (mesh_bvh_stale_)
+            {
+                mesh_bvh_cache_.clear();
+                mesh_bvh_stale_ = false;
+            }
+
+            // build bvh of each mesh once, no matter how many instances it has. Meshes are
+            // independent, each of which builds its bvh in parallel as well.
+            std::vector<std::pair<const SceneMesh*, unique_ptr<LazyMeshBvh>*>> pending;
+            for (MeshPrimitive* prim : mesh_prims_)
+            {
+                auto [it, inserted] = mesh_bvh_cache_.try_emplace(prim->Mesh(), nullptr);
+                if (inserted)
+                {
+                    pending.emplace_back(prim->Mesh(), &it->second);
+                }
+            }
+
+            ParallelFor(0, pending.size(), 1, [&](size_t i) {
+                auto [mesh, bvh] = pending[i];
+                *bvh = make_unique<LazyMeshBvh>(mesh, bvh_setting_, mesh_bvh_layout_,
+                                                mesh_bvh_file_cache_.get(), lazy_mesh_bvh_);
+            });
+
+            for (MeshPrimitive* prim : mesh_prims_)
+            {
+                prim->BindBvh(mesh_bvh_cache_.at(prim->Mesh()).get());
+            }
+
+            // top level bvh over all primitives, where each mesh is an instance with its own bvh
+            if (!prims_.empty())
+            {
+                world_bvh_ = arena_.Construct<BvhComposite>(
+                    BvhComposite::PrimitiveCollectionType{prims_}, bvh_setting_);
+                world_ = world_bvh_;
+            }
+            else
+            {
+                world_bvh_ = nullptr;
+                world_     = arena_.Construct<NaiveComposite>();
+            }
+
+            Scene::Commit();
+        }
+
+        /**
+         * Update bvhs of a committed scene after instances are moved by
+         * `MeshPrimitive::SetTransform`, or vertices of `deformed_meshes` are changed in place.
+         * It's much cheaper than a commit as long as no primitive is added.
+         */
+        void Refit(std::span<const SceneMesh* const> deformed_meshes = {})
+        {
+            USAMI_REQUIRE(world_ != nullptr);
+
+            ParallelFor(0, deformed_meshes.size(), 1, [&](size_t i) {
+                mesh_bvh_cache_.at(deformed_meshes[i])->Refit();
+            });
+
+            if (!deformed_meshes.empty())
             {
-                world->AddPrimitive(prim);
+                ParallelFor(0, mesh_prims_.size(), [&](size_t i) {
+                    mesh_prims_[i]->UpdateWorldBounds();
+                });
             }
 
-            world_ = world;
+            if (world_bvh_ != nullptr)
+            {
+                world_bvh_->Refit();
+            }
         }
 
         bool Intersect(const Ray& ray, Workspace& workspace,
@@ -46,6 +174,12 @@ namespace usami::ray
                                      isect_out);
         }
 
+        bool Occluded(const Ray& ray, float t_max, Workspace& workspace) const override
+        {
+            OcclusionInfo occ;
+            return world_->Intersect(ray, kTravelDistanceMin, t_max, workspace, occ);
+        }
+
         // primitive factory
         //
         template <typename ShapeType>
@@ -59,13 +193,30 @@ namespace usami::ray
             primitive->SetName("ground");
             prims_.push_back(primitive);
         }
-        void AddMeshPrimitive(SceneMesh* mesh, shared_ptr<Material> mat,
-                              const Matrix4& model_to_world)
+        MeshPrimitive* AddMeshPrimitive(const SceneMesh* mesh, shared_ptr<Material> mat,
+                                        const Matrix4& model_to_world)
         {
             auto primitive = arena_.Construct<MeshPrimitive>(mesh, model_to_world);
 
             primitive->SetName("mesh");
             prims_.push_back(primitive);
+            mesh_prims_.push_back(primitive);
+            return primitive;
+        }
+        /**
+         * Add many shapes of the same type sharing a material, e.g. particles, which are
+         * intersected in SIMD batches by a bvh of their own. Its bvh is built right away.
+         */
+        template <GeometricShape ShapeType>
+        void AddShapeGroup(std::vector<ShapeType> shapes, shared_ptr<Material> mat,
+                           bool reverse_orientation = false)
+        {
+            auto primitive = arena_.Construct<ShapeGroupPrimitive<ShapeType>>(
+                std::move(shapes), reverse_orientation, bvh_setting_);
+            primitive->BindMaterial(move(mat));
+
+            primitive->SetName("shape-group");
+            prims_.push_back(primitive);
         }
         template <GeometricShape ShapeType>
         void AddGeometricLight(ShapeType shape, SpectrumRGB intensity, bool reverse_orientation)
@@ -0,0 +1,333 @@
+#pragma once
+#include "usami/math/math.h"
+#include "usami/ray/ray.h"
+#include "usami/ray/shape/disk.h"
+#include "usami/ray/shape/rect.h"
+#include "usami/ray/shape/sphere.h"
+#include "xsimd/xsimd.hpp"
+#include <vector>
+
+namespace usami::ray::shape
+{
+    namespace detail
+    {
+        // relative error by which batch tests err on the side of a hit, as rounding of SIMD
+        // arithmetic differs from that of scalar one, e.g. by fused multiply-add
+        constexpr float kBatchTestTolerance = 1e-5f;
+
+        /**
+         * Float fields of shapes in SoA layout, one array per field
+         *
+         * NOTE arrays are padded by a batch so that a batch could be loaded from any shape
+         */
+        template <int NumField, int Width>
+        class SoAFields
+        {
+        private:
+            size_t size_ = 0;
+            std::vector<float> fields_[NumField];
+
+        public:
+            size_t Size() const noexcept
+            {
+                return size_;
+            }
+
+            void Resize(size_t size)
+            {
+                size_ = size;
+                for (std::vector<float>& field : fields_)
+                {
+                    field.resize(size + Width - 1, 0.f);
+                }
+            }
+
+            void Set(size_t i, int ifield, float value) noexcept
+            {
+                USAMI_ASSERT(i < size_);
+                fields_[ifield][i] = value;
+            }
+
+            xsimd::batch<float, Width> Load(size_t offset, int ifield) const noexcept
+            {
+                xsimd::batch<float, Width> result;
+                result.load_unaligned(fields_[ifield].data() + offset);
+                return result;
+            }
+
+            size_t ByteSize() const noexcept
+            {
+                return NumField * fields_[0].capacity() * sizeof(float);
+            }
+        };
+
+        /**
+         * Bit `i` of the result is set if the i-th lane isn't missed
+         */
+        template <int Width>
+        inline uint32_t ToHitMask(const xsimd::batch_bool<float, Width>& miss) noexcept
+        {
+            using BatchType = xsimd::batch<float, Width>;
+
+            alignas(sizeof(float) * Width) float miss_arr[Width];
+            xsimd::select(miss, BatchType{1.f}, BatchType{0.f}).store_aligned(miss_arr);
+
+            uint32_t hit_mask = 0;
+            for (int i = 0; i < Width; ++i)
+            {
+                hit_mask |= static_cast<uint32_t>(miss_arr[i] == 0.f) << i;
+            }
+
+            return hit_mask;
+        }
+    } // namespace detail
+
+    /**
+     * Spheres stored in SoA layout, so that consecutive ones are tested against a ray in a batch
+     */
+    template <int Width = kSimdFloatWidth>
+    class SphereSoA
+    {
+    private:
+        using BatchType = xsimd::batch<float, Width>;
+
+        // center and radius
+        detail::SoAFields<4, Width> fields_;
+
+    public:
+        static constexpr int kBatchSize = Width;
+
+        size_t Size() const noexcept
+        {
+            return fields_.Size();
+        }
+
+        void Resize(size_t size)
+        {
+            fields_.Resize(size);
+        }
+
+        void Set(size_t i, const Sphere& sphere) noexcept
+        {
+            for (int axis = 0; axis < 3; ++axis)
+            {
+                fields_.Set(i, axis, sphere.center[axis]);
+            }
+            fields_.Set(i, 3, sphere.radius);
+        }
+
+        size_t ByteSize() const noexcept
+        {
+            return fields_.ByteSize();
+        }
+
+        /**
+         * Test `Width` spheres starting from `offset` against a ray, like `Sphere::IntersectTest`
+         *
+         * @return mask of spheres that may be hit within [t_min, t_max], bit `i` for the i-th one.
+         *         It's a superset of those hit, so hits are confirmed by the scalar test.
+         */
+        uint32_t IntersectBatch(size_t offset, const Ray& ray, float t_min,
+                                float t_max) const noexcept
+        {
+            BatchType B[3], D[3];
+            BatchType r = fields_.Load(offset, 3);
+            for (int axis = 0; axis < 3; ++axis)
+            {
+                B[axis] = BatchType{ray.d[axis]};
+                D[axis] = BatchType{ray.o[axis]} - fields_.Load(offset, axis);
+            }
+
+            // a*t^2 + b*t + c = 0, where a is shared by all spheres
+            float a     = Dot(ray.d, ray.d);
+            BatchType b = BatchType{2.f} * (B[0] * D[0] + B[1] * D[1] + B[2] * D[2]);
+            BatchType c = D[0] * D[0] + D[1] * D[1] + D[2] * D[2] - r * r;
+
+            // widen the discriminant, which cancels badly for rays grazing a sphere
+            BatchType tolerance = BatchType{detail::kBatchTestTolerance} *
+                                  (b * b + xsimd::abs(BatchType{4 * a} * c));
+            BatchType delta_sq  = b * b - BatchType{4 * a} * c + tolerance;
+            BatchType delta     = xsimd::sqrt(xsimd::max(delta_sq, BatchType{0.f}));
+            BatchType t0        = (-b - delta) / BatchType{2 * a};
+            BatchType t1        = (-b + delta) / BatchType{2 * a};
+
+            // the scalar test takes the nearer root unless it's behind the origin
+            auto miss = (delta_sq < BatchType{0.f}) | (t1 < BatchType{0.f}) |
+                        (t1 < BatchType{t_min}) | (t0 > BatchType{t_max});
+
+            return detail::ToHitMask<Width>(miss);
+        }
+    };
+
+    /**
+     * Disks stored in SoA layout, see `SphereSoA`
+     */
+    template <int Width = kSimdFloatWidth>
+    class DiskSoA
+    {
+    private:
+        using BatchType = xsimd::batch<float, Width>;
+
+        // center and radius
+        detail::SoAFields<4, Width> fields_;
+
+    public:
+        static constexpr int kBatchSize = Width;
+
+        size_t Size() const noexcept
+        {
+            return fields_.Size();
+        }
+
+        void Resize(size_t size)
+        {
+            fields_.Resize(size);
+        }
+
+        void Set(size_t i, const Disk& disk) noexcept
+        {
+            for (int axis = 0; axis < 3; ++axis)
+            {
+                fields_.Set(i, axis, disk.center[axis]);
+            }
+            fields_.Set(i, 3, disk.radius);
+        }
+
+        size_t ByteSize() const noexcept
+        {
+            return fields_.ByteSize();
+        }
+
+        /**
+         * Test `Width` disks starting from `offset` against a ray, like `Disk::IntersectTest`
+         *
+         * @return mask of disks that may be hit, see `SphereSoA::IntersectBatch`
+         */
+        uint32_t IntersectBatch(size_t offset, const Ray& ray, float t_min,
+                                float t_max) const noexcept
+        {
+            if (ray.d.z == 0)
+            {
+                return 0;
+            }
+
+            BatchType r = fields_.Load(offset, 3);
+            BatchType t = (fields_.Load(offset, 2) - BatchType{ray.o.z}) / BatchType{ray.d.z};
+
+            BatchType dist_sq   = BatchType{0.f};
+            BatchType magnitude = BatchType{0.f};
+            for (int axis = 0; axis < 3; ++axis)
+            {
+                BatchType o     = BatchType{ray.o[axis]};
+                BatchType td    = t * BatchType{ray.d[axis]};
+                BatchType delta = o + td - fields_.Load(offset, axis);
+
+                dist_sq   = dist_sq + delta * delta;
+                magnitude = xsimd::max(magnitude, xsimd::abs(o) + xsimd::abs(td));
+            }
+
+            BatchType r_max = r + BatchType{detail::kBatchTestTolerance} * magnitude;
+
+            auto miss =
+                (t < BatchType{t_min}) | (t > BatchType{t_max}) | (dist_sq > r_max * r_max);
+
+            return detail::ToHitMask<Width>(miss);
+        }
+    };
+
+    /**
+     * Rectangles stored in SoA layout, see `SphereSoA`
+     */
+    template <int Width = kSimdFloatWidth>
+    class RectSoA
+    {
+    private:
+        using BatchType = xsimd::batch<float, Width>;
+
+        // corner of the least x and y, and lengths along x and y
+        detail::SoAFields<5, Width> fields_;
+
+    public:
+        static constexpr int kBatchSize = Width;
+
+        size_t Size() const noexcept
+        {
+            return fields_.Size();
+        }
+
+        void Resize(size_t size)
+        {
+            fields_.Resize(size);
+        }
+
+        void Set(size_t i, const Rect& rect) noexcept
+        {
+            for (int axis = 0; axis < 3; ++axis)
+            {
+                fields_.Set(i, axis, rect.p_minxy[axis]);
+            }
+            fields_.Set(i, 3, rect.len_x);
+            fields_.Set(i, 4, rect.len_y);
+        }
+
+        size_t ByteSize() const noexcept
+        {
+            return fields_.ByteSize();
+        }
+
+        /**
+         * Test `Width` rectangles starting from `offset` against a ray, like
+         * `Rect::IntersectTest`
+         *
+         * @return mask of rectangles that may be hit, see `SphereSoA::IntersectBatch`
+         */
+        uint32_t IntersectBatch(size_t offset, const Ray& ray, float t_min,
+                                float t_max) const noexcept
+        {
+            if (ray.d.z == 0)
+            {
+                return 0;
+            }
+
+            BatchType t = (fields_.Load(offset, 2) - BatchType{ray.o.z}) / BatchType{ray.d.z};
+
+            auto miss = (t < BatchType{t_min}) | (t > BatchType{t_max});
+            for (int axis = 0; axis < 2; ++axis)
+            {
+                BatchType o     = BatchType{ray.o[axis]};
+                BatchType td    = t * BatchType{ray.d[axis]};
+                BatchType delta = o + td - fields_.Load(offset, axis);
+                BatchType slack =
+                    BatchType{detail::kBatchTestTolerance} * (xsimd::abs(o) + xsimd::abs(td));
+
+                miss = miss | (delta < -slack) | (delta > fields_.Load(offset, 3 + axis) + slack);
+            }
+
+            return detail::ToHitMask<Width>(miss);
+        }
+    };
+
+    /**
+     * SoA layout of an analytic shape, whose `Type` tests shapes in SIMD batches
+     */
+    template <typename Shape>
+    struct ShapeSoATraits;
+
+    template <>
+    struct ShapeSoATraits<Sphere>
+    {
+        using Type = SphereSoA<>;
+    };
+
+    template <>
+    struct ShapeSoATraits<Disk>
+    {
+        using Type = DiskSoA<>;
+    };
+
+    template <>
+    struct ShapeSoATraits<Rect>
+    {
+        using Type = RectSoA<>;
+    };
+} // namespace usami::ray::shape
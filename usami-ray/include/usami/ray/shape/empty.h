@@ -32,6 +32,14 @@ namespace usami::ray::shape
             return {0.f};
         }
 
+        /**
+         * Bounds of normals of the surface
+         */
+        DirectionCone NormalBounds() const noexcept
+        {
+            return DirectionCone::Empty();
+        }
+
         /**
          * Test if a ray intersect with the geometric object.
          * If ComputeGeometryInfo, all output parameters will be set on intersection.
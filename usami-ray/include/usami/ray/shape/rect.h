@@ -32,6 +32,11 @@ namespace usami::ray::shape
             return BoundingBox{p_minxy, p_minxy + Vec3f{len_x, len_y, 0}};
         }
 
+        DirectionCone NormalBounds() const noexcept
+        {
+            return DirectionCone{Vec3f{0, 0, 1}, 1.f};
+        }
+
         template <bool ComputeGeometryInfo>
         bool IntersectTest(const Ray& ray, float t_min, float t_max, float* t_out, Vec3f* p_out,
                            Vec3f* n_out, Vec2f* uv_out) const
@@ -27,6 +27,11 @@ namespace usami::ray::shape
             return BoundingBox{center - radius, center + radius};
         }
 
+        DirectionCone NormalBounds() const noexcept
+        {
+            return DirectionCone::EntireSphere();
+        }
+
         template <bool ComputeGeometryInfo>
         bool IntersectTest(const Ray& ray, float t_min, float t_max, float* t_out, Vec3f* p_out,
                            Vec3f* n_out, Vec2f* uv_out) const
@@ -30,6 +30,11 @@ namespace usami::ray::shape
             return BoundingBox{Min(v0, Min(v1, v2)), Max(v0, Max(v1, v2))};
         }
 
+        DirectionCone NormalBounds() const noexcept
+        {
+            return DirectionCone{Cross(e1, e2).Normalize(), 1.f};
+        }
+
         template <bool ComputeGeometryInfo>
         bool IntersectTest(const Ray& ray, float t_min, float t_max, float* t_out, Vec3f* p_out,
                            Vec3f* n_out, Vec2f* uv_out) const
@@ -81,9 +86,9 @@ namespace usami::ray::shape
             Vec3f n_sized = Cross(e1, e2); // len = area of the formed parallelogram
             float len_inv = 1.f / n_sized.Length();
 
-            p_out   = v0 + t * e1 + (1 - t) * e2;
+            p_out   = v0 + (1 - t) * e1 + u[1] * t * e2;
             n_out   = n_sized * len_inv;
-            pdf_out = 1.f * .5f * len_inv;
+            pdf_out = 2.f * len_inv;
         }
     };
 } // namespace usami::ray::shape
@@ -0,0 +1,131 @@
+#pragma once
+#include "usami/math/math.h"
+#include "usami/ray/ray.h"
+#include "usami/ray/shape/triangle.h"
+#include "xsimd/xsimd.hpp"
+#include <vector>
+
+namespace usami::ray::shape
+{
+    /**
+     * Triangles stored in SoA layout, so that consecutive ones are tested against a ray in a batch
+     *
+     * NOTE arrays are padded by a batch so that a batch could be loaded from any triangle
+     */
+    template <int Width = kSimdFloatWidth>
+    class TriangleSoA
+    {
+    private:
+        using BatchType = xsimd::batch<float, Width>;
+
+        size_t size_ = 0;
+
+        // each of v0, e1 and e2 in `shape::Triangle`, one array per component
+        std::vector<float> v0_[3];
+        std::vector<float> e1_[3];
+        std::vector<float> e2_[3];
+
+    public:
+        static constexpr int kBatchSize = Width;
+
+        size_t Size() const noexcept
+        {
+            return size_;
+        }
+
+        void Resize(size_t size)
+        {
+            size_ = size;
+            for (int axis = 0; axis < 3; ++axis)
+            {
+                v0_[axis].resize(size + Width - 1, 0.f);
+                e1_[axis].resize(size + Width - 1, 0.f);
+                e2_[axis].resize(size + Width - 1, 0.f);
+            }
+        }
+
+        void Set(size_t i, const Triangle& tri) noexcept
+        {
+            USAMI_ASSERT(i < size_);
+            for (int axis = 0; axis < 3; ++axis)
+            {
+                v0_[axis][i] = tri.v0[axis];
+                e1_[axis][i] = tri.e1[axis];
+                e2_[axis][i] = tri.e2[axis];
+            }
+        }
+
+        /**
+         * Unnormalized geometric normal of the i-th triangle, see `Triangle::IntersectTest`
+         */
+        Vec3f GeometricNormal(size_t i) const noexcept
+        {
+            USAMI_ASSERT(i < size_);
+
+            Vec3f e1{e1_[0][i], e1_[1][i], e1_[2][i]};
+            Vec3f e2{e2_[0][i], e2_[1][i], e2_[2][i]};
+            return Cross(e1, e2);
+        }
+
+        size_t ByteSize() const noexcept
+        {
+            return 9 * v0_[0].capacity() * sizeof(float);
+        }
+
+        /**
+         * Test `Width` triangles starting from `offset` against a ray, the same way as
+         * `Triangle::IntersectTest` does
+         *
+         * @return mask of triangles hit within [t_min, t_max], bit `i` for the i-th one
+         */
+        uint32_t IntersectBatch(size_t offset, const Ray& ray, float t_min, float t_max,
+                                float* t_out, float* u_out, float* v_out) const noexcept
+        {
+            BatchType v0[3], e1[3], e2[3];
+            for (int axis = 0; axis < 3; ++axis)
+            {
+                v0[axis].load_unaligned(v0_[axis].data() + offset);
+                e1[axis].load_unaligned(e1_[axis].data() + offset);
+                e2[axis].load_unaligned(e2_[axis].data() + offset);
+            }
+
+            BatchType d[3] = {BatchType{ray.d[0]}, BatchType{ray.d[1]}, BatchType{ray.d[2]}};
+
+            // h = d x e2, a = e1 . h
+            BatchType h[3] = {d[1] * e2[2] - d[2] * e2[1], d[2] * e2[0] - d[0] * e2[2],
+                              d[0] * e2[1] - d[1] * e2[0]};
+            BatchType a    = e1[0] * h[0] + e1[1] * h[1] + e1[2] * h[2];
+
+            BatchType f    = BatchType{1.f} / a;
+            BatchType s[3] = {BatchType{ray.o[0]} - v0[0], BatchType{ray.o[1]} - v0[1],
+                              BatchType{ray.o[2]} - v0[2]};
+            BatchType u    = f * (s[0] * h[0] + s[1] * h[1] + s[2] * h[2]);
+
+            // q = s x e1
+            BatchType q[3] = {s[1] * e1[2] - s[2] * e1[1], s[2] * e1[0] - s[0] * e1[2],
+                              s[0] * e1[1] - s[1] * e1[0]};
+            BatchType v    = f * (d[0] * q[0] + d[1] * q[1] + d[2] * q[2]);
+            BatchType t    = f * (e2[0] * q[0] + e2[1] * q[1] + e2[2] * q[2]);
+
+            // same rejection tests as `Triangle::IntersectTest`
+            auto miss = ((a > BatchType{-kFloatEpsilon}) & (a < BatchType{kFloatEpsilon})) |
+                        (u < BatchType{0.f}) | (u > BatchType{1.f}) | (v < BatchType{0.f}) |
+                        (u + v > BatchType{1.f}) | (t < BatchType{t_min}) | (t > BatchType{t_max});
+            BatchType miss_flag = xsimd::select(miss, BatchType{1.f}, BatchType{0.f});
+
+            alignas(sizeof(float) * Width) float miss_arr[Width];
+            miss_flag.store_aligned(miss_arr);
+            t.store_unaligned(t_out);
+            u.store_unaligned(u_out);
+            v.store_unaligned(v_out);
+
+            uint32_t hit_mask = 0;
+            for (int i = 0; i < Width; ++i)
+            {
+                hit_mask |= static_cast<uint32_t>(miss_arr[i] == 0.f) << i;
+            }
+
+            return hit_mask;
+        }
+    };
+} // namespace usami::ray::shape
@@ -1,25 +1,26 @@
 #include "usami/ray/canvas.h"
 #include "usami/image.h"
+#include "usami/parallel/parallel_for.h"
 
 namespace usami::ray
 {
     void Canvas::SaveImage(const std::string& filename, float scalar)
     {
-        std::vector<uint8_t> image_data;
-        image_data.reserve(3 * width_ * height_);
+        std::vector<uint8_t> image_data(3 * width_ * height_);
 
-        for (int y = 0; y < height_; ++y)
-        {
+        ParallelFor(0, height_, [&](size_t y) {
+            uint8_t* p_dst = image_data.data() + 3 * width_ * y;
             for (int x = 0; x < width_; ++x)
             {
-                SpectrumRGB spectrum = GetPixel(x, y) * scalar;
+                SpectrumRGB spectrum = GetPixel(x, static_cast<int>(y)) * scalar;
                 SpectrumRGB color    = Linear2sRGB(ToneMap_Aces(spectrum)) * 255.f;
 
-                image_data.push_back(static_cast<uint8_t>(color[0]));
-                image_data.push_back(static_cast<uint8_t>(color[1]));
-                image_data.push_back(static_cast<uint8_t>(color[2]));
+                p_dst[0] = static_cast<uint8_t>(color[0]);
+                p_dst[1] = static_cast<uint8_t>(color[1]);
+                p_dst[2] = static_cast<uint8_t>(color[2]);
+                p_dst += 3;
             }
-        }
+        });
 
         SavePngImage(filename.c_str(), image_data.data(), width_, height_, 3);
     }
@@ -1,14 +1,35 @@
+#include "usami/math/sampling.h"
 #include "usami/ray/ray.h"
 #include "usami/ray/primitive.h"
 #include "usami/ray/integrator/path_tracing.h"
 #include "usami/ray/light.h"
+#include "usami/ray/light/infinite.h"
+#include "usami/ray/light_sampler.h"
 #include "usami/ray/material.h"
 #include "usami/ray/bsdf.h"
 #include "usami/ray/bsdf/bsdf_geometry.h"
 
 namespace usami::ray
 {
-    // TODO: make unbiased
+    // radiance reflected towards `wo_bsdf` from a sampled light, weighted against sampling the same
+    // direction by BSDF, where `pdf_light` is the density of the sample scaled by the number of
+    // samples taken by the same strategy
+    SpectrumRGB EvalLightSample(const LightSample& sample, float pdf_light, const Vec3f& wo_bsdf,
+                                const Bsdf& bsdf, const Matrix4& world2local)
+    {
+        Vec3f wi_bsdf = world2local.ApplyVector(sample.IncidentDirection());
+
+        // BSDF never samples directions towards lights of delta distribution
+        float weight = 1.f;
+        if (sample.Type() == LightType::Area || sample.Type() == LightType::Infinite)
+        {
+            weight = PowerHeuristic(pdf_light, bsdf.Pdf(wo_bsdf, wi_bsdf));
+        }
+
+        Vec3f incident_radiance = sample.Radiance() * AbsCosTheta(wi_bsdf);
+        return incident_radiance * bsdf.Eval(wo_bsdf, wi_bsdf) * weight;
+    }
+
     SpectrumRGB SampleAllDirectLight(RenderingContext& ctx, Sampler& sampler, const Scene& scene,
                                      const IntersectionInfo& isect, const Vec3f& wo_bsdf,
                                      const Bsdf& bsdf, const Matrix4& world2local)
@@ -20,16 +41,60 @@ namespace usami::ray
 
             if (sample.TestIllumination() && sample.TestVisibility(scene, isect, ctx.workspace))
             {
-                Vec3f wi_bsdf = world2local.ApplyVector(sample.IncidentDirection());
+                total_ld += EvalLightSample(sample, sample.Pdf(), wo_bsdf, bsdf, world2local) /
+                            sample.Pdf();
+            }
+        }
 
-                Vec3f incident_radiance = sample.Radiance() * AbsCosTheta(wi_bsdf);
-                Vec3f exitant_radiance  = incident_radiance * bsdf.Eval(wo_bsdf, wi_bsdf);
+        return total_ld;
+    }
 
-                total_ld += exitant_radiance / sample.Pdf();
+    /**
+     * Estimate direct lighting from `num_sample` lights picked by `light_sampler`, each of which
+     * is weighted by the inverse of its probability
+     */
+    SpectrumRGB SampleDirectLight(RenderingContext& ctx, Sampler& sampler, const Scene& scene,
+                                  const LightSampler& light_sampler, int num_sample,
+                                  const IntersectionInfo& isect, const Vec3f& wo_bsdf,
+                                  const Bsdf& bsdf, const Matrix4& world2local)
+    {
+        SpectrumRGB total_ld = 0.f;
+        for (int i = 0; i < num_sample; ++i)
+        {
+            float pmf;
+            const Light* light = light_sampler.Sample(isect.point, isect.ns, sampler.Get1D(), pmf);
+            if (light == nullptr)
+            {
+                continue;
+            }
+
+            LightSample sample = light->Sample(isect, sampler.Get2D());
+
+            if (sample.TestIllumination() && sample.TestVisibility(scene, isect, ctx.workspace))
+            {
+                float pdf = sample.Pdf() * pmf;
+                total_ld += EvalLightSample(sample, pdf * num_sample, wo_bsdf, bsdf, world2local) /
+                            pdf;
             }
         }
 
-        return total_ld;
+        return total_ld / static_cast<float>(num_sample);
+    }
+
+    // radiance reflected towards `wo_bsdf` from a direction sampled on the global light
+    SpectrumRGB SampleGlobalLight(RenderingContext& ctx, Sampler& sampler, const Scene& scene,
+                                  const IntersectionInfo& isect, const Vec3f& wo_bsdf,
+                                  const Bsdf& bsdf, const Matrix4& world2local)
+    {
+        LightSample sample = scene.GlobalLight()->Sample(isect, sampler.Get2D());
+
+        if (sample.TestIllumination() && sample.TestVisibility(scene, isect, ctx.workspace))
+        {
+            return EvalLightSample(sample, sample.Pdf(), wo_bsdf, bsdf, world2local) /
+                   sample.Pdf();
+        }
+
+        return 0.f;
     }
 
     SpectrumRGB PathTracingIntegrator::Li(RenderingContext& ctx, Sampler& sampler,
@@ -39,33 +104,75 @@ namespace usami::ray
         SpectrumRGB result  = 0.f;
         SpectrumRGB contrib = 1.f; // attenuation
 
+        // light sampler picking lights for direct lighting, or null if every light is sampled
+        const LightSampler* light_sampler = nullptr;
+        switch (light_sampling_)
+        {
+        case DirectLightSampling::LightBvh:
+            light_sampler = &scene.LightBvh();
+            break;
+        case DirectLightSampling::Power:
+            light_sampler = &scene.LightDistribution();
+            break;
+        default:
+            break;
+        }
+
+        // the last scattering event, against which lights hit by the sampled ray are weighted
+        IntersectionInfo last_isect;
+        float last_pdf_bsdf = 0.f;
+
+        // NOTE the ray sampled at the last bounce is still traced to find light it hits, as direct
+        // lighting there is weighted against it
         bool from_camera_or_specular = true;
-        for (int bounce = 0; bounce < max_bounce_; ++bounce)
+        for (int bounce = 0; bounce <= max_bounce_; ++bounce)
         {
             ctx.workspace.Clear();
 
             IntersectionInfo isect;
             if (!scene.Intersect(ray, ctx.workspace, isect))
             {
-                // as we are not sampling from global light, we should always add this
-                // if (from_camera_or_specular)
                 if (scene.GlobalLight() != nullptr)
                 {
-                    result += contrib * scene.GlobalLight()->Eval(ray);
+                    SpectrumRGB radiance = scene.GlobalLight()->Eval(ray);
+                    if (!from_camera_or_specular)
+                    {
+                        radiance *=
+                            PowerHeuristic(last_pdf_bsdf, scene.GlobalLight()->Pdf(ray.d));
+                    }
+
+                    result += contrib * radiance;
                 }
 
                 break;
             }
 
             // if ray hit an area light source
-            // as we explicit sample light, the radiance from hit light source shouldn't be added
-            // unless we are coming from camera or perfect specular reflection
-            if (isect.area_light != nullptr && from_camera_or_specular)
+            // as lights are also sampled explicitly, radiance from the hit light is weighted
+            // against that unless we are coming from camera or perfect specular reflection
+            if (isect.area_light != nullptr)
             {
-                result += contrib * isect.area_light->Eval(ray);
+                if (from_camera_or_specular)
+                {
+                    result += contrib * isect.area_light->Eval(ray);
+                }
+                else if (Dot(ray.d, isect.ng) < 0)
+                {
+                    // same as light sampling, only the side the light faces emits
+                    float pdf_light = isect.area_light->Pdf(last_isect, isect);
+                    if (light_sampler != nullptr)
+                    {
+                        pdf_light *= num_light_sample_ *
+                                     light_sampler->Pmf(last_isect.point, last_isect.ns,
+                                                        isect.area_light);
+                    }
+
+                    result += contrib * isect.area_light->Eval(ray) *
+                              PowerHeuristic(last_pdf_bsdf, pdf_light);
+                }
             }
 
-            if (isect.material == nullptr)
+            if (isect.material == nullptr || bounce == max_bounce_)
             {
                 break;
             }
@@ -83,8 +190,23 @@ namespace usami::ray
             // estimate direct light illumination for non-specular bsdf
             if (!is_specular_bsdf)
             {
-                result += contrib * SampleAllDirectLight(ctx, sampler, scene, isect, wo_bsdf, *bsdf,
-                                                         world2local);
+                if (light_sampler == nullptr)
+                {
+                    result += contrib * SampleAllDirectLight(ctx, sampler, scene, isect, wo_bsdf,
+                                                             *bsdf, world2local);
+                }
+                else
+                {
+                    result += contrib * SampleDirectLight(ctx, sampler, scene, *light_sampler,
+                                                          num_light_sample_, isect, wo_bsdf, *bsdf,
+                                                          world2local);
+                }
+
+                if (scene.GlobalLight() != nullptr)
+                {
+                    result += contrib * SampleGlobalLight(ctx, sampler, scene, isect, wo_bsdf,
+                                                          *bsdf, world2local);
+                }
             }
 
             // estimite indirect light illumination
@@ -99,11 +221,15 @@ namespace usami::ray
             contrib *= f * AbsCosTheta(wi_bsdf) / pdf_wi;
             ray = Ray{isect.point, local2world.ApplyVector(wi_bsdf)};
 
+            last_isect    = isect;
+            last_pdf_bsdf = pdf_wi;
+
             // russian roulette
             if (bounce >= min_bounce_)
             {
-                float prob_halt = std::max({contrib[0], contrib[1], contrib[2]});
-                USAMI_REQUIRE(prob_halt <= 1);
+                // NOTE throughput may exceed one after glossy bounces, e.g. BSDF sampling of
+                // microfacet models doesn't follow f * cos exactly
+                float prob_halt = Min(1.f, std::max({contrib[0], contrib[1], contrib[2]}));
 
                 if (sampler.Get1D() > prob_halt)
                 {
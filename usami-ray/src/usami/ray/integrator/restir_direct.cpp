@@ -0,0 +1,391 @@
+#include "usami/ray/integrator/restir_direct.h"
+#include "usami/ray/primitive.h"
+#include "usami/ray/light.h"
+#include "usami/ray/light_sampler.h"
+#include "usami/ray/material.h"
+#include "usami/ray/bsdf.h"
+#include "usami/ray/bsdf/bsdf_geometry.h"
+#include "usami/math/sampling.h"
+#include "usami/parallel/parallel_for.h"
+#include <array>
+
+namespace usami::ray
+{
+    // number of pixels processed by one task in a pass
+    static constexpr size_t kRestirGrain = 64;
+
+    // maximum number of neighbours merged at a pixel
+    static constexpr int kMaxSpatialNeighbor = 16;
+
+    // reservoirs are only merged between similar surfaces, i.e. whose normals are within about 25
+    // degrees and depths within 10%, which doesn't bias the result but avoids useless samples
+    static constexpr float kSimilarNormalCos  = .9f;
+    static constexpr float kSimilarDepthRatio = .1f;
+
+    namespace
+    {
+        /**
+         * Surface of a reservoir with its bsdf, at which light samples are evaluated
+         */
+        struct ShadingPoint
+        {
+            const IntersectionInfo* isect;
+            const Bsdf* bsdf;
+            Matrix4 world2local;
+            Vec3f wo_bsdf;
+
+            ShadingPoint()
+            {
+            }
+            ShadingPoint(Workspace& workspace, const ReservoirBuffer::Entry& entry)
+                : isect(&entry.isect),
+                  bsdf(entry.isect.material->ComputeBsdf(workspace, entry.isect)),
+                  world2local(CreateBsdfCoordTransform(entry.isect.ns)),
+                  wo_bsdf(world2local.ApplyVector(entry.wo))
+            {
+                USAMI_REQUIRE(bsdf != nullptr);
+            }
+        };
+
+        // unshadowed contribution of a light sample, divided by its pdf of `Light::Sample`
+        SpectrumRGB EvalContribution(const ShadingPoint& sp, const LightSample& sample)
+        {
+            if (!sample.TestIllumination())
+            {
+                return 0.f;
+            }
+
+            Vec3f wi_bsdf = sp.world2local.ApplyVector(sample.IncidentDirection());
+
+            Vec3f incident_radiance = sample.Radiance() * AbsCosTheta(wi_bsdf);
+            return incident_radiance * sp.bsdf->Eval(sp.wo_bsdf, wi_bsdf) / sample.Pdf();
+        }
+
+        // target function that candidates are resampled by, i.e. luminance of the contribution
+        float EvalTarget(const ShadingPoint& sp, const Light* light, const Point2f& u)
+        {
+            return Luminance(EvalContribution(sp, light->Sample(*sp.isect, u)));
+        }
+
+        bool SimilarSurface(const ReservoirBuffer::Entry& a, const ReservoirBuffer::Entry& b)
+        {
+            return b.Valid() && Dot(a.isect.ns, b.isect.ns) >= kSimilarNormalCos &&
+                   Abs(a.isect.t - b.isect.t) <= kSimilarDepthRatio * a.isect.t;
+        }
+
+        /**
+         * Merge reservoirs into one for `sps[0]`, where `sps[i]` is the surface of
+         * `reservoirs[i]`, and each reservoir stands for `num_candidates[i]` candidates
+         *
+         * Samples are weighted by pairwise MIS, see GRIS (Lin et al. 2022), where each other
+         * reservoir is paired with the canonical one at `sps[0]` and weighted by balance heuristic
+         * within the pair. So weights of all reservoirs that may pick a sample sum to one and the
+         * estimate stays unbiased, while the cost grows linearly with reservoirs.
+         */
+        LightReservoir MergeReservoirs(std::span<const ShadingPoint> sps,
+                                       std::span<const LightReservoir* const> reservoirs,
+                                       std::span<const float> num_candidates, Sampler& sampler,
+                                       const Scene& scene, Workspace& workspace,
+                                       bool test_visibility)
+        {
+            // target function of a sample at a surface, which includes visibility if reservoirs
+            // only hold visible samples
+            auto eval_target = [&](const ShadingPoint& sp, const Light* light, const Point2f& u) {
+                LightSample sample = light->Sample(*sp.isect, u);
+
+                float target = Luminance(EvalContribution(sp, sample));
+                if (test_visibility && target > 0 &&
+                    !sample.TestVisibility(scene, *sp.isect, workspace))
+                {
+                    target = 0.f;
+                }
+
+                return target;
+            };
+
+            const LightReservoir& canonical = *reservoirs[0];
+            if (reservoirs.size() == 1)
+            {
+                return canonical;
+            }
+
+            float num_total = 0.f;
+            for (float num_candidate : num_candidates)
+            {
+                num_total += num_candidate;
+            }
+
+            // share of candidates of the canonical reservoir in each pair
+            float num_canonical = num_candidates[0] / static_cast<float>(reservoirs.size() - 1);
+            bool has_canonical  = canonical.light != nullptr && canonical.contrib_weight > 0;
+
+            LightReservoir result;
+            float mis_canonical = 0.f;
+            for (size_t i = 1; i < reservoirs.size(); ++i)
+            {
+                const LightReservoir& r = *reservoirs[i];
+                float pair_share        = (num_candidates[i] + num_canonical) / num_total;
+
+                float target = 0.f;
+                float weight = 0.f;
+                if (r.light != nullptr && r.contrib_weight > 0)
+                {
+                    target = eval_target(sps[0], r.light, r.u);
+
+                    float self  = num_candidates[i] * r.target;
+                    float other = num_canonical * target;
+                    weight      = pair_share * self / (self + other) * target * r.contrib_weight;
+                }
+
+                result.Update(r.light, r.u, target, weight, sampler.Get1D(), num_candidates[i]);
+
+                if (has_canonical)
+                {
+                    float self  = num_canonical * canonical.target;
+                    float other =
+                        num_candidates[i] * eval_target(sps[i], canonical.light, canonical.u);
+                    mis_canonical += pair_share * self / (self + other);
+                }
+            }
+
+            result.Update(canonical.light, canonical.u, canonical.target,
+                          has_canonical ? mis_canonical * canonical.target *
+                                              canonical.contrib_weight
+                                        : 0.f,
+                          sampler.Get1D(), num_candidates[0]);
+
+            if (result.target > 0)
+            {
+                result.contrib_weight = result.weight_sum / result.target;
+            }
+
+            return result;
+        }
+    } // namespace
+
+    RestirDirectIntegrator::RestirDirectIntegrator(RestirDirectSetting setting)
+        : setting_(setting)
+    {
+        USAMI_REQUIRE(setting_.num_sample > 0 && setting_.num_initial_candidate > 0);
+        USAMI_REQUIRE(setting_.max_history > 0);
+        USAMI_REQUIRE(setting_.num_spatial_neighbor >= 0 &&
+                      setting_.num_spatial_neighbor <= kMaxSpatialNeighbor);
+    }
+
+    void RestirDirectIntegrator::Render(Canvas& canvas, ReservoirBuffer& reservoirs,
+                                        const PerspectiveCamera& camera, const Scene& scene) const
+    {
+        USAMI_REQUIRE(reservoirs.Width() == canvas.Width() &&
+                      reservoirs.Height() == canvas.Height());
+
+        size_t num_pixel = static_cast<size_t>(canvas.Width()) * canvas.Height();
+        int width        = canvas.Width();
+
+        ThreadPool& pool = ThreadPool::Global();
+
+        // sampler is seeded per pixel so that result doesn't depend on scheduling
+        FrameContext frame;
+        frame.samplers.resize(num_pixel, Sampler{0});
+        ParallelFor(0, num_pixel, [&](size_t i) {
+            frame.samplers[i] = Sampler{MixSeed(setting_.seed, i)};
+        });
+        for (int i = 0; i < pool.NumWorkerSlots(); ++i)
+        {
+            frame.contexts.push_back(make_unique<RenderingContext>());
+        }
+
+        // NOTE a pass only writes entries of the pixel being processed, and the spatial pass only
+        // reads current reservoirs written by the initial pass, so there's no conflicting access
+        for (int i = 0; i < setting_.num_sample; ++i)
+        {
+            ParallelFor(0, num_pixel, kRestirGrain, [&](size_t pixel) {
+                int x = static_cast<int>(pixel % width);
+                int y = static_cast<int>(pixel / width);
+                ResampleInitial(frame, canvas, reservoirs, camera, scene, x, y);
+            });
+
+            ParallelFor(0, num_pixel, kRestirGrain, [&](size_t pixel) {
+                int x = static_cast<int>(pixel % width);
+                int y = static_cast<int>(pixel / width);
+                ResampleSpatial(frame, canvas, reservoirs, scene, x, y);
+            });
+        }
+    }
+
+    void RestirDirectIntegrator::Render(Canvas& canvas, const PerspectiveCamera& camera,
+                                        const Scene& scene) const
+    {
+        ReservoirBuffer reservoirs{canvas.Width(), canvas.Height()};
+        Render(canvas, reservoirs, camera, scene);
+    }
+
+    void RestirDirectIntegrator::ResampleInitial(FrameContext& frame, Canvas& canvas,
+                                                 ReservoirBuffer& reservoirs,
+                                                 const PerspectiveCamera& camera,
+                                                 const Scene& scene, int x, int y) const
+    {
+        RenderingContext& ctx = *frame.contexts[ThreadPool::Global().CurrentWorkerIndex()];
+        Sampler& sampler      = frame.samplers[static_cast<size_t>(y) * canvas.Width() + x];
+
+        ReservoirBuffer::Entry& entry = reservoirs.Current(x, y);
+        entry                         = ReservoirBuffer::Entry{};
+
+        ctx.workspace.Clear();
+
+        Ray ray = camera.SpawnRay({x, y}, sampler.Get2D());
+        IntersectionInfo isect;
+        if (!scene.Intersect(ray, ctx.workspace, isect))
+        {
+            if (scene.GlobalLight() != nullptr)
+            {
+                canvas.AppendPixel(x, y, scene.GlobalLight()->Eval(ray));
+            }
+
+            return;
+        }
+
+        if (isect.area_light != nullptr)
+        {
+            canvas.AppendPixel(x, y, isect.area_light->Eval(ray));
+        }
+
+        if (isect.material == nullptr)
+        {
+            return;
+        }
+
+        entry.isect = isect;
+        entry.wo    = -ray.d;
+
+        ShadingPoint sp{ctx.workspace, entry};
+        if (sp.bsdf->GetType().Contain(BsdfType::Specular))
+        {
+            entry.isect.material = nullptr;
+            return;
+        }
+
+        // resample candidates picked by the light sampler, whose unshadowed contribution costs no
+        // ray to evaluate
+        const LightSampler& light_sampler = scene.LightBvh();
+
+        LightReservoir& reservoir = entry.reservoir;
+        for (int i = 0; i < setting_.num_initial_candidate; ++i)
+        {
+            float pmf;
+            const Light* light = light_sampler.Sample(isect.point, isect.ns, sampler.Get1D(), pmf);
+            Point2f u          = sampler.Get2D();
+
+            float target = light != nullptr ? EvalTarget(sp, light, u) : 0.f;
+            reservoir.Update(light, u, target, target > 0 ? target / pmf : 0.f, sampler.Get1D());
+        }
+
+        if (reservoir.target > 0)
+        {
+            reservoir.contrib_weight =
+                reservoir.weight_sum / (reservoir.num_candidate * reservoir.target);
+        }
+
+        // drop an occluded sample, after which reservoirs only hold visible samples and are merged
+        // by targets including visibility
+        if (setting_.visibility_reuse && reservoir.contrib_weight > 0)
+        {
+            LightSample sample = reservoir.light->Sample(isect, reservoir.u);
+            if (!sample.TestVisibility(scene, isect, ctx.workspace))
+            {
+                reservoir.contrib_weight = 0.f;
+            }
+        }
+
+        // merge the reservoir left at the pixel by the previous frame
+        const ReservoirBuffer::Entry& history = reservoirs.History(x, y);
+        if (setting_.temporal_reuse && SimilarSurface(entry, history))
+        {
+            float max_history = static_cast<float>(setting_.max_history) *
+                                static_cast<float>(setting_.num_initial_candidate);
+
+            std::array<ShadingPoint, 2> sps = {sp, ShadingPoint{ctx.workspace, history}};
+            std::array<const LightReservoir*, 2> merged = {&reservoir, &history.reservoir};
+            std::array<float, 2> num_candidates = {reservoir.num_candidate,
+                                                   Min(history.reservoir.num_candidate,
+                                                       max_history)};
+
+            reservoir = MergeReservoirs(sps, merged, num_candidates, sampler, scene,
+                                        ctx.workspace, setting_.visibility_reuse);
+        }
+    }
+
+    void RestirDirectIntegrator::ResampleSpatial(FrameContext& frame, Canvas& canvas,
+                                                 ReservoirBuffer& reservoirs, const Scene& scene,
+                                                 int x, int y) const
+    {
+        RenderingContext& ctx = *frame.contexts[ThreadPool::Global().CurrentWorkerIndex()];
+        Sampler& sampler      = frame.samplers[static_cast<size_t>(y) * canvas.Width() + x];
+
+        const ReservoirBuffer::Entry& entry = reservoirs.Current(x, y);
+        ReservoirBuffer::Entry& history     = reservoirs.History(x, y);
+        if (!entry.Valid())
+        {
+            history = entry;
+            return;
+        }
+
+        ctx.workspace.Clear();
+
+        std::array<ShadingPoint, kMaxSpatialNeighbor + 1> sps;
+        std::array<const LightReservoir*, kMaxSpatialNeighbor + 1> merged;
+        std::array<float, kMaxSpatialNeighbor + 1> num_candidates;
+
+        sps[0]            = ShadingPoint{ctx.workspace, entry};
+        merged[0]         = &entry.reservoir;
+        num_candidates[0] = entry.reservoir.num_candidate;
+
+        // merge reservoirs of random neighbours with similar surfaces
+        size_t num_merged = 1;
+        for (int i = 0; i < setting_.num_spatial_neighbor; ++i)
+        {
+            Vec3f offset = SampleUniformDisk(sampler.Get2D()) * setting_.spatial_radius;
+            int nx       = x + static_cast<int>(std::round(offset.x));
+            int ny       = y + static_cast<int>(std::round(offset.y));
+            if (nx < 0 || nx >= canvas.Width() || ny < 0 || ny >= canvas.Height() ||
+                (nx == x && ny == y))
+            {
+                continue;
+            }
+
+            const ReservoirBuffer::Entry& neighbor = reservoirs.Current(nx, ny);
+            if (!SimilarSurface(entry, neighbor))
+            {
+                continue;
+            }
+
+            sps[num_merged]            = ShadingPoint{ctx.workspace, neighbor};
+            merged[num_merged]         = &neighbor.reservoir;
+            num_candidates[num_merged] = neighbor.reservoir.num_candidate;
+            num_merged += 1;
+        }
+
+        LightReservoir reservoir =
+            MergeReservoirs(std::span{sps.data(), num_merged},
+                            std::span{merged.data(), num_merged},
+                            std::span{num_candidates.data(), num_merged}, sampler, scene,
+                            ctx.workspace, setting_.visibility_reuse);
+
+        // shade with the picked sample, whose visibility is already known if visibility is reused
+        if (reservoir.contrib_weight > 0)
+        {
+            LightSample sample = reservoir.light->Sample(entry.isect, reservoir.u);
+            if (setting_.visibility_reuse ||
+                sample.TestVisibility(scene, entry.isect, ctx.workspace))
+            {
+                SpectrumRGB radiance = EvalContribution(sps[0], sample) * reservoir.contrib_weight;
+                USAMI_CHECK(!InvalidSpectrum(radiance));
+
+                canvas.AppendPixel(x, y, radiance);
+            }
+        }
+
+        // the merged reservoir is the history of the next frame
+        history = ReservoirBuffer::Entry{
+            .isect = entry.isect, .wo = entry.wo, .reservoir = reservoir};
+    }
+} // namespace usami::ray
@@ -0,0 +1,355 @@
+#include "usami/ray/integrator/wavefront_path.h"
+#include "usami/ray/primitive.h"
+#include "usami/ray/light.h"
+#include "usami/ray/material.h"
+#include "usami/ray/bsdf.h"
+#include "usami/ray/bsdf/bsdf_geometry.h"
+#include "usami/parallel/parallel_for.h"
+#include <algorithm>
+#include <unordered_map>
+#include <utility>
+
+namespace usami::ray
+{
+    // number of paths processed by one task in a stage
+    static constexpr size_t kWavefrontGrain = 256;
+
+    void WavefrontPathIntegrator::PathStates::Resize(size_t size)
+    {
+        pixel.resize(size);
+        ray.resize(size);
+        throughput.resize(size);
+        radiance.resize(size);
+        specular_bounce.resize(size);
+        alive.resize(size);
+        hit.resize(size);
+    }
+
+    WavefrontPathIntegrator::WavefrontPathIntegrator(WavefrontPathSetting setting)
+        : setting_(setting)
+    {
+        USAMI_REQUIRE(setting_.num_sample > 0 && setting_.max_path_per_wave > 0);
+        USAMI_REQUIRE(setting_.min_bounce > 0 && setting_.max_bounce >= setting_.min_bounce);
+    }
+
+    void WavefrontPathIntegrator::Render(Canvas& canvas, const PerspectiveCamera& camera,
+                                         const Scene& scene) const
+    {
+        size_t num_pixel = static_cast<size_t>(canvas.Width()) * canvas.Height();
+        size_t wave_size = Min(num_pixel, static_cast<size_t>(setting_.max_path_per_wave));
+
+        ThreadPool& pool = ThreadPool::Global();
+
+        WaveContext wave;
+        wave.paths.Resize(wave_size);
+        wave.active.reserve(wave_size);
+        wave.shade_queue.reserve(wave_size);
+
+        // sampler is seeded per pixel so that result doesn't depend on scheduling
+        wave.samplers.resize(num_pixel, Sampler{0});
+        ParallelFor(0, num_pixel, [&](size_t i) {
+            wave.samplers[i] = Sampler{MixSeed(setting_.seed, i)};
+        });
+        for (int i = 0; i < pool.NumWorkerSlots(); ++i)
+        {
+            wave.workers.push_back(make_unique<WorkerData>());
+        }
+
+        for (int i = 0; i < setting_.num_sample; ++i)
+        {
+            for (size_t pixel_begin = 0; pixel_begin < num_pixel; pixel_begin += wave_size)
+            {
+                size_t pixel_end = Min(pixel_begin + wave_size, num_pixel);
+                RenderWave(wave, canvas, camera, scene, pixel_begin, pixel_end);
+            }
+        }
+    }
+
+    void WavefrontPathIntegrator::RenderWave(WaveContext& wave, Canvas& canvas,
+                                             const PerspectiveCamera& camera, const Scene& scene,
+                                             size_t pixel_begin, size_t pixel_end) const
+    {
+        PathStates& paths = wave.paths;
+        size_t num_path   = pixel_end - pixel_begin;
+        int width         = canvas.Width();
+
+        // generate camera rays
+        ParallelFor(0, num_path, kWavefrontGrain, [&](size_t i) {
+            uint32_t pixel = static_cast<uint32_t>(pixel_begin + i);
+            int x          = static_cast<int>(pixel % width);
+            int y          = static_cast<int>(pixel / width);
+
+            paths.pixel[i]           = pixel;
+            paths.ray[i]             = camera.SpawnRay({x, y}, wave.samplers[pixel].Get2D());
+            paths.throughput[i]      = 1.f;
+            paths.radiance[i]        = 0.f;
+            paths.specular_bounce[i] = true;
+            paths.alive[i]           = true;
+        });
+
+        wave.active.resize(num_path);
+        for (size_t i = 0; i < num_path; ++i)
+        {
+            wave.active[i] = static_cast<uint32_t>(i);
+        }
+
+        for (int bounce = 0; bounce < setting_.max_bounce && !wave.active.empty(); ++bounce)
+        {
+            Extend(wave, scene, bounce);
+            CompactActivePaths(wave);
+
+            SortByMaterial(wave);
+            Shade(wave, scene, bounce);
+            TraceShadowRays(wave, scene);
+            CompactActivePaths(wave);
+        }
+
+        // NOTE each pixel appears once in a wave, so there's no conflicting write
+        ParallelFor(0, num_path, kWavefrontGrain, [&](size_t i) {
+            USAMI_CHECK(!InvalidSpectrum(paths.radiance[i]));
+
+            int x = static_cast<int>(paths.pixel[i] % width);
+            int y = static_cast<int>(paths.pixel[i] / width);
+            canvas.AppendPixel(x, y, paths.radiance[i]);
+        });
+    }
+
+    void WavefrontPathIntegrator::Extend(WaveContext& wave, const Scene& scene, int bounce) const
+    {
+        PathStates& paths = wave.paths;
+        ThreadPool& pool  = ThreadPool::Global();
+
+        // camera rays of a wave are ordered by pixel, and thus coherent
+        RayCoherence coherence = bounce == 0 ? RayCoherence::Coherent : RayCoherence::Incoherent;
+
+        ParallelForRange(0, wave.active.size(), kWavefrontGrain, [&](size_t begin, size_t end) {
+            WorkerData& worker = *wave.workers[pool.CurrentWorkerIndex()];
+
+            worker.rays.clear();
+            for (size_t k = begin; k < end; ++k)
+            {
+                worker.rays.push_back(paths.ray[wave.active[k]]);
+            }
+
+            scene.IntersectBatch(worker.rays, coherence, worker.ctx.workspace, worker.hits);
+
+            for (size_t k = begin; k < end; ++k)
+            {
+                uint32_t i                 = wave.active[k];
+                const Ray& ray             = paths.ray[i];
+                const SpectrumRGB& contrib = paths.throughput[i];
+
+                if (!worker.hits.hit[k - begin])
+                {
+                    // as we are not sampling from global light, we should always add this
+                    if (scene.GlobalLight() != nullptr)
+                    {
+                        paths.radiance[i] += contrib * scene.GlobalLight()->Eval(ray);
+                    }
+
+                    paths.alive[i] = false;
+                    continue;
+                }
+
+                IntersectionInfo& isect = paths.hit[i];
+                isect                   = worker.hits.Load(k - begin);
+
+                // radiance from a hit light source is only added for camera or specular rays as
+                // direct lighting is sampled explicitly
+                if (isect.area_light != nullptr && paths.specular_bounce[i])
+                {
+                    paths.radiance[i] += contrib * isect.area_light->Eval(ray);
+                }
+
+                if (isect.material == nullptr)
+                {
+                    paths.alive[i] = false;
+                }
+            }
+        });
+    }
+
+    void WavefrontPathIntegrator::SortByMaterial(WaveContext& wave) const
+    {
+        const PathStates& paths = wave.paths;
+
+        // counting sort keyed by material, where materials are numbered in order of appearance
+        std::unordered_map<const Material*, uint32_t> material_index;
+        std::vector<uint32_t> keys(wave.active.size());
+        std::vector<uint32_t> offsets;
+
+        const Material* last_material = nullptr;
+        uint32_t last_index           = 0;
+        for (size_t k = 0; k < wave.active.size(); ++k)
+        {
+            const Material* material = paths.hit[wave.active[k]].material;
+            if (material != last_material || k == 0)
+            {
+                auto [iter, inserted] = material_index.try_emplace(
+                    material, static_cast<uint32_t>(material_index.size()));
+                if (inserted)
+                {
+                    offsets.push_back(0);
+                }
+
+                last_material = material;
+                last_index    = iter->second;
+            }
+
+            keys[k] = last_index;
+            offsets[last_index] += 1;
+        }
+
+        uint32_t total = 0;
+        for (uint32_t& offset : offsets)
+        {
+            total += std::exchange(offset, total);
+        }
+
+        wave.shade_queue.resize(wave.active.size());
+        for (size_t k = 0; k < wave.active.size(); ++k)
+        {
+            wave.shade_queue[offsets[keys[k]]++] = wave.active[k];
+        }
+    }
+
+    void WavefrontPathIntegrator::Shade(WaveContext& wave, const Scene& scene, int bounce) const
+    {
+        PathStates& paths = wave.paths;
+        ThreadPool& pool  = ThreadPool::Global();
+
+        for (auto& worker : wave.workers)
+        {
+            worker->shadow_queue.clear();
+        }
+
+        // NOTE paths of the same material are adjacent in the queue, so a chunk mostly runs the
+        // same shading code
+        ParallelFor(0, wave.shade_queue.size(), kWavefrontGrain, [&](size_t k) {
+            uint32_t i                           = wave.shade_queue[k];
+            WorkerData& worker                   = *wave.workers[pool.CurrentWorkerIndex()];
+            RenderingContext& ctx                = worker.ctx;
+            std::vector<ShadowRay>& shadow_queue = worker.shadow_queue;
+
+            Sampler& sampler              = wave.samplers[paths.pixel[i]];
+            const IntersectionInfo& isect = paths.hit[i];
+            SpectrumRGB& contrib          = paths.throughput[i];
+
+            ctx.workspace.Clear();
+            const Bsdf* bsdf = isect.material->ComputeBsdf(ctx.workspace, isect);
+            USAMI_REQUIRE(bsdf != nullptr);
+
+            Matrix4 world2local = CreateBsdfCoordTransform(isect.ns);
+            Matrix4 local2world = world2local.Inverse();
+            Vec3f wo_bsdf       = world2local.ApplyVector(-paths.ray[i].d);
+
+            bool is_specular_bsdf    = bsdf->GetType().Contain(BsdfType::Specular);
+            paths.specular_bounce[i] = is_specular_bsdf;
+
+            // queue shadow rays to estimate direct light illumination for non-specular bsdf
+            if (!is_specular_bsdf)
+            {
+                for (const Light* light : scene.Lights())
+                {
+                    LightSample sample = light->Sample(isect, sampler.Get2D());
+                    if (!sample.TestIllumination())
+                    {
+                        continue;
+                    }
+
+                    Vec3f wi_bsdf = world2local.ApplyVector(sample.IncidentDirection());
+
+                    Vec3f incident_radiance = sample.Radiance() * AbsCosTheta(wi_bsdf);
+                    Vec3f exitant_radiance  = incident_radiance * bsdf->Eval(wo_bsdf, wi_bsdf);
+
+                    shadow_queue.push_back(ShadowRay{
+                        .path         = i,
+                        .ray          = sample.GenerateShadowRay(isect.point),
+                        .t_max        = sample.ShadowRayDistance(isect.point),
+                        .contribution = contrib * exitant_radiance / sample.Pdf(),
+                    });
+                }
+            }
+
+            // sample next ray for indirect light illumination
+            Vec3f wi_bsdf;
+            float pdf_wi;
+            SpectrumRGB f = bsdf->SampleAndEval(sampler.Get2D(), wo_bsdf, wi_bsdf, pdf_wi);
+            if (pdf_wi == 0)
+            {
+                paths.alive[i] = false;
+                return;
+            }
+
+            contrib *= f * AbsCosTheta(wi_bsdf) / pdf_wi;
+            paths.ray[i] = Ray{isect.point, local2world.ApplyVector(wi_bsdf)};
+
+            // russian roulette
+            if (bounce >= setting_.min_bounce)
+            {
+                // NOTE throughput may exceed one after glossy bounces, same as
+                // `PathTracingIntegrator`
+                float prob_halt = Min(1.f, std::max({contrib[0], contrib[1], contrib[2]}));
+
+                if (sampler.Get1D() > prob_halt)
+                {
+                    paths.alive[i] = false;
+                    return;
+                }
+
+                contrib *= (1 / prob_halt);
+            }
+        });
+    }
+
+    void WavefrontPathIntegrator::TraceShadowRays(WaveContext& wave, const Scene& scene) const
+    {
+        PathStates& paths = wave.paths;
+        ThreadPool& pool  = ThreadPool::Global();
+
+        for (auto& owner : wave.workers)
+        {
+            std::vector<ShadowRay>& queue = owner->shadow_queue;
+
+            ParallelForRange(0, queue.size(), kWavefrontGrain, [&](size_t begin, size_t end) {
+                WorkerData& worker = *wave.workers[pool.CurrentWorkerIndex()];
+
+                worker.rays.clear();
+                worker.t_max.clear();
+                for (size_t k = begin; k < end; ++k)
+                {
+                    worker.rays.push_back(queue[k].ray);
+                    worker.t_max.push_back(queue[k].t_max);
+                }
+
+                worker.occluded.resize(end - begin);
+                scene.OccludedBatch(worker.rays, worker.t_max, RayCoherence::Incoherent,
+                                    worker.ctx.workspace, worker.occluded);
+
+                for (size_t k = begin; k < end; ++k)
+                {
+                    if (worker.occluded[k - begin])
+                    {
+                        queue[k].contribution = 0.f;
+                    }
+                }
+            });
+
+            // NOTE all shadow rays of a path are in the same queue, as a path is shaded by one
+            // worker, so they are accumulated in the same order regardless of scheduling
+            for (const ShadowRay& shadow_ray : queue)
+            {
+                paths.radiance[shadow_ray.path] += shadow_ray.contribution;
+            }
+        }
+    }
+
+    void WavefrontPathIntegrator::CompactActivePaths(WaveContext& wave) const
+    {
+        const PathStates& paths = wave.paths;
+
+        auto iter = std::remove_if(wave.active.begin(), wave.active.end(),
+                                   [&](uint32_t i) { return !paths.alive[i]; });
+        wave.active.erase(iter, wave.active.end());
+    }
+} // namespace usami::ray
@@ -1,5 +1,4 @@
 #include "usami/ray/light.h"
-#include "usami/ray/primitive.h"
 #include "usami/ray/scene.h"
 
 namespace usami::ray
@@ -7,28 +6,22 @@ namespace usami::ray
     bool LightSample::TestVisibility(const Scene& scene, const IntersectionInfo& isect_obj,
                                      Workspace& workspace) const
     {
-        IntersectionInfo isect;
+        return !scene.Occluded(GenerateShadowRay(isect_obj.point),
+                               ShadowRayDistance(isect_obj.point), workspace);
+    }
+
+    float LightSample::ShadowRayDistance(const Vec3f& p) const
+    {
         switch (type_)
         {
         case LightType::DeltaPoint:
         case LightType::Area:
-        {
-            if (!scene.IntersectQuick(GenerateTestRay(isect_obj.point), workspace, isect))
-            {
-                // no intersection with original primitive
-                return false;
-            }
-
-            return isect_obj.iface == isect.iface &&
-                   SamePrimitive(isect_obj.primitive, isect.primitive) &&
-                   (isect.point - isect_obj.point).LengthSq() < 0.001f;
-        }
+            // stop right before the sampled point so that the light itself isn't an occluder
+            return (point_ - p).Length() - kTravelDistanceMin;
 
         case LightType::DeltaDirection:
         case LightType::Infinite:
-        {
-            return !scene.IntersectQuick(GenerateShadowRay(isect_obj.point), workspace, isect);
-        }
+            return kTravelDistanceMax;
 
         default:
             USAMI_IMPOSSIBLE();
@@ -0,0 +1,92 @@
+#include "usami/ray/light/infinite.h"
+#include "usami/color.h"
+#include "usami/texture/image.h"
+
+namespace usami::ray
+{
+    namespace
+    {
+        // resolution of the sampling distribution of textures without a known size, e.g.
+        // procedural ones
+        constexpr int kDefaultDistributionWidth  = 1024;
+        constexpr int kDefaultDistributionHeight = 512;
+    } // namespace
+
+    InfiniteAreaLight::InfiniteAreaLight(shared_ptr<Texture2D<Vec3f>> tex, float intensity,
+                                         Vec3f world_center, float world_radius)
+        : Light(LightType::Infinite), tex_(tex), intensity_(intensity),
+          world_center_(world_center), world_radius_(world_radius)
+    {
+        // one cell per texel for images, so that the distribution follows them exactly
+        int width  = kDefaultDistributionWidth;
+        int height = kDefaultDistributionHeight;
+        if (auto image = dynamic_cast<const ImageTexture*>(tex_.get()); image != nullptr)
+        {
+            width  = static_cast<int>(image->Width());
+            height = static_cast<int>(image->Height());
+        }
+
+        // a cell takes the largest luminance at its center and corners, so that it isn't
+        // under-sampled when only part of it covers a bright feature, or when texels of the image
+        // don't align with cells exactly. Rows are evaluated in parallel, as large maps have tens
+        // of millions of texels.
+        std::vector<float> func(static_cast<size_t>(width) * height);
+        ParallelFor(0, height, [&](size_t row) {
+            auto eval_luminance = [&](float u, float v) {
+                return Max(0.f, Luminance(tex_->Eval({u, Min(v, kOneMinusEpsilon)})));
+            };
+
+            float v_top     = static_cast<float>(row) / height;
+            float v_bottom  = static_cast<float>(row + 1) / height;
+            float v_center  = (row + .5f) / height;
+            float sin_theta = Sin(v_center * kPi);
+
+            float* row_func = func.data() + row * width;
+            float left_max  = Max(eval_luminance(0.f, v_top), eval_luminance(0.f, v_bottom));
+            for (int col = 0; col < width; ++col)
+            {
+                float u_right   = static_cast<float>(col + 1) / width;
+                float right_max = Max(eval_luminance(u_right, v_top),
+                                      eval_luminance(u_right, v_bottom));
+                float center    = eval_luminance((col + .5f) / width, v_center);
+
+                row_func[col] = Max({left_max, right_max, center}) * sin_theta;
+                left_max      = right_max;
+            }
+        });
+
+        distribution_.Reset(std::move(func), width, height);
+    }
+
+    LightSample InfiniteAreaLight::Sample(const IntersectionInfo& isect, const Point2f& u) const
+    {
+        float pdf_uv;
+        Point2f uv = distribution_.Sample(u, pdf_uv);
+        Vec3f wi   = UVToDirection(uv);
+
+        // map density over uv to solid angle, as dw = sin(theta) * dtheta * dphi, where theta and
+        // phi span pi and 2 * pi respectively
+        float sin_theta = Sin((1 - uv[1]) * kPi);
+        if (pdf_uv == 0 || sin_theta <= 0)
+        {
+            return LightSample{wi, isect.point, 0.f, 0.f, LightType::Infinite};
+        }
+
+        float pdf = pdf_uv / (2 * kPi * kPi * sin_theta);
+
+        // a point far beyond the world, so that shadow rays head towards `wi`
+        Vec3f point = isect.point + wi * (2 * world_radius_);
+        return LightSample{wi, point, Eval(wi), pdf, LightType::Infinite};
+    }
+
+    float InfiniteAreaLight::Pdf(const Vec3f& wi_world) const
+    {
+        float sin_theta = Sqrt(Max(0.f, 1 - wi_world.z * wi_world.z));
+        if (sin_theta == 0)
+        {
+            return 0.f;
+        }
+
+        return distribution_.Pdf(DirectionToUV(wi_world)) / (2 * kPi * kPi * sin_theta);
+    }
+} // namespace usami::ray
@@ -0,0 +1,344 @@
+#include "usami/ray/light_sampler/bvh.h"
+#include <algorithm>
+#include <array>
+#include <limits>
+
+namespace usami::ray
+{
+    static float SafeSqrt(float x)
+    {
+        return Sqrt(Max(x, 0.f));
+    }
+
+    static float SafeAcos(float x)
+    {
+        return std::acos(Clamp(x, -1.f, 1.f));
+    }
+
+    // cosine of max(0, theta_a - theta_b)
+    static float CosSubClamped(float sin_a, float cos_a, float sin_b, float cos_b)
+    {
+        return cos_a > cos_b ? 1.f : cos_a * cos_b + sin_a * sin_b;
+    }
+
+    // sine of max(0, theta_a - theta_b)
+    static float SinSubClamped(float sin_a, float cos_a, float sin_b, float cos_b)
+    {
+        return cos_a > cos_b ? 0.f : sin_a * cos_b - cos_a * sin_b;
+    }
+
+    void BvhLightSampler::Reset(std::span<const Light* const> lights)
+    {
+        bounded_lights_.clear();
+        infinite_lights_.clear();
+        nodes_.clear();
+        light_trails_.clear();
+
+        std::vector<std::pair<uint32_t, LightBounds>> items;
+        for (const Light* light : lights)
+        {
+            LightBounds bounds;
+            if (!light->Bounds(bounds))
+            {
+                infinite_lights_.push_back(light);
+            }
+            else if (bounds.phi > 0)
+            {
+                items.emplace_back(static_cast<uint32_t>(bounded_lights_.size()), bounds);
+                bounded_lights_.push_back(light);
+            }
+        }
+
+        if (!items.empty())
+        {
+            nodes_.reserve(2 * items.size() - 1);
+            light_trails_.reserve(items.size());
+            BuildNodes(items, 0, 0);
+        }
+    }
+
+    const Light* BvhLightSampler::Sample(const Vec3f& p, const Vec3f& n, float u,
+                                         float& pmf_out) const
+    {
+        float p_infinite = InfiniteProbability();
+        if (u < p_infinite)
+        {
+            size_t i = Min(static_cast<size_t>(u / p_infinite * infinite_lights_.size()),
+                           infinite_lights_.size() - 1);
+
+            pmf_out = p_infinite / infinite_lights_.size();
+            return infinite_lights_[i];
+        }
+
+        if (nodes_.empty())
+        {
+            pmf_out = 0;
+            return nullptr;
+        }
+
+        // descend by importance of children, reusing the sample at every level
+        u         = Min((u - p_infinite) / (1 - p_infinite), kOneMinusEpsilon);
+        float pmf = 1 - p_infinite;
+
+        uint32_t inode = 0;
+        while (!nodes_[inode].is_leaf)
+        {
+            const Node& node = nodes_[inode];
+
+            float importance0 = Importance(nodes_[inode + 1].bounds, p, n);
+            float importance1 = Importance(nodes_[node.index].bounds, p, n);
+            if (importance0 == 0 && importance1 == 0)
+            {
+                pmf_out = 0;
+                return nullptr;
+            }
+
+            float p0 = importance0 / (importance0 + importance1);
+            if (u < p0)
+            {
+                u     = Min(u / p0, kOneMinusEpsilon);
+                pmf   = pmf * p0;
+                inode = inode + 1;
+            }
+            else
+            {
+                u     = Min((u - p0) / (1 - p0), kOneMinusEpsilon);
+                pmf   = pmf * (1 - p0);
+                inode = node.index;
+            }
+        }
+
+        // a leaf below the root is only reached if it's important
+        if (inode == 0 && Importance(nodes_[0].bounds, p, n) == 0)
+        {
+            pmf_out = 0;
+            return nullptr;
+        }
+
+        pmf_out = pmf;
+        return bounded_lights_[nodes_[inode].index];
+    }
+
+    float BvhLightSampler::Pmf(const Vec3f& p, const Vec3f& n, const Light* light) const
+    {
+        float p_infinite = InfiniteProbability();
+
+        auto it = light_trails_.find(light);
+        if (it == light_trails_.end())
+        {
+            bool is_infinite = std::find(infinite_lights_.begin(), infinite_lights_.end(),
+                                         light) != infinite_lights_.end();
+            return is_infinite ? p_infinite / infinite_lights_.size() : 0.f;
+        }
+
+        // follow the path to the leaf the same way as `Sample` does
+        uint64_t trail = it->second;
+        float pmf      = 1 - p_infinite;
+
+        uint32_t inode = 0;
+        while (!nodes_[inode].is_leaf)
+        {
+            const Node& node = nodes_[inode];
+
+            float importance0 = Importance(nodes_[inode + 1].bounds, p, n);
+            float importance1 = Importance(nodes_[node.index].bounds, p, n);
+            if (importance0 == 0 && importance1 == 0)
+            {
+                return 0.f;
+            }
+
+            float p0 = importance0 / (importance0 + importance1);
+            if ((trail & 1) == 0)
+            {
+                pmf   = pmf * p0;
+                inode = inode + 1;
+            }
+            else
+            {
+                pmf   = pmf * (1 - p0);
+                inode = node.index;
+            }
+
+            trail >>= 1;
+        }
+
+        if (inode == 0 && Importance(nodes_[0].bounds, p, n) == 0)
+        {
+            return 0.f;
+        }
+
+        return pmf;
+    }
+
+    float BvhLightSampler::Importance(const LightBounds& bounds, const Vec3f& p, const Vec3f& n)
+    {
+        Vec3f pc      = bounds.bbox.Centroid();
+        float radius  = bounds.bbox.Extents().Length() * .5f;
+        float dist_sq = (p - pc).LengthSq();
+        float d_sq    = Max(dist_sq, radius);
+        Vec3f wi      = dist_sq > 0 ? (p - pc).Normalize() : Vec3f{0, 0, 1};
+
+        // angle between the axis of normals and direction from the center to the point
+        float cos_theta_w = Dot(bounds.normal.w, wi);
+        float sin_theta_w = SafeSqrt(1 - cos_theta_w * cos_theta_w);
+
+        // directions from points within the bounding sphere to the point are spread by theta_b,
+        // which covers all directions if the point is inside the sphere
+        float cos_theta_b = dist_sq < radius * radius ? -1.f
+                                                      : SafeSqrt(1 - radius * radius / dist_sq);
+        float sin_theta_b = SafeSqrt(1 - cos_theta_b * cos_theta_b);
+
+        // minimum angle between any normal and any direction from the bounds to the point,
+        // beyond which no light is emitted
+        float cos_theta_o = bounds.normal.cos_theta;
+        float sin_theta_o = SafeSqrt(1 - cos_theta_o * cos_theta_o);
+        float cos_theta_x = CosSubClamped(sin_theta_w, cos_theta_w, sin_theta_o, cos_theta_o);
+        float sin_theta_x = SinSubClamped(sin_theta_w, cos_theta_w, sin_theta_o, cos_theta_o);
+        float cos_theta_p = CosSubClamped(sin_theta_x, cos_theta_x, sin_theta_b, cos_theta_b);
+        if (cos_theta_p < bounds.cos_theta_e)
+        {
+            return 0.f;
+        }
+
+        float importance = bounds.phi * cos_theta_p / d_sq;
+
+        // minimum incident angle at the point, taking either side of the surface
+        if (n.LengthSq() > 0)
+        {
+            float cos_theta_i = Abs(Dot(wi, n));
+            float sin_theta_i = SafeSqrt(1 - cos_theta_i * cos_theta_i);
+
+            importance *= CosSubClamped(sin_theta_i, cos_theta_i, sin_theta_b, cos_theta_b);
+        }
+
+        return Max(importance, 0.f);
+    }
+
+    float BvhLightSampler::SplitCost(const LightBounds& bounds, const BoundingBox& parent_bbox,
+                                     int axis)
+    {
+        // solid angle measure of directions light is emitted towards
+        float theta_o     = SafeAcos(bounds.normal.cos_theta);
+        float theta_e     = SafeAcos(bounds.cos_theta_e);
+        float theta_w     = Min(theta_o + theta_e, kPi);
+        float sin_theta_o = SafeSqrt(1 - bounds.normal.cos_theta * bounds.normal.cos_theta);
+        float m_omega     = kTwoPi * (1 - bounds.normal.cos_theta) +
+                        kHalfPi * (2 * theta_w * sin_theta_o - Cos(theta_o - 2 * theta_w) -
+                                   2 * theta_o * sin_theta_o + bounds.normal.cos_theta);
+
+        // penalize thin slices across the longest axis of the parent
+        Vec3f extents = parent_bbox.Extents();
+        float k_r     = Max(extents[0], Max(extents[1], extents[2])) / extents[axis];
+
+        return bounds.phi * m_omega * k_r * bounds.bbox.Area();
+    }
+
+    uint32_t BvhLightSampler::BuildNodes(std::span<std::pair<uint32_t, LightBounds>> items,
+                                         uint64_t trail, int depth)
+    {
+        USAMI_ASSERT(depth < 64);
+
+        uint32_t inode = static_cast<uint32_t>(nodes_.size());
+        if (items.size() == 1)
+        {
+            nodes_.push_back(
+                Node{.bounds = items[0].second, .index = items[0].first, .is_leaf = true});
+            light_trails_[bounded_lights_[items[0].first]] = trail;
+            return inode;
+        }
+
+        LightBounds bounds;
+        BoundingBox centroid_bbox = BoundingBox::Empty();
+        for (const auto& [index, item_bounds] : items)
+        {
+            bounds        = UnionLightBounds(bounds, item_bounds);
+            centroid_bbox = UnionBBox(centroid_bbox, item_bounds.bbox.Centroid());
+        }
+
+        auto bucket_of = [&](const LightBounds& item_bounds, int axis) {
+            float c_min  = centroid_bbox.p_min[axis];
+            float extent = centroid_bbox.p_max[axis] - c_min;
+            int ibucket  = static_cast<int>(kNumSplitBucket *
+                                           (item_bounds.bbox.Centroid()[axis] - c_min) / extent);
+            return Clamp(ibucket, 0, kNumSplitBucket - 1);
+        };
+
+        // find the split between buckets of centroids with the least cost, unless the tree grows
+        // too deep, e.g. over point lights whose costs are all zero
+        float min_cost = std::numeric_limits<float>::infinity();
+        int min_axis   = -1;
+        int min_bucket = -1;
+        for (int axis = 0; axis < 3 && depth < kMaxCostSplitDepth; ++axis)
+        {
+            if (centroid_bbox.p_max[axis] == centroid_bbox.p_min[axis])
+            {
+                continue;
+            }
+
+            std::array<LightBounds, kNumSplitBucket> buckets;
+            for (const auto& [index, item_bounds] : items)
+            {
+                LightBounds& bucket = buckets[bucket_of(item_bounds, axis)];
+                bucket              = UnionLightBounds(bucket, item_bounds);
+            }
+
+            // bounds of buckets above each split
+            std::array<LightBounds, kNumSplitBucket> above;
+            above[kNumSplitBucket - 1] = buckets[kNumSplitBucket - 1];
+            for (int i = kNumSplitBucket - 2; i > 0; --i)
+            {
+                above[i] = UnionLightBounds(buckets[i], above[i + 1]);
+            }
+
+            LightBounds below;
+            for (int i = 0; i < kNumSplitBucket - 1; ++i)
+            {
+                below = UnionLightBounds(below, buckets[i]);
+                if (below.phi == 0 || above[i + 1].phi == 0)
+                {
+                    continue;
+                }
+
+                float cost = SplitCost(below, bounds.bbox, axis) +
+                             SplitCost(above[i + 1], bounds.bbox, axis);
+                if (cost < min_cost)
+                {
+                    min_cost   = cost;
+                    min_axis   = axis;
+                    min_bucket = i;
+                }
+            }
+        }
+
+        size_t mid = items.size() / 2;
+        if (min_axis != -1)
+        {
+            auto it = std::partition(items.begin(), items.end(), [&](const auto& item) {
+                return bucket_of(item.second, min_axis) <= min_bucket;
+            });
+
+            mid = static_cast<size_t>(it - items.begin());
+        }
+        else
+        {
+            // otherwise split by count along the longest axis of centroids
+            Vec3f extents = centroid_bbox.Extents();
+            int axis      = extents[0] > extents[1] ? (extents[0] > extents[2] ? 0 : 2)
+                                                    : (extents[1] > extents[2] ? 1 : 2);
+
+            std::nth_element(items.begin(), items.begin() + mid, items.end(),
+                             [axis](const auto& a, const auto& b) {
+                                 return a.second.bbox.Centroid()[axis] <
+                                        b.second.bbox.Centroid()[axis];
+                             });
+        }
+
+        nodes_.push_back(Node{.bounds = bounds, .index = 0, .is_leaf = false});
+        BuildNodes(items.first(mid), trail, depth + 1);
+
+        uint32_t second =
+            BuildNodes(items.subspan(mid), trail | (uint64_t{1} << depth), depth + 1);
+        nodes_[inode].index = second;
+        return inode;
+    }
+} // namespace usami::ray
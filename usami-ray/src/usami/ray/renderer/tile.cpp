@@ -0,0 +1,77 @@
+#include "usami/ray/renderer/tile.h"
+#include "usami/parallel/parallel_for.h"
+#include <vector>
+
+namespace usami::ray
+{
+    TileRenderer::TileRenderer(TileRenderSetting setting) : setting_(setting)
+    {
+        USAMI_REQUIRE(setting_.tile_size > 0 && setting_.num_sample > 0);
+    }
+
+    void TileRenderer::Render(Canvas& canvas, const PerspectiveCamera& camera, const Scene& scene,
+                              const Integrator& integrator) const
+    {
+        int num_tile_x = (canvas.Width() + setting_.tile_size - 1) / setting_.tile_size;
+        int num_tile_y = (canvas.Height() + setting_.tile_size - 1) / setting_.tile_size;
+        int num_tile   = num_tile_x * num_tile_y;
+
+        // contexts are created lazily as a worker may receive no tile at all
+        ThreadPool& pool = ThreadPool::Global();
+        std::vector<unique_ptr<RenderingContext>> contexts(pool.NumWorkerSlots());
+
+        // NOTE chunks are split in halves, so a worker starts on a contiguous range of nearby tiles
+        // while idle workers steal the remaining ones
+        ParallelFor(
+            0, num_tile, 1,
+            [&](size_t index) {
+                auto& ctx = contexts[pool.CurrentWorkerIndex()];
+                if (ctx == nullptr)
+                {
+                    ctx = make_unique<RenderingContext>();
+                }
+
+                RenderTile(*ctx, canvas, GetTile(canvas, static_cast<int>(index)), camera, scene,
+                           integrator);
+            },
+            pool);
+    }
+
+    TileRenderer::Tile TileRenderer::GetTile(const Canvas& canvas, int index) const noexcept
+    {
+        int num_tile_x = (canvas.Width() + setting_.tile_size - 1) / setting_.tile_size;
+
+        int x_begin = (index % num_tile_x) * setting_.tile_size;
+        int y_begin = (index / num_tile_x) * setting_.tile_size;
+        return Tile{
+            .x_begin = x_begin,
+            .y_begin = y_begin,
+            .x_end   = Min(x_begin + setting_.tile_size, canvas.Width()),
+            .y_end   = Min(y_begin + setting_.tile_size, canvas.Height()),
+        };
+    }
+
+    void TileRenderer::RenderTile(RenderingContext& ctx, Canvas& canvas, const Tile& tile,
+                                  const PerspectiveCamera& camera, const Scene& scene,
+                                  const Integrator& integrator) const
+    {
+        for (int y = tile.y_begin; y < tile.y_end; ++y)
+        {
+            for (int x = tile.x_begin; x < tile.x_end; ++x)
+            {
+                // sampler is seeded per pixel so that result doesn't depend on scheduling
+                uint64_t pixel_index = static_cast<uint64_t>(y) * canvas.Width() + x;
+                Sampler sampler{MixSeed(setting_.seed, pixel_index)};
+
+                SpectrumRGB pixel_radiance = 0.f;
+                for (int i = 0; i < setting_.num_sample; ++i)
+                {
+                    Ray camera_ray = camera.SpawnRay({x, y}, sampler.Get2D());
+                    pixel_radiance += integrator.Li(ctx, sampler, scene, camera_ray);
+                }
+
+                canvas.AppendPixel(x, y, pixel_radiance);
+            }
+        }
+    }
+} // namespace usami::ray
@@ -0,0 +1,38 @@
+#include "usami/ray/scene.h"
+
+namespace usami::ray
+{
+    void Scene::IntersectBatch(std::span<const Ray> rays, RayCoherence coherence,
+                               Workspace& workspace, HitBuffer& hits) const
+    {
+        hits.Resize(rays.size());
+        for (size_t i = 0; i < rays.size(); ++i)
+        {
+            workspace.Clear();
+
+            IntersectionInfo isect;
+            if (Intersect(rays[i], workspace, isect))
+            {
+                hits.Store(i, isect);
+            }
+            else
+            {
+                hits.StoreMiss(i);
+            }
+        }
+    }
+
+    void Scene::OccludedBatch(std::span<const Ray> rays, std::span<const float> t_max,
+                              RayCoherence coherence, Workspace& workspace,
+                              std::span<uint8_t> occluded_out) const
+    {
+        USAMI_REQUIRE(t_max.size() == rays.size() && occluded_out.size() == rays.size());
+
+        for (size_t i = 0; i < rays.size(); ++i)
+        {
+            workspace.Clear();
+
+            occluded_out[i] = Occluded(rays[i], t_max[i], workspace);
+        }
+    }
+} // namespace usami::ray
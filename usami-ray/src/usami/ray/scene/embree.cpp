@@ -1,7 +1,10 @@
 #include "usami/ray/scene/embree.h"
 #include "usami/ray/material/diffuse.h"
 #include "usami/ray/light/diffuse.h"
+#include "usami/ray/shape/triangle.h"
+#include "usami/parallel/thread_pool.h"
 #include <embree3/rtcore.h>
+#include <array>
 #include <ranges>
 #include <algorithm>
 
@@ -15,7 +18,10 @@ namespace usami::ray
         {
             if (embree_device == nullptr)
             {
-                embree_device = rtcNewDevice(nullptr);
+                // share thread budget with the global pool instead of spawning a thread for
+                // every hardware thread on top of it
+                std::string config = fmt::format("threads={}", ThreadPool::GlobalThreadCount());
+                embree_device = rtcNewDevice(config.c_str());
             }
 
             USAMI_REQUIRE(embree_device != nullptr);
@@ -32,11 +38,89 @@ namespace usami::ray
             }
         }
 
-        RTCRayHit CreateEmptyRayHit(const Ray& us_ray)
+        // number of rays in a packet for coherent queries, i.e. the widest one that the isa
+        // embree is compiled for supports natively, see `EmbreePacket`
+        size_t SelectPacketSize(RTCDevice device)
         {
-            RTCRayHit result;
-            auto& ray = result.ray;
-            auto& hit = result.hit;
+            if (rtcGetDeviceProperty(device, RTC_DEVICE_PROPERTY_NATIVE_RAY16_SUPPORTED))
+            {
+                return 16;
+            }
+            else if (rtcGetDeviceProperty(device, RTC_DEVICE_PROPERTY_NATIVE_RAY8_SUPPORTED))
+            {
+                return 8;
+            }
+            else
+            {
+                // NOTE embree emulates packets if not supported natively
+                return 4;
+            }
+        }
+
+        // ray packet types and queries of embree by packet size
+        template <size_t N>
+        struct EmbreePacket;
+
+        template <>
+        struct EmbreePacket<4>
+        {
+            using RayType    = RTCRay4;
+            using RayHitType = RTCRayHit4;
+
+            static void Intersect(const int* valid, RTCScene scene, RTCIntersectContext* ctx,
+                                  RayHitType* ray_hit)
+            {
+                rtcIntersect4(valid, scene, ctx, ray_hit);
+            }
+            static void Occluded(const int* valid, RTCScene scene, RTCIntersectContext* ctx,
+                                 RayType* ray)
+            {
+                rtcOccluded4(valid, scene, ctx, ray);
+            }
+        };
+
+        template <>
+        struct EmbreePacket<8>
+        {
+            using RayType    = RTCRay8;
+            using RayHitType = RTCRayHit8;
+
+            static void Intersect(const int* valid, RTCScene scene, RTCIntersectContext* ctx,
+                                  RayHitType* ray_hit)
+            {
+                rtcIntersect8(valid, scene, ctx, ray_hit);
+            }
+            static void Occluded(const int* valid, RTCScene scene, RTCIntersectContext* ctx,
+                                 RayType* ray)
+            {
+                rtcOccluded8(valid, scene, ctx, ray);
+            }
+        };
+
+        template <>
+        struct EmbreePacket<16>
+        {
+            using RayType    = RTCRay16;
+            using RayHitType = RTCRayHit16;
+
+            static void Intersect(const int* valid, RTCScene scene, RTCIntersectContext* ctx,
+                                  RayHitType* ray_hit)
+            {
+                rtcIntersect16(valid, scene, ctx, ray_hit);
+            }
+            static void Occluded(const int* valid, RTCScene scene, RTCIntersectContext* ctx,
+                                 RayType* ray)
+            {
+                rtcOccluded16(valid, scene, ctx, ray);
+            }
+        };
+
+        // number of rays submitted at once as a stream for incoherent queries
+        constexpr size_t kEmbreeStreamSize = 64;
+
+        RTCRay CreateEmptyRay(const Ray& us_ray, float t_max = kTravelDistanceMax)
+        {
+            RTCRay ray;
 
             ray.org_x = us_ray.o.x;
             ray.org_y = us_ray.o.y;
@@ -48,24 +132,181 @@ namespace usami::ray
             ray.dir_z = us_ray.d.z;
             ray.time  = 0.f;
 
-            ray.tfar  = kTravelDistanceMax;
+            ray.tfar  = t_max;
             ray.mask  = 0u;
             ray.id    = 0u;
             ray.flags = 0u;
 
+            return ray;
+        }
+
+        RTCRayHit CreateEmptyRayHit(const Ray& us_ray)
+        {
+            RTCRayHit result;
+            auto& hit = result.hit;
+
+            result.ray = CreateEmptyRay(us_ray);
+
             hit.instID[0] = RTC_INVALID_GEOMETRY_ID;
             hit.geomID    = RTC_INVALID_GEOMETRY_ID;
             hit.primID    = RTC_INVALID_GEOMETRY_ID;
 
             return result;
         }
+
+        // write a ray into a lane of a ray packet, e.g. RTCRay8
+        template <typename TRayN>
+        void SetPacketRay(TRayN& ray, size_t lane, const Ray& us_ray, float t_max)
+        {
+            ray.org_x[lane] = us_ray.o.x;
+            ray.org_y[lane] = us_ray.o.y;
+            ray.org_z[lane] = us_ray.o.z;
+            ray.tnear[lane] = kTravelDistanceMin;
+
+            ray.dir_x[lane] = us_ray.d.x;
+            ray.dir_y[lane] = us_ray.d.y;
+            ray.dir_z[lane] = us_ray.d.z;
+            ray.time[lane]  = 0.f;
+
+            ray.tfar[lane]  = t_max;
+            ray.mask[lane]  = 0u;
+            ray.id[lane]    = static_cast<unsigned>(lane);
+            ray.flags[lane] = 0u;
+        }
+
+        // write a ray into a lane of a ray-hit packet, e.g. RTCRayHit8
+        template <typename TRayHitN>
+        void SetPacketRayHit(TRayHitN& ray_hit, size_t lane, const Ray& us_ray)
+        {
+            SetPacketRay(ray_hit.ray, lane, us_ray, kTravelDistanceMax);
+
+            ray_hit.hit.instID[0][lane] = RTC_INVALID_GEOMETRY_ID;
+            ray_hit.hit.geomID[lane]    = RTC_INVALID_GEOMETRY_ID;
+            ray_hit.hit.primID[lane]    = RTC_INVALID_GEOMETRY_ID;
+        }
+
+        // affine transformation in the layout of RTC_FORMAT_FLOAT3X4_ROW_MAJOR
+        std::array<float, 12> ToEmbreeTransform(const Matrix4& m)
+        {
+            std::array<float, 16> elements = m.ToArray();
+            USAMI_ASSERT(elements[12] == 0 && elements[13] == 0 && elements[14] == 0 &&
+                         elements[15] == 1);
+
+            std::array<float, 12> result;
+            std::copy_n(elements.begin(), 12, result.begin());
+            return result;
+        }
+
+        BoundingBox ToBoundingBox(const RTCBounds& bounds)
+        {
+            return BoundingBox{Vec3f{bounds.lower_x, bounds.lower_y, bounds.lower_z},
+                               Vec3f{bounds.upper_x, bounds.upper_y, bounds.upper_z}};
+        }
+
+        // sum of surface area of triangle bounds over that of the mesh, which grows as triangles
+        // stretch and overlap each other. It's a proxy of vertex deformation only, and invariant
+        // under rigid transforms of the mesh
+        float ComputeMeshCost(const SceneMesh& mesh)
+        {
+            if (mesh.num_face == 0)
+            {
+                return 0;
+            }
+
+            BoundingBox bbox_mesh = Vec3f{};
+            float area_sum        = 0;
+            for (int i = 0; i < mesh.num_face; ++i)
+            {
+                auto [v0, v1, v2] = mesh.GetTriangleVertices(i).vertices;
+                BoundingBox bbox  = shape::Triangle{v0, v1, v2}.Bounding();
+
+                bbox_mesh = i == 0 ? bbox : UnionBBox(bbox_mesh, bbox);
+                area_sum += bbox.Area();
+            }
+
+            float area_mesh = bbox_mesh.Area();
+            return area_mesh > 0 ? area_sum / area_mesh : 0.f;
+        }
+
+        void InitIntersectContext(RTCIntersectContext& ctx, RayCoherence coherence)
+        {
+            rtcInitIntersectContext(&ctx);
+            ctx.flags = coherence == RayCoherence::Coherent ? RTC_INTERSECT_CONTEXT_FLAG_COHERENT
+                                                            : RTC_INTERSECT_CONTEXT_FLAG_INCOHERENT;
+        }
+
+        // trace rays as packets of N rays, so that nodes are visited once for rays in a packet
+        template <size_t N, typename F>
+        void IntersectPackets(RTCScene scene, RTCIntersectContext& ctx, std::span<const Ray> rays,
+                              const F& store_result)
+        {
+            using Packet = EmbreePacket<N>;
+
+            for (size_t begin = 0; begin < rays.size(); begin += N)
+            {
+                size_t count = Min(N, rays.size() - begin);
+
+                // NOTE embree loads the valid mask with aligned loads of the packet width
+                typename Packet::RayHitType packet;
+                alignas(sizeof(int) * N) int valid[N];
+                for (size_t lane = 0; lane < N; ++lane)
+                {
+                    valid[lane] = lane < count ? -1 : 0;
+                    SetPacketRayHit(packet, lane, rays[begin + Min(lane, count - 1)]);
+                }
+
+                Packet::Intersect(valid, scene, &ctx, &packet);
+
+                const auto& hit = packet.hit;
+                for (size_t lane = 0; lane < count; ++lane)
+                {
+                    Vec3f ng = Vec3f{hit.Ng_x[lane], hit.Ng_y[lane], hit.Ng_z[lane]};
+                    store_result(begin + lane, packet.ray.tfar[lane], ng, hit.u[lane], hit.v[lane],
+                                 hit.geomID[lane], hit.primID[lane]);
+                }
+            }
+        }
+
+        template <size_t N>
+        void OccludedPackets(RTCScene scene, RTCIntersectContext& ctx, std::span<const Ray> rays,
+                             std::span<const float> t_max, std::span<uint8_t> occluded_out)
+        {
+            using Packet = EmbreePacket<N>;
+
+            for (size_t begin = 0; begin < rays.size(); begin += N)
+            {
+                size_t count = Min(N, rays.size() - begin);
+
+                typename Packet::RayType packet;
+                alignas(sizeof(int) * N) int valid[N];
+                for (size_t lane = 0; lane < N; ++lane)
+                {
+                    size_t i    = begin + Min(lane, count - 1);
+                    valid[lane] = lane < count ? -1 : 0;
+                    SetPacketRay(packet, lane, rays[i], t_max[i]);
+                }
+
+                Packet::Occluded(valid, scene, &ctx, &packet);
+
+                // NOTE embree sets tfar to -inf for an occluded ray
+                for (size_t lane = 0; lane < count; ++lane)
+                {
+                    occluded_out[begin + lane] = packet.tfar[lane] < 0.f;
+                }
+            }
+        }
     } // namespace
 
-    EmbreeScene::EmbreeScene()
+    EmbreeScene::EmbreeScene(bool dynamic) : dynamic_(dynamic)
     {
         auto device = GetEmbreeDevice();
 
-        scene_ = rtcNewScene(device);
+        scene_       = rtcNewScene(device);
+        packet_size_ = SelectPacketSize(device);
+        if (dynamic_)
+        {
+            rtcSetSceneFlags(scene_, RTC_SCENE_FLAG_DYNAMIC);
+        }
     }
 
     EmbreeScene::~EmbreeScene()
@@ -77,8 +318,147 @@ namespace usami::ray
     {
         rtcSetSceneBuildQuality(scene_, RTC_BUILD_QUALITY_HIGH);
         rtcCommitScene(scene_);
+        build_cost_ = ComputeInstanceCost();
 
         Scene::Commit();
+        lights_moved_ = false;
+    }
+
+    void EmbreeScene::Refit(std::span<const SceneMesh* const> deformed_meshes)
+    {
+        USAMI_REQUIRE(dynamic_);
+
+        for (const SceneMesh* mesh : deformed_meshes)
+        {
+            auto it_registry =
+                std::ranges::find_if(models_, [mesh](const EmbreeRegisteredModel& registry) {
+                    return registry.mesh_instance_cache.contains(mesh);
+                });
+            USAMI_REQUIRE(it_registry != models_.end());
+
+            RTCScene instanced_scene = it_registry->mesh_instance_cache.at(mesh);
+            RTCGeometry rtc_geom     = rtcGetGeometry(instanced_scene, 0);
+
+            float cost        = ComputeMeshCost(*mesh);
+            float& build_cost = it_registry->mesh_build_cost[mesh];
+            int& refit_count  = it_registry->mesh_refit_count[mesh];
+            if (cost > build_cost * kMaxRefitCostRatio || refit_count >= kMaxRefitCount)
+            {
+                rtcSetGeometryBuildQuality(rtc_geom, RTC_BUILD_QUALITY_HIGH);
+                build_cost  = cost;
+                refit_count = 0;
+            }
+            else
+            {
+                rtcSetGeometryBuildQuality(rtc_geom, RTC_BUILD_QUALITY_REFIT);
+                refit_count += 1;
+            }
+
+            rtcUpdateGeometryBuffer(rtc_geom, RTC_BUFFER_TYPE_VERTEX, 0);
+            rtcCommitGeometry(rtc_geom);
+            rtcCommitScene(instanced_scene);
+        }
+
+        // NOTE instances have to be recommitted after their instanced scenes change
+        for (EmbreeMeshGeometry* geom : geom_lookup_)
+        {
+            if (std::ranges::find(deformed_meshes, geom->mesh_) != deformed_meshes.end())
+            {
+                rtcCommitGeometry(rtcGetGeometry(scene_, geom->Id()));
+
+                if (geom->ContainAreaLight())
+                {
+                    UpdateLightPrimitives(*geom);
+                    lights_moved_ = true;
+                }
+            }
+        }
+
+        // bounds and power of moved lights have changed
+        if (lights_moved_)
+        {
+            UpdateLightDistribution();
+            lights_moved_ = false;
+        }
+
+        // embree doesn't refit instances, but a low quality build over them is cheap
+        float cost = ComputeInstanceCost();
+        if (cost > build_cost_ * kMaxRefitCostRatio)
+        {
+            rtcSetSceneBuildQuality(scene_, RTC_BUILD_QUALITY_HIGH);
+            build_cost_ = cost;
+        }
+        else
+        {
+            rtcSetSceneBuildQuality(scene_, RTC_BUILD_QUALITY_LOW);
+        }
+
+        rtcCommitScene(scene_);
+    }
+
+    void EmbreeScene::SetTransform(int geom_id, const Matrix4& model_to_world)
+    {
+        EmbreeMeshGeometry* geom = geom_lookup_[geom_id];
+        geom->model_to_world_    = model_to_world;
+        geom->normal_to_world_   = model_to_world.Inverse().Transpose();
+
+        RTCGeometry rtc_geom      = rtcGetGeometry(scene_, geom_id);
+        std::array<float, 12> mat = ToEmbreeTransform(model_to_world);
+        rtcSetGeometryTransform(rtc_geom, 0, RTC_FORMAT_FLOAT3X4_ROW_MAJOR, mat.data());
+        rtcCommitGeometry(rtc_geom);
+
+        if (geom->ContainAreaLight())
+        {
+            UpdateLightPrimitives(*geom);
+            lights_moved_ = true;
+        }
+    }
+
+    void EmbreeScene::UpdateLightPrimitives(EmbreeMeshGeometry& geometry)
+    {
+        // NOTE area lights refer to these triangles, so they are updated in place
+        for (EmbreeTriangle* primitive : geometry.light_primitives)
+        {
+            CreatePrimitiveAux(*primitive, primitive->geom_id_, primitive->prim_id_,
+                               geometry.Mesh().GetTriangle(primitive->prim_id_));
+        }
+    }
+
+    float EmbreeScene::ComputeInstanceCost() const
+    {
+        RTCBounds scene_bounds;
+        rtcGetSceneBounds(scene_, &scene_bounds);
+
+        float area_scene = ToBoundingBox(scene_bounds).Area();
+        if (area_scene <= 0)
+        {
+            return 0;
+        }
+
+        float area_sum = 0;
+        for (const EmbreeMeshGeometry* geom : geom_lookup_)
+        {
+            RTCBounds mesh_bounds;
+            rtcGetSceneBounds(geom->instanced_scene_, &mesh_bounds);
+
+            // bound all corners of the box in model space
+            BoundingBox bbox_model = ToBoundingBox(mesh_bounds);
+            BoundingBox bbox_world = Vec3f{};
+            for (int i = 0; i < 8; ++i)
+            {
+                Vec3f corner{(i & 1) ? bbox_model.p_max[0] : bbox_model.p_min[0],
+                             (i & 2) ? bbox_model.p_max[1] : bbox_model.p_min[1],
+                             (i & 4) ? bbox_model.p_max[2] : bbox_model.p_min[2]};
+
+                Vec3f corner_world = geom->model_to_world_.ApplyPoint(corner);
+                bbox_world         = i == 0 ? BoundingBox{corner_world}
+                                            : UnionBBox(bbox_world, BoundingBox{corner_world});
+            }
+
+            area_sum += bbox_world.Area();
+        }
+
+        return area_sum / area_scene;
     }
 
     bool EmbreeScene::Intersect(const Ray& ray, Workspace& workspace, IntersectionInfo& isect) const
@@ -99,57 +479,135 @@ namespace usami::ray
             return false;
         }
 
-        const EmbreeMeshGeometry* geometry = geom_lookup_[geom_id];
+        Vec3f ng = Vec3f{ray_hit.hit.Ng_x, ray_hit.hit.Ng_y, ray_hit.hit.Ng_z};
+        ResolveHit(ray, ray_hit.ray.tfar, ng, ray_hit.hit.u, ray_hit.hit.v, geom_id, prim_id,
+                   isect);
 
-        isect.t     = ray_hit.ray.tfar;
-        isect.point = ray.o + isect.t * ray.d;
-        isect.ng    = Vec3f{ray_hit.hit.Ng_x, ray_hit.hit.Ng_y, ray_hit.hit.Ng_z}.Normalize();
+        const TriangleDesc tri_desc = geom_lookup_[geom_id]->Mesh().GetTriangle(prim_id);
+        isect.primitive = InstantiateTemporaryPrimitive(workspace, geom_id, prim_id, tri_desc);
 
-        const TriangleDesc tri_desc = geometry->Mesh().GetTriangle(prim_id);
+        return true;
+    }
 
-        // override shading normal
-        if (tri_desc.has_normal)
-        {
-            Vec3f n0 = tri_desc.normals[0];
-            Vec3f n1 = tri_desc.normals[1];
-            Vec3f n2 = tri_desc.normals[2];
+    bool EmbreeScene::Occluded(const Ray& ray, float t_max, Workspace& workspace) const
+    {
+        RTCIntersectContext ctx;
+        rtcInitIntersectContext(&ctx);
+
+        RTCRay rtc_ray = CreateEmptyRay(ray, t_max);
+        rtcOccluded1(scene_, &ctx, &rtc_ray);
 
-            auto uu = ray_hit.hit.u;
-            auto vv = ray_hit.hit.v;
-            auto ww = 1 - uu - vv;
+        // NOTE embree sets tfar to -inf for an occluded ray
+        return rtc_ray.tfar < 0.f;
+    }
 
-            // TODO: needs to be converted into world coordinate
-            isect.ns = geometry->Transform().ApplyVector(ww * n0 + uu * n1 + vv * n2).Normalize();
+    void EmbreeScene::IntersectBatch(std::span<const Ray> rays, RayCoherence coherence,
+                                     Workspace& workspace, HitBuffer& hits) const
+    {
+        hits.Resize(rays.size());
+
+        RTCIntersectContext ctx;
+        InitIntersectContext(ctx, coherence);
+
+        auto store_result = [&](size_t i, float t, Vec3f ng, float u, float v, unsigned geom_id,
+                                unsigned prim_id) {
+            if (geom_id == RTC_INVALID_GEOMETRY_ID)
+            {
+                hits.StoreMiss(i);
+                return;
+            }
+
+            IntersectionInfo isect;
+            ResolveHit(rays[i], t, ng, u, v, geom_id, prim_id, isect);
+            hits.Store(i, isect);
+        };
+
+        if (coherence == RayCoherence::Coherent)
+        {
+            switch (packet_size_)
+            {
+            case 16:
+                IntersectPackets<16>(scene_, ctx, rays, store_result);
+                break;
+            case 8:
+                IntersectPackets<8>(scene_, ctx, rays, store_result);
+                break;
+            default:
+                IntersectPackets<4>(scene_, ctx, rays, store_result);
+                break;
+            }
         }
         else
         {
-            isect.ns = isect.ng;
+            // trace as a stream of single rays, letting embree reorder them
+            std::array<RTCRayHit, kEmbreeStreamSize> stream;
+            for (size_t begin = 0; begin < rays.size(); begin += kEmbreeStreamSize)
+            {
+                size_t count = Min(kEmbreeStreamSize, rays.size() - begin);
+                for (size_t k = 0; k < count; ++k)
+                {
+                    stream[k] = CreateEmptyRayHit(rays[begin + k]);
+                }
+
+                rtcIntersect1M(scene_, &ctx, stream.data(), static_cast<unsigned>(count),
+                               sizeof(RTCRayHit));
+
+                for (size_t k = 0; k < count; ++k)
+                {
+                    const RTCHit& hit = stream[k].hit;
+
+                    Vec3f ng = Vec3f{hit.Ng_x, hit.Ng_y, hit.Ng_z};
+                    store_result(begin + k, stream[k].ray.tfar, ng, hit.u, hit.v, hit.geomID,
+                                 hit.primID);
+                }
+            }
         }
+    }
 
-        // override texture coordinate
-        if (tri_desc.has_tex_coord)
-        {
-            Vec2f uv0 = tri_desc.tex_coords[0];
-            Vec2f uv1 = tri_desc.tex_coords[1];
-            Vec2f uv2 = tri_desc.tex_coords[2];
+    void EmbreeScene::OccludedBatch(std::span<const Ray> rays, std::span<const float> t_max,
+                                    RayCoherence coherence, Workspace& workspace,
+                                    std::span<uint8_t> occluded_out) const
+    {
+        USAMI_REQUIRE(t_max.size() == rays.size() && occluded_out.size() == rays.size());
 
-            auto uu = ray_hit.hit.u;
-            auto vv = ray_hit.hit.v;
-            auto ww = 1 - uu - vv;
+        RTCIntersectContext ctx;
+        InitIntersectContext(ctx, coherence);
 
-            isect.uv = ww * uv0 + uu * uv1 + vv * uv2;
+        if (coherence == RayCoherence::Coherent)
+        {
+            switch (packet_size_)
+            {
+            case 16:
+                OccludedPackets<16>(scene_, ctx, rays, t_max, occluded_out);
+                break;
+            case 8:
+                OccludedPackets<8>(scene_, ctx, rays, t_max, occluded_out);
+                break;
+            default:
+                OccludedPackets<4>(scene_, ctx, rays, t_max, occluded_out);
+                break;
+            }
         }
         else
         {
-            isect.uv = {ray_hit.hit.u, ray_hit.hit.v};
-        }
+            std::array<RTCRay, kEmbreeStreamSize> stream;
+            for (size_t begin = 0; begin < rays.size(); begin += kEmbreeStreamSize)
+            {
+                size_t count = Min(kEmbreeStreamSize, rays.size() - begin);
+                for (size_t k = 0; k < count; ++k)
+                {
+                    stream[k] = CreateEmptyRay(rays[begin + k], t_max[begin + k]);
+                }
 
-        isect.iface      = prim_id;
-        isect.primitive  = InstantiateTemporaryPrimitive(workspace, geom_id, prim_id, tri_desc);
-        isect.area_light = geometry->GetAreaLight(prim_id);
-        isect.material   = geometry->GetMaterial();
+                rtcOccluded1M(scene_, &ctx, stream.data(), static_cast<unsigned>(count),
+                              sizeof(RTCRay));
 
-        return true;
+                for (size_t k = 0; k < count; ++k)
+                {
+                    occluded_out[begin + k] = stream[k].tfar < 0.f;
+                }
+            }
+        }
     }
 
     void EmbreeScene::AddModel(shared_ptr<SceneModel> model, const Matrix4& model_to_world)
@@ -187,16 +645,28 @@ namespace usami::ray
                                        vertex_buf.buffer->stride,
                                        vertex_buf.buffer->size / vertex_buf.buffer->stride);
 
-            // finalize geometry
+            // finalize geometry, where the first build of a refittable one is a full build
+            if (dynamic_)
+            {
+                rtcSetGeometryBuildQuality(rtc_geom, RTC_BUILD_QUALITY_REFIT);
+            }
             rtcCommitGeometry(rtc_geom);
             rtcAttachGeometry(instance_scene, rtc_geom);
             // rtcReleaseGeometry(rtc_geom);
 
             // finalize scene
+            if (dynamic_)
+            {
+                rtcSetSceneFlags(instance_scene, RTC_SCENE_FLAG_DYNAMIC);
+            }
             rtcSetSceneBuildQuality(instance_scene, RTC_BUILD_QUALITY_HIGH);
             rtcCommitScene(instance_scene);
 
             model_registry.mesh_instance_cache.insert(std::pair{mesh.get(), instance_scene});
+            if (dynamic_)
+            {
+                model_registry.mesh_build_cost[mesh.get()] = ComputeMeshCost(*mesh);
+            }
         }
 
         for (const SceneNode* root_node : model->roots)
@@ -213,7 +683,7 @@ namespace usami::ray
         const Matrix4& global_transform = parent_transform.Then(node->transform);
         if (node->mesh != nullptr)
         {
-            AddMeshGeometry(node->mesh, parent_transform, registry);
+            AddMeshGeometry(node->mesh, global_transform, registry);
         }
 
         for (const SceneNode* child_node : node->children)
@@ -228,20 +698,20 @@ namespace usami::ray
         EmbreeMeshGeometry* geom = arena_.Construct<EmbreeMeshGeometry>();
 
         // book-keeping
-        geom->id_             = geom_lookup_.size();
-        geom->mesh_           = mesh;
-        geom->model_to_world_ = model_to_world;
+        geom->id_              = geom_lookup_.size();
+        geom->mesh_            = mesh;
+        geom->instanced_scene_ = registry.mesh_instance_cache.at(mesh);
+        geom->model_to_world_  = model_to_world;
+        geom->normal_to_world_ = model_to_world.Inverse().Transpose();
         geom_lookup_.push_back(geom);
 
         // register geometry into embree
         RTCGeometry rtc_geom = rtcNewGeometry(GetEmbreeDevice(), RTC_GEOMETRY_TYPE_INSTANCE);
-        rtcSetGeometryInstancedScene(rtc_geom, registry.mesh_instance_cache.at(mesh));
+        rtcSetGeometryInstancedScene(rtc_geom, geom->instanced_scene_);
 
         // set model to world transformation
-        // TODO: verify last row of the matrix being affine
-        // auto mat = model_to_world.ToArray();
-        std::array<float, 12> mat = {1, 0, 0, 0, 0, 1, 0, 0, 0, 0, 1, 0};
-        rtcSetGeometryTransform(rtc_geom, 0, RTC_FORMAT_FLOAT3X4_ROW_MAJOR, &mat);
+        std::array<float, 12> mat = ToEmbreeTransform(model_to_world);
+        rtcSetGeometryTransform(rtc_geom, 0, RTC_FORMAT_FLOAT3X4_ROW_MAJOR, mat.data());
 
         // finalize
         rtcCommitGeometry(rtc_geom);
@@ -260,13 +730,14 @@ namespace usami::ray
 
                 for (int i = 0; i < mesh->num_face; ++i)
                 {
-                    const Primitive* primitive =
+                    EmbreeTriangle* primitive =
                         InstantiatePrimitive(geom->Id(), i, mesh->GetTriangle(i));
                     const AreaLight* light =
                         arena_.Construct<DiffuseAreaLight>(primitive, emmisive_factor);
 
                     AddLightSource(light);
                     geom->area_lights.push_back(light);
+                    geom->light_primitives.push_back(primitive);
                 }
             }
         }
@@ -277,8 +748,59 @@ namespace usami::ray
     {
     }
 
-    Primitive* EmbreeScene::InstantiatePrimitive(unsigned geom_id, unsigned prim_id,
-                                                 const TriangleDesc& tri_desc)
+    void EmbreeScene::ResolveHit(const Ray& ray, float t, Vec3f ng, float u, float v,
+                                 unsigned geom_id, unsigned prim_id, IntersectionInfo& isect) const
+    {
+        const EmbreeMeshGeometry* geometry = geom_lookup_[geom_id];
+
+        // NOTE embree reports normals of instanced geometries in model space
+        isect.t     = t;
+        isect.point = ray.o + t * ray.d;
+        isect.ng    = geometry->NormalTransform().ApplyVector(ng).Normalize();
+
+        const TriangleDesc tri_desc = geometry->Mesh().GetTriangle(prim_id);
+
+        // override shading normal
+        if (tri_desc.has_normal)
+        {
+            Vec3f n0 = tri_desc.normals[0];
+            Vec3f n1 = tri_desc.normals[1];
+            Vec3f n2 = tri_desc.normals[2];
+
+            auto ww = 1 - u - v;
+
+            isect.ns =
+                geometry->NormalTransform().ApplyVector(ww * n0 + u * n1 + v * n2).Normalize();
+        }
+        else
+        {
+            isect.ns = isect.ng;
+        }
+
+        // override texture coordinate
+        if (tri_desc.has_tex_coord)
+        {
+            Vec2f uv0 = tri_desc.tex_coords[0];
+            Vec2f uv1 = tri_desc.tex_coords[1];
+            Vec2f uv2 = tri_desc.tex_coords[2];
+
+            auto ww = 1 - u - v;
+
+            isect.uv = ww * uv0 + u * uv1 + v * uv2;
+        }
+        else
+        {
+            isect.uv = {u, v};
+        }
+
+        isect.iface      = prim_id;
+        isect.primitive  = nullptr;
+        isect.area_light = geometry->GetAreaLight(prim_id);
+        isect.material   = geometry->GetMaterial();
+    }
+
+    EmbreeTriangle* EmbreeScene::InstantiatePrimitive(unsigned geom_id, unsigned prim_id,
+                                                      const TriangleDesc& tri_desc)
     {
         auto p = arena_.Construct<EmbreeTriangle>();
         CreatePrimitiveAux(*p, geom_id, prim_id, tri_desc);
@@ -302,9 +824,12 @@ namespace usami::ray
         p.geom_id_ = geom_id;
         p.prim_id_ = prim_id;
 
-        Vec3f v0 = tri_desc.vertices[0];
-        Vec3f v1 = tri_desc.vertices[1];
-        Vec3f v2 = tri_desc.vertices[2];
+        // vertices are stored in model space, while lights are sampled in world space
+        const Matrix4& model_to_world = geom_lookup_[geom_id]->Transform();
+
+        Vec3f v0 = model_to_world.ApplyPoint(tri_desc.vertices[0]);
+        Vec3f v1 = model_to_world.ApplyPoint(tri_desc.vertices[1]);
+        Vec3f v2 = model_to_world.ApplyPoint(tri_desc.vertices[2]);
 
         p.v0_ = v0;
         p.e1_ = v1 - v0;
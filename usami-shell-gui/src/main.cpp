@@ -2,13 +2,17 @@
 #include "usami/color.h"
 #include "usami/model.h"
 #include "usami/camera.h"
-#include "usami/raster/render.h"
+#include "usami/ray/camera.h"
+#include "usami/ray/canvas.h"
+#include "usami/ray/scene/embree.h"
+#include "usami/ray/integrator/normal_mapping.h"
+#include "usami/ray/renderer/tile.h"
 #include "quick_imgui.h"
 #include "imgui.h"
 #include <chrono>
 
 using namespace usami;
-using namespace usami::raster;
+using namespace usami::ray;
 
 namespace ImGui
 {
@@ -36,8 +40,6 @@ static constexpr int kCanvasWidth  = 600;
 static constexpr int kCanvasHeight = 600;
 
 usami::CameraSetting camera;
-float z_near;
-float z_far;
 
 Vec3f RotatePivot = {0.f, 1.f, 0.f};
 float RotateTheta = 0;
@@ -45,13 +47,26 @@ float Scale       = 1.f;
 
 static std::shared_ptr<SceneModel> model;
 
+// dynamic scene so that instances could be moved and refit every frame
+static std::unique_ptr<EmbreeScene> scene;
+
+// model to world transformation of each instance when the model is loaded
+static std::vector<Matrix4> instance_transforms;
+
 void LoadScene()
 {
     model = ParseModel("d:/models/duck/Duck.gltf");
 
+    scene = std::make_unique<EmbreeScene>(true);
+    scene->AddModel(model);
+    scene->Commit();
+
+    for (const EmbreeMeshGeometry* geom : scene->Geometries())
+    {
+        instance_transforms.push_back(geom->Transform());
+    }
+
     camera.position = {0, 0, -3};
-    z_near          = 1e-2f;
-    z_far           = 1e2f;
 }
 
 class MyApp : public Application
@@ -64,6 +79,9 @@ private:
     MemoryBuffer<ColorRGBA> img_data{kCanvasWidth * kCanvasHeight};
     Canvas canvas{kCanvasWidth, kCanvasHeight};
 
+    NormalMappingIntegrator integrator;
+    TileRenderer renderer{TileRenderSetting{.num_sample = 1}};
+
     TimePoint t0;
     float theta              = 0;
     Matrix4 rotate_transform = Matrix4::Identity();
@@ -79,18 +97,26 @@ public:
         rotate_transform =
             rotate_transform.Then(Matrix4::Rotate3D(RotatePivot, RotateTheta * timespan_s));
 
-        // scene->Root().SetTransform(rotate_transform * Matrix4::Scale3D(Scale));
-        // canvas.Clear(1.f);
-        // raster::Render(canvas, camera, z_near, z_far, [] { RenderSceneNode(scene->Root()); });
-
-        auto pcanvas = canvas.Buffer().Data();
-        auto pimg    = img_data.Data();
-        for (int i = 0; i < kCanvasWidth * kCanvasHeight; ++i)
+        Matrix4 model_transform = Matrix4::Scale3D(Scale).Then(rotate_transform);
+        for (const EmbreeMeshGeometry* geom : scene->Geometries())
         {
-            *pimg = SpectrumRGBToColor_Linear(Vec3f(pcanvas));
+            scene->SetTransform(geom->Id(),
+                                instance_transforms[geom->Id()].Then(model_transform));
+        }
+        scene->Refit();
 
-            pcanvas += 3;
-            pimg += 1;
+        canvas.Clear();
+        renderer.Render(canvas, PerspectiveCamera{camera, {kCanvasWidth, kCanvasHeight}}, *scene,
+                        integrator);
+
+        auto pimg = img_data.Data();
+        for (int y = 0; y < kCanvasHeight; ++y)
+        {
+            for (int x = 0; x < kCanvasWidth; ++x)
+            {
+                *pimg = SpectrumRGBToColor_Linear(canvas.GetPixel(x, y));
+                pimg += 1;
+            }
         }
 
         tex->UpdateRgba(img_data.Data());
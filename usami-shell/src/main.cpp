@@ -15,6 +15,7 @@
 #include "usami/ray/scene/embree.h"
 #include "usami/ray/integrator/path_tracing.h"
 #include "usami/ray/primitive/mesh.h"
+#include "usami/ray/renderer/tile.h"
 
 using namespace std;
 using namespace usami;
@@ -100,22 +101,9 @@ int main()
     Canvas canvas{resolution.x, resolution.y};
     PerspectiveCamera camera{camera_setting, resolution};
     PathTracingIntegrator integrator{};
-    RenderingContext ctx{};
-    Sampler sampler{0xdeadbeef};
-
-    for (int y = 0; y < resolution.y; ++y)
-    {
-        for (int x = 0; x < resolution.x; ++x)
-        {
-            Ray camera_ray = camera.SpawnRay({x, y}, sampler.Get2D());
-
-            for (int i = 0; i < num_sample; ++i)
-            {
-                SpectrumRGB pixel_radiance = integrator.Li(ctx, sampler, *scene, camera_ray);
-                canvas.AppendPixel(x, y, pixel_radiance);
-            }
-        }
-    }
+    TileRenderer renderer{TileRenderSetting{.num_sample = num_sample}};
+
+    renderer.Render(canvas, camera, *scene, integrator);
 
     canvas.SaveImage("d:/usami-test.png", 1.f / num_sample);
 }
\ No newline at end of file
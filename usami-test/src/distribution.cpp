@@ -0,0 +1,238 @@
+#include "test.h"
+#include "usami/math/distribution.h"
+#include <cmath>
+#include <cstdint>
+#include <vector>
+
+using namespace usami;
+
+namespace
+{
+    // number of stratified samples tallied for each distribution
+    constexpr int kNumSample = 200000;
+
+    // tally indices picked by `Sample` over stratified samples, and compare frequency of each
+    // index with its `Pmf`, as well as pdf reported by `Sample`
+    void ExpectSampleMatchPmf(const DiscrateDistribution& dist)
+    {
+        std::vector<int> counts(dist.Size(), 0);
+        for (int i = 0; i < kNumSample; ++i)
+        {
+            float pdf;
+            int index = dist.Sample((i + .5f) / kNumSample, pdf);
+
+            USAMI_EXPECT(index >= 0 && index < dist.Size());
+            USAMI_EXPECT(pdf == dist.Pmf(index));
+            counts[index] += 1;
+        }
+
+        float pmf_sum = 0;
+        for (int i = 0; i < dist.Size(); ++i)
+        {
+            USAMI_EXPECT_NEAR(static_cast<float>(counts[i]) / kNumSample, dist.Pmf(i), 1e-4f);
+            USAMI_EXPECT(dist.Pmf(i) > 0 || counts[i] == 0);
+            pmf_sum += dist.Pmf(i);
+        }
+
+        USAMI_EXPECT_NEAR(pmf_sum, 1.f, 1e-5f);
+    }
+
+    // indices of zero weight are never returned, including at edges of bins
+    void ExpectZeroWeightNeverSampled(const DiscrateDistribution& dist,
+                                      const std::vector<float>& weights)
+    {
+        int n = dist.Size();
+        for (int i = 0; i <= n; ++i)
+        {
+            float edge = static_cast<float>(i) / n;
+            for (float u : {edge, std::nextafter(edge, 0.f), std::nextafter(edge, 1.f)})
+            {
+                if (u < 0 || u >= 1)
+                {
+                    continue;
+                }
+
+                float pdf;
+                int index = dist.Sample(u, pdf);
+                USAMI_EXPECT(weights[index] > 0 && pdf > 0);
+            }
+        }
+    }
+
+    void TestWeights()
+    {
+        std::vector<float> weights = {1, 0, 3, 0, 6, 2, .5f, 0};
+        DiscrateDistribution dist{weights.data(), weights.data() + weights.size()};
+
+        USAMI_EXPECT(dist.Size() == static_cast<int>(weights.size()));
+        for (int i = 0; i < dist.Size(); ++i)
+        {
+            USAMI_EXPECT_NEAR(dist.Pmf(i), weights[i] / 12.5f, 1e-6f);
+        }
+
+        ExpectSampleMatchPmf(dist);
+        ExpectZeroWeightNeverSampled(dist, weights);
+    }
+
+    void TestManyWeights()
+    {
+        // weights spanning several orders of magnitude, where every fifth is zero
+        std::vector<float> weights(1000);
+        uint32_t state = 12345;
+        for (size_t i = 0; i < weights.size(); ++i)
+        {
+            state = state * 1664525u + 1013904223u;
+
+            float scale = static_cast<float>(1 << (i % 7 * 3));
+            weights[i]  = i % 5 == 0 ? 0.f : static_cast<float>(state >> 8) / (1 << 24) * scale;
+        }
+
+        DiscrateDistribution dist{weights.data(), weights.data() + weights.size()};
+        ExpectSampleMatchPmf(dist);
+        ExpectZeroWeightNeverSampled(dist, weights);
+    }
+
+    void TestDegenerateWeights()
+    {
+        // zero total weight gives a uniform distribution
+        std::vector<float> zeros(4, 0.f);
+        DiscrateDistribution dist_zero{zeros.data(), zeros.data() + zeros.size()};
+
+        USAMI_EXPECT(dist_zero.Size() == 4);
+        for (int i = 0; i < dist_zero.Size(); ++i)
+        {
+            USAMI_EXPECT(dist_zero.Pmf(i) == .25f);
+        }
+        ExpectSampleMatchPmf(dist_zero);
+
+        // an empty range gives a single bin, as does a default constructed one
+        DiscrateDistribution dist_empty{zeros.data(), zeros.data()};
+        DiscrateDistribution dist_default{};
+        for (const DiscrateDistribution* dist : {&dist_empty, &dist_default})
+        {
+            float pdf;
+            USAMI_EXPECT(dist->Size() == 1 && dist->Pmf(0) == 1);
+            USAMI_EXPECT(dist->Sample(0.f, pdf) == 0 && pdf == 1);
+            USAMI_EXPECT(dist->Sample(kOneMinusEpsilon, pdf) == 0 && pdf == 1);
+        }
+
+        // a single weight takes all the probability
+        float weight = 3.f;
+        DiscrateDistribution dist_single{&weight, &weight + 1};
+        USAMI_EXPECT(dist_single.Size() == 1 && dist_single.Pmf(0) == 1);
+        ExpectSampleMatchPmf(dist_single);
+
+        // reset replaces the whole table
+        std::vector<float> weights = {0, 2, 0};
+        dist_zero.Reset(weights.data(), weights.data() + weights.size());
+        USAMI_EXPECT(dist_zero.Size() == 3 && dist_zero.Pmf(1) == 1);
+        ExpectSampleMatchPmf(dist_zero);
+        ExpectZeroWeightNeverSampled(dist_zero, weights);
+    }
+
+    // tally cells hit by `Sample` over a stratified grid of samples, and compare frequency of each
+    // cell with `Pdf`, as well as pdf reported by `Sample`
+    void ExpectSampleMatchPdf(const Distribution2D& dist)
+    {
+        constexpr int kNumSampleAxis = 1000;
+
+        int width  = dist.Width();
+        int height = dist.Height();
+
+        std::vector<int> counts(static_cast<size_t>(width) * height, 0);
+        for (int j = 0; j < kNumSampleAxis; ++j)
+        {
+            for (int i = 0; i < kNumSampleAxis; ++i)
+            {
+                Point2f u = {(i + .5f) / kNumSampleAxis, (j + .5f) / kNumSampleAxis};
+
+                float pdf;
+                Point2f p = dist.Sample(u, pdf);
+                USAMI_EXPECT(p[0] >= 0 && p[0] < 1 && p[1] >= 0 && p[1] < 1);
+                USAMI_EXPECT(pdf > 0);
+                USAMI_EXPECT_NEAR(pdf, dist.Pdf(p), 1e-5f * pdf);
+
+                int col = Min(static_cast<int>(p[0] * width), width - 1);
+                int row = Min(static_cast<int>(p[1] * height), height - 1);
+                counts[static_cast<size_t>(row) * width + col] += 1;
+            }
+        }
+
+        // pdf is constant over a cell, so the cell takes pdf times its area, while frequency of a
+        // cell is off by at most a stratum along either axis
+        float pdf_integral = 0;
+        for (int row = 0; row < height; ++row)
+        {
+            for (int col = 0; col < width; ++col)
+            {
+                Point2f center = {(col + .5f) / width, (row + .5f) / height};
+                float p_cell   = dist.Pdf(center) / (width * height);
+                int count      = counts[static_cast<size_t>(row) * width + col];
+
+                USAMI_EXPECT_NEAR(static_cast<float>(count) / (kNumSampleAxis * kNumSampleAxis),
+                                  p_cell, 2.f / kNumSampleAxis);
+                USAMI_EXPECT(p_cell > 0 || count == 0);
+                pdf_integral += p_cell;
+            }
+        }
+
+        USAMI_EXPECT_NEAR(pdf_integral, 1.f, 1e-5f);
+    }
+
+    void TestDistribution2D()
+    {
+        // a row of zeros and scattered zero cells
+        std::vector<float> func = {
+            1, 0, 2, 3, 0, //
+            0, 0, 0, 0, 0, //
+            4, 1, 0, .5f, 8,
+        };
+        Distribution2D dist{func, 5, 3};
+
+        USAMI_EXPECT(dist.Width() == 5 && dist.Height() == 3);
+        for (int row = 0; row < 3; ++row)
+        {
+            for (int col = 0; col < 5; ++col)
+            {
+                Point2f center = {(col + .5f) / 5, (row + .5f) / 3};
+                USAMI_EXPECT_NEAR(dist.Pdf(center), func[row * 5 + col] / (19.5f / 15), 1e-5f);
+            }
+        }
+
+        ExpectSampleMatchPdf(dist);
+
+        // a single column and a single row
+        ExpectSampleMatchPdf(Distribution2D{{1, 0, 3, 2}, 1, 4});
+        ExpectSampleMatchPdf(Distribution2D{{0, 5, 1, 0, 2}, 5, 1});
+    }
+
+    void TestDegenerateDistribution2D()
+    {
+        // zero everywhere gives a uniform distribution
+        Distribution2D dist{std::vector<float>(12, 0.f), 4, 3};
+
+        float pdf;
+        Point2f p = dist.Sample({.3f, .8f}, pdf);
+        USAMI_EXPECT(pdf == 1 && dist.Pdf(p) == 1);
+        USAMI_EXPECT_NEAR(p[0], .3f, 1e-6f);
+        USAMI_EXPECT_NEAR(p[1], .8f, 1e-6f);
+        ExpectSampleMatchPdf(dist);
+
+        // reset replaces the whole distribution
+        dist.Reset({0, 0, 7, 0}, 2, 2);
+        USAMI_EXPECT(dist.Width() == 2 && dist.Height() == 2);
+        USAMI_EXPECT(dist.Pdf({.25f, .75f}) == 4 && dist.Pdf({.75f, .25f}) == 0);
+        ExpectSampleMatchPdf(dist);
+    }
+} // namespace
+
+int main()
+{
+    TestWeights();
+    TestManyWeights();
+    TestDegenerateWeights();
+    TestDistribution2D();
+    TestDegenerateDistribution2D();
+
+    return test::Result();
+}
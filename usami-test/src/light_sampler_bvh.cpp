@@ -0,0 +1,192 @@
+#include "test.h"
+#include "usami/ray/light/distant.h"
+#include "usami/ray/light/point.h"
+#include "usami/ray/light/spot.h"
+#include "usami/ray/light_sampler/bvh.h"
+#include <algorithm>
+#include <memory>
+#include <vector>
+
+using namespace usami;
+using namespace usami::ray;
+
+namespace
+{
+    // number of stratified samples tallied for each shading point
+    constexpr int kNumSample = 100000;
+
+    struct LightSet
+    {
+        std::vector<std::unique_ptr<Light>> storage;
+        std::vector<const Light*> lights;
+
+        template <typename T, typename... TArgs>
+        const Light* Add(TArgs&&... args)
+        {
+            storage.push_back(std::make_unique<T>(std::forward<TArgs>(args)...));
+            lights.push_back(storage.back().get());
+            return lights.back();
+        }
+    };
+
+    // tally lights picked by `Sample` over stratified samples, and compare frequency of each
+    // light with its `Pmf`, as well as pmf reported by `Sample`
+    void ExpectSampleMatchPmf(const BvhLightSampler& sampler, const LightSet& set, Vec3f p,
+                              Vec3f n)
+    {
+        std::vector<int> counts(set.lights.size(), 0);
+        int num_null = 0;
+        for (int i = 0; i < kNumSample; ++i)
+        {
+            float u = (i + .5f) / kNumSample;
+
+            float pmf;
+            const Light* light = sampler.Sample(p, n, u, pmf);
+            if (light == nullptr)
+            {
+                USAMI_EXPECT(pmf == 0);
+                num_null += 1;
+                continue;
+            }
+
+            auto it = std::find(set.lights.begin(), set.lights.end(), light);
+            USAMI_EXPECT(it != set.lights.end());
+            USAMI_EXPECT_NEAR(pmf, sampler.Pmf(p, n, light), 1e-5f);
+            counts[it - set.lights.begin()] += 1;
+        }
+
+        float pmf_sum = 0;
+        for (size_t i = 0; i < set.lights.size(); ++i)
+        {
+            float pmf = sampler.Pmf(p, n, set.lights[i]);
+            USAMI_EXPECT_NEAR(static_cast<float>(counts[i]) / kNumSample, pmf, 1e-3f);
+            USAMI_EXPECT(pmf > 0 || counts[i] == 0);
+            pmf_sum += pmf;
+        }
+
+        // samples either pick a light or none at all
+        USAMI_EXPECT(num_null == 0 || num_null == kNumSample);
+        USAMI_EXPECT_NEAR(pmf_sum, num_null == 0 ? 1.f : 0.f, 1e-4f);
+    }
+
+    void TestPointLights()
+    {
+        LightSet set;
+        for (int i = 0; i < 9; ++i)
+        {
+            float x = static_cast<float>(i % 3) * 2.f;
+            float y = static_cast<float>(i / 3) * 3.f;
+            set.Add<PointLight>(Vec3f{x, y, 2.f}, Vec3f{1.f + i, 1.f, 1.f});
+        }
+
+        BvhLightSampler sampler{set.lights};
+        ExpectSampleMatchPmf(sampler, set, Vec3f{0, 0, 0}, Vec3f{0, 0, 1});
+        ExpectSampleMatchPmf(sampler, set, Vec3f{2, 4, 1}, Vec3f{0, 1, 0});
+
+        // zero normal takes light from either side
+        ExpectSampleMatchPmf(sampler, set, Vec3f{5, -1, 3}, Vec3f{0, 0, 0});
+    }
+
+    void TestInfiniteLights()
+    {
+        LightSet set;
+        const Light* distant0 =
+            set.Add<DistantLight>(Vec3f{0, 0, -1}, Vec3f{1.f}, Vec3f{0.f}, 10.f);
+        const Light* distant1 =
+            set.Add<DistantLight>(Vec3f{1, 0, -1}, Vec3f{2.f}, Vec3f{0.f}, 10.f);
+        set.Add<PointLight>(Vec3f{0, 0, 2}, Vec3f{1.f});
+        set.Add<PointLight>(Vec3f{3, 0, 2}, Vec3f{4.f});
+
+        // the hierarchy as a whole is as likely as either unbounded light, whatever its power
+        BvhLightSampler sampler{set.lights};
+        Vec3f p = {1, 0, 0};
+        Vec3f n = {0, 0, 1};
+        USAMI_EXPECT_NEAR(sampler.Pmf(p, n, distant0), 1.f / 3, 1e-6f);
+        USAMI_EXPECT_NEAR(sampler.Pmf(p, n, distant1), 1.f / 3, 1e-6f);
+        ExpectSampleMatchPmf(sampler, set, p, n);
+
+        // unbounded lights alone are picked uniformly
+        LightSet set_infinite;
+        set_infinite.Add<DistantLight>(Vec3f{0, 0, -1}, Vec3f{1.f}, Vec3f{0.f}, 10.f);
+        set_infinite.Add<DistantLight>(Vec3f{0, 1, -1}, Vec3f{1.f}, Vec3f{0.f}, 10.f);
+        set_infinite.Add<DistantLight>(Vec3f{1, 0, -1}, Vec3f{1.f}, Vec3f{0.f}, 10.f);
+
+        BvhLightSampler sampler_infinite{set_infinite.lights};
+        for (const Light* light : set_infinite.lights)
+        {
+            USAMI_EXPECT_NEAR(sampler_infinite.Pmf(p, n, light), 1.f / 3, 1e-6f);
+        }
+        ExpectSampleMatchPmf(sampler_infinite, set_infinite, p, n);
+    }
+
+    void TestZeroImportance()
+    {
+        // spot lights facing away from the shading point can't reach it
+        LightSet set;
+        const Light* spot0 = set.Add<SpotLight>(Vec3f{0, 0, 2}, Vec3f{0, 0, 1}, .3f, Vec3f{1.f});
+        const Light* spot1 = set.Add<SpotLight>(Vec3f{2, 0, 2}, Vec3f{0, 0, 1}, .3f, Vec3f{1.f});
+
+        Vec3f p = {1, 0, 0};
+        Vec3f n = {0, 0, 1};
+        BvhLightSampler sampler{set.lights};
+        ExpectSampleMatchPmf(sampler, set, p, n);
+
+        float pmf;
+        USAMI_EXPECT(sampler.Sample(p, n, .5f, pmf) == nullptr && pmf == 0);
+        USAMI_EXPECT(sampler.Pmf(p, n, spot0) == 0 && sampler.Pmf(p, n, spot1) == 0);
+
+        // ones that can reach the point take all the probability
+        const Light* point = set.Add<PointLight>(Vec3f{1, 0, 3}, Vec3f{1.f});
+        const Light* spot2 = set.Add<SpotLight>(Vec3f{1, .3f, 2}, Vec3f{0, 0, -1}, .3f, Vec3f{1.f});
+        sampler.Reset(set.lights);
+        ExpectSampleMatchPmf(sampler, set, p, n);
+        USAMI_EXPECT(sampler.Pmf(p, n, spot0) == 0 && sampler.Pmf(p, n, spot1) == 0);
+        USAMI_EXPECT(sampler.Pmf(p, n, point) > 0 && sampler.Pmf(p, n, spot2) > 0);
+
+        // lights emitting no power are never picked
+        const Light* dark = set.Add<PointLight>(Vec3f{1, 0, 1}, Vec3f{0.f});
+        sampler.Reset(set.lights);
+        ExpectSampleMatchPmf(sampler, set, p, n);
+        USAMI_EXPECT(sampler.Pmf(p, n, dark) == 0);
+    }
+
+    void TestRootLeaf()
+    {
+        Vec3f p = {0, 0, 0};
+        Vec3f n = {0, 0, 1};
+
+        // a single light is the root of the hierarchy
+        LightSet set;
+        const Light* point = set.Add<PointLight>(Vec3f{0, 0, 2}, Vec3f{1.f});
+
+        BvhLightSampler sampler{set.lights};
+        float pmf;
+        USAMI_EXPECT(sampler.Sample(p, n, .5f, pmf) == point && pmf == 1);
+        USAMI_EXPECT(sampler.Pmf(p, n, point) == 1);
+        ExpectSampleMatchPmf(sampler, set, p, n);
+
+        // which is still never picked if it can't reach the point
+        LightSet set_spot;
+        const Light* spot =
+            set_spot.Add<SpotLight>(Vec3f{0, 0, 2}, Vec3f{0, 0, 1}, .3f, Vec3f{1.f});
+
+        BvhLightSampler sampler_spot{set_spot.lights};
+        USAMI_EXPECT(sampler_spot.Sample(p, n, .5f, pmf) == nullptr && pmf == 0);
+        USAMI_EXPECT(sampler_spot.Pmf(p, n, spot) == 0);
+
+        // and nothing is picked without any light
+        BvhLightSampler sampler_empty{};
+        USAMI_EXPECT(sampler_empty.Sample(p, n, .5f, pmf) == nullptr && pmf == 0);
+        USAMI_EXPECT(sampler_empty.Pmf(p, n, point) == 0);
+    }
+} // namespace
+
+int main()
+{
+    TestPointLights();
+    TestInfiniteLights();
+    TestZeroImportance();
+    TestRootLeaf();
+
+    return test::Result();
+}
@@ -0,0 +1,35 @@
+#pragma once
+#include <cmath>
+#include <cstdio>
+
+namespace usami::test
+{
+    // number of expectations failed so far, see `USAMI_EXPECT`
+    inline int num_failure = 0;
+
+    inline void ReportFailure(const char* file, int line, const char* what)
+    {
+        std::fprintf(stderr, "%s:%d: expectation failed: %s\n", file, line, what);
+        num_failure += 1;
+    }
+
+    /**
+     * Exit code of a test, i.e. non-zero if any expectation has failed
+     */
+    inline int Result()
+    {
+        if (num_failure > 0)
+        {
+            std::fprintf(stderr, "%d expectation(s) failed\n", num_failure);
+        }
+
+        return num_failure > 0 ? 1 : 0;
+    }
+} // namespace usami::test
+
+// unlike `USAMI_CHECK`, failures are counted in release builds too and fail the test on exit
+#define USAMI_EXPECT(CONDITION)                                                                    \
+    static_cast<void>(!!(CONDITION) ||                                                             \
+                      (::usami::test::ReportFailure(__FILE__, __LINE__, #CONDITION), 0))
+
+#define USAMI_EXPECT_NEAR(A, B, TOLERANCE) USAMI_EXPECT(std::abs((A) - (B)) <= (TOLERANCE))